@@ -0,0 +1,1683 @@
+/*
+ * bench.cpp - Offline benchmarks for the capture pipeline stages
+ *
+ * Usage: bench <benchmark> [options]
+ *
+ * Every benchmark runs on the images bundled with the repository so the
+ * numbers can be reproduced on the device without a camera attached.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv4/opencv2/opencv.hpp>
+
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "classifier.h"
+#include "event_loop.h"
+#include "event_recorder.h"
+#include "detection_publisher.h"
+#include "detection_subscriber.h"
+#include "duty_cycle.h"
+#include "frame_signature.h"
+#include "governor.h"
+#include "inference_scheduler.h"
+#include "metrics.h"
+#include "model_bundle.h"
+#include "mjpeg_container.h"
+#include "ncnn_inference.h"
+#include "perf_counters.h"
+#include "preview_server.h"
+#include "region_filter.h"
+#include "replay_source.h"
+#include "save_jpeg.h"
+#include "strip_encoder.h"
+#include "thread_placement.h"
+
+static const char *bundled_images[] = {
+	"code/bus.jpg",
+	"20250219_164023.jpg",
+	"output.jpg",
+};
+
+static const char *model_param = "code/yolo11n_ncnn_model/model.ncnn.param";
+static const char *model_bin = "code/yolo11n_ncnn_model/model.ncnn.bin";
+
+#ifndef MODEL_BUNDLE_PATH
+#define MODEL_BUNDLE_PATH "build/yolo11n.bundle"
+#endif
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double, std::milli> d = std::chrono::steady_clock::now() - start;
+	return d.count();
+}
+
+static std::vector<cv::Mat> load_bundled_images()
+{
+	std::vector<cv::Mat> images;
+	for (const char *path : bundled_images) {
+		cv::Mat image = cv::imread(path, cv::IMREAD_COLOR);
+		if (image.empty()) {
+			std::cerr << "Skipping unreadable image " << path << std::endl;
+			continue;
+		}
+		images.push_back(image);
+	}
+	return images;
+}
+
+/*
+ * Compare detect_batch() for batch sizes 1 to 8 against calling detect() on
+ * the same items one at a time.
+ */
+static int bench_detect_batch(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin) != 0)
+		return EXIT_FAILURE;
+
+	/* Warm up the allocators and the network. */
+	detector.detect(images[0]);
+
+	std::cout << "batch  sequential ms/item  batched ms/item  speedup" << std::endl;
+	for (int batch_size = 1; batch_size <= 8; batch_size++) {
+		std::vector<cv::Mat> batch;
+		for (int i = 0; i < batch_size; i++)
+			batch.push_back(images[i % images.size()]);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++)
+			for (const cv::Mat &image : batch)
+				detector.detect(image);
+		double sequential = elapsed_ms(start) / (iterations * batch_size);
+
+		start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++)
+			detector.detect_batch(batch);
+		double batched = elapsed_ms(start) / (iterations * batch_size);
+
+		printf("%5d  %19.2f  %15.2f  %6.2fx\n", batch_size, sequential,
+		       batched, sequential / batched);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static float iou(const cv::Rect_<float> &a, const cv::Rect_<float> &b)
+{
+	float inter = (a & b).area();
+	float uni = a.area() + b.area() - inter;
+	return uni > 0 ? inter / uni : 0.f;
+}
+
+/*
+ * Latency and accuracy at each supported input size. The repository has no
+ * labelled ground truth, so accuracy is the recall of the 640 detections
+ * (same class, IoU >= 0.5) on the bundled images. "first" is the first
+ * call at a new shape, "switch max" the worst call while alternating
+ * between the prepared sizes.
+ */
+static int bench_input_size(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin) != 0)
+		return EXIT_FAILURE;
+
+	const int sizes[] = { 320, 416, 480, 640 };
+
+	detector.target_size = detector.input_size();
+	std::vector<std::vector<Object>> reference;
+	for (const cv::Mat &image : images)
+		reference.push_back(detector.detect(image));
+
+	/* Start over so every shape is new to the allocator pools. */
+	Detector cold;
+	if (cold.load(model_param, model_bin) != 0)
+		return EXIT_FAILURE;
+
+	std::cout << "size  shape      first ms  mean ms  objects  recall@640" << std::endl;
+	for (int size : sizes) {
+		/* The model is a fixed-shape export, other sizes fail to infer. */
+		if (size != cold.input_size()) {
+			printf("%4d  not the %d the model was exported for\n", size,
+			       cold.input_size());
+			continue;
+		}
+
+		cold.target_size = size;
+		const cv::Mat &first = images[0];
+		cv::Size shape = letterbox_shape(size, first.cols, first.rows);
+
+		auto start = std::chrono::steady_clock::now();
+		cold.detect(first);
+		double firstMs = elapsed_ms(start);
+
+		for (const cv::Mat &image : images)
+			cold.prepare(size, image.cols, image.rows);
+
+		unsigned int objects = 0, matched = 0, expected = 0;
+		start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++) {
+			for (size_t i = 0; i < images.size(); i++) {
+				std::vector<Object> found = cold.detect(images[i]);
+				if (it)
+					continue;
+
+				objects += found.size();
+				expected += reference[i].size();
+				for (const Object &ref : reference[i]) {
+					for (const Object &obj : found) {
+						if (obj.label == ref.label && iou(obj.rect, ref.rect) >= 0.5f) {
+							matched++;
+							break;
+						}
+					}
+				}
+			}
+		}
+		double mean = elapsed_ms(start) / (iterations * images.size());
+
+		printf("%4d  %4dx%-4d  %8.2f  %7.2f  %7u  %9.1f%%\n", size, shape.width,
+		       shape.height, firstMs, mean, objects,
+		       expected ? 100.0 * matched / expected : 100.0);
+	}
+
+	double total = 0, worst = 0;
+	int calls = 0;
+	for (int it = 0; it < iterations; it++) {
+		for (int size : sizes) {
+			if (size != cold.input_size())
+				continue;
+
+			cold.target_size = size;
+			auto start = std::chrono::steady_clock::now();
+			cold.detect(images[it % images.size()]);
+			double ms = elapsed_ms(start);
+			total += ms;
+			worst = std::max(worst, ms);
+			calls++;
+		}
+	}
+	printf("switching every call: mean %.2f ms, switch max %.2f ms\n",
+	       total / calls, worst);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Whole-frame detection against detection on the bounding rectangle of a
+ * region of interest covering the central half of each bundled image, at
+ * the same input size. The gain is how many more source pixels each
+ * detector input pixel resolves inside the region.
+ */
+static int bench_roi(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin) != 0)
+		return EXIT_FAILURE;
+
+	RegionFilter regions({ { { 0.25f, 0.2f }, { 0.75f, 0.2f }, { 0.8f, 0.8f }, { 0.2f, 0.8f } } },
+			     { { { 0.45f, 0.45f }, { 0.55f, 0.45f }, { 0.55f, 0.55f }, { 0.45f, 0.55f } } });
+
+	std::cout << "image  size       crop       gain  full ms  roi ms  full objs  roi objs" << std::endl;
+	for (size_t i = 0; i < images.size(); i++) {
+		const cv::Mat &image = images[i];
+		cv::Rect crop = regions.crop(image.size());
+
+		detector.prepare(detector.target_size, image.cols, image.rows);
+		detector.prepare(detector.target_size, crop.width, crop.height);
+
+		std::vector<Object> full, roi;
+		auto start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++)
+			full = detector.detect(image);
+		double fullMs = elapsed_ms(start) / iterations;
+
+		start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++) {
+			roi = detector.detect(image(crop));
+			regions.apply(image.size(), crop, roi);
+		}
+		double roiMs = elapsed_ms(start) / iterations;
+
+		double gain = static_cast<double>(std::max(image.cols, image.rows)) /
+			      std::max(crop.width, crop.height);
+		printf("%5zu  %4dx%-4d  %4dx%-4d  %4.2fx  %7.2f  %6.2f  %9zu  %8zu\n", i,
+		       image.cols, image.rows, crop.width, crop.height, gain, fullMs,
+		       roiMs, full.size(), roi.size());
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Full-frame save_jpeg() against save_crops() on the detections of each
+ * bundled image. Files are written to a scratch directory under /tmp.
+ */
+static int bench_crop_save(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin) != 0)
+		return EXIT_FAILURE;
+
+	std::vector<std::vector<Object>> detections = detector.detect_batch(images);
+
+	char dir[] = "/tmp/bench_crop_save.XXXXXX";
+	if (!mkdtemp(dir) || chdir(dir)) {
+		std::cerr << "Failed to create scratch directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	CropSaveOptions options;
+
+	std::cout << "image  objects  full ms  full KiB  crops ms  crops KiB  time  bytes" << std::endl;
+	for (size_t i = 0; i < images.size(); i++) {
+		size_t fullBytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++)
+			fullBytes = save_jpeg(images[i], options.quality);
+		double full = elapsed_ms(start) / iterations;
+
+		size_t cropBytes = 0;
+		start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++)
+			cropBytes = save_crops(images[i], detections[i], options);
+		double crops = elapsed_ms(start) / iterations;
+
+		printf("%5zu  %7zu  %7.2f  %8.1f  %8.2f  %9.1f  %4.1fx  %4.1fx\n", i,
+		       detections[i].size(), full, fullBytes / 1024.0, crops,
+		       cropBytes / 1024.0, full / crops,
+		       cropBytes ? (double)fullBytes / cropBytes : 0.0);
+	}
+
+	std::cout << "Scratch files left in " << dir << std::endl;
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Write throughput of one file per frame, as save_jpeg() does, against
+ * appending to container segments. Both sides write the same pre-encoded
+ * JPEGs and are synced to disk before the clock stops.
+ */
+static int bench_container(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	std::vector<std::vector<unsigned char>> jpegs(images.size());
+	for (size_t i = 0; i < images.size(); i++)
+		encode_jpeg(images[i], 85, jpegs[i]);
+
+	char dir[] = "/tmp/bench_container.XXXXXX";
+	if (!mkdtemp(dir) || chdir(dir)) {
+		std::cerr << "Failed to create scratch directory" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const int frames = iterations * 20;
+	size_t bytes = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < frames; i++) {
+		const std::vector<unsigned char> &jpeg = jpegs[i % jpegs.size()];
+		char name[32];
+		snprintf(name, sizeof(name), "frame_%06d.jpg", i);
+		FILE *file = fopen(name, "wb");
+		if (!file)
+			return EXIT_FAILURE;
+		fwrite(jpeg.data(), 1, jpeg.size(), file);
+		fclose(file);
+		bytes += jpeg.size();
+	}
+	sync();
+	double perFile = elapsed_ms(start);
+
+	start = std::chrono::steady_clock::now();
+	{
+		MjpegWriter writer("segment", 64ull << 20);
+		for (int i = 0; i < frames; i++) {
+			const std::vector<unsigned char> &jpeg = jpegs[i % jpegs.size()];
+			writer.append(jpeg.data(), jpeg.size(), wallclock_ns(), i);
+		}
+	}
+	sync();
+	double container = elapsed_ms(start);
+
+	double megabytes = bytes / (1024.0 * 1024.0);
+	printf("%d frames, %.1f MiB\n", frames, megabytes);
+	printf("per-file   %8.1f ms  %7.1f MiB/s  %8.1f frames/s\n", perFile,
+	       megabytes * 1000 / perFile, frames * 1000 / perFile);
+	printf("container  %8.1f ms  %7.1f MiB/s  %8.1f frames/s\n", container,
+	       megabytes * 1000 / container, frames * 1000 / container);
+
+	std::cout << "Scratch files left in " << dir << std::endl;
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Publish-to-consume latency of the shared-memory detection ring, with the
+ * subscriber sleeping in FUTEX_WAIT between records as a real consumer
+ * would. Publishes 1000 * iterations records at roughly 1 kHz.
+ */
+static int bench_publish(int iterations)
+{
+	const char *name = "/radaria_bench";
+	const int records = 1000 * iterations;
+
+	DetectionPublisher publisher;
+	if (publisher.open(name))
+		return EXIT_FAILURE;
+
+	DetectionSubscriber subscriber;
+	if (subscriber.open(name))
+		return EXIT_FAILURE;
+
+	std::vector<double> latencies;
+	latencies.reserve(records);
+
+	std::thread consumer([&]() {
+		DetectionRecord record;
+		while ((int)latencies.size() < records && subscriber.next(record, 1000)) {
+			uint64_t now = monotonic_ns(std::chrono::steady_clock::now());
+			latencies.push_back((now - record.publishNs) / 1000.0);
+		}
+	});
+
+	std::vector<Object> objects(4);
+	for (size_t i = 0; i < objects.size(); i++)
+		objects[i] = { cv::Rect_<float>(10.f * i, 20.f, 64.f, 128.f), 0, 0.9f };
+
+	for (int i = 0; i < records; i++) {
+		Frame frame;
+		frame.sequence = i;
+		frame.timestamp = std::chrono::steady_clock::now();
+		publisher.publish(frame, objects);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	consumer.join();
+
+	if (latencies.empty())
+		return EXIT_FAILURE;
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("%zu records, %llu missed\n", latencies.size(),
+	       static_cast<unsigned long long>(subscriber.missed()));
+	printf("latency us: p50 %.1f  p99 %.1f  max %.1f\n",
+	       latencies[latencies.size() / 2],
+	       latencies[latencies.size() * 99 / 100], latencies.back());
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Preview server load test: 8 * iterations local clients stream from the
+ * server while frames are submitted at 30 fps for five seconds. One client
+ * in eight reads slowly and should only lose its own frames.
+ */
+static int bench_preview(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	EventLoop loop;
+	std::unique_ptr<PreviewServer> server = std::make_unique<PreviewServer>(loop);
+	server->setMaxFps(30);
+	if (server->listen("127.0.0.1", 0))
+		return EXIT_FAILURE;
+
+	const uint16_t port = server->port();
+	const int numClients = 8 * iterations;
+	std::vector<uint64_t> received(numClients);
+	std::vector<std::thread> clients;
+
+	for (int i = 0; i < numClients; i++) {
+		clients.emplace_back([&received, port, i]() {
+			int fd = socket(AF_INET, SOCK_STREAM, 0);
+			struct sockaddr_in addr = {};
+			addr.sin_family = AF_INET;
+			addr.sin_port = htons(port);
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+				close(fd);
+				return;
+			}
+
+			const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+			if (write(fd, request, sizeof(request) - 1) < 0) {
+				close(fd);
+				return;
+			}
+
+			char buffer[65536];
+			ssize_t n;
+			while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+				received[i] += n;
+				if (i % 8 == 7)
+					usleep(100000);
+			}
+			close(fd);
+		});
+	}
+
+	double maxSubmit = 0;
+	std::thread producer([&]() {
+		auto next = std::chrono::steady_clock::now();
+		for (int k = 0; k < 150; k++) {
+			Frame frame;
+			frame.sequence = k;
+			frame.timestamp = std::chrono::steady_clock::now();
+			frame.image = images[k % images.size()];
+
+			auto start = std::chrono::steady_clock::now();
+			server->submit(frame, {});
+			maxSubmit = std::max(maxSubmit, elapsed_ms(start));
+
+			next += std::chrono::milliseconds(33);
+			std::this_thread::sleep_until(next);
+		}
+		loop.exit();
+	});
+
+	loop.exec();
+	producer.join();
+
+	uint64_t encoded = server->encoded();
+	uint64_t sent = server->sent();
+	uint64_t dropped = server->dropped();
+
+	/* Closing the server disconnects the clients. */
+	server.reset();
+	for (std::thread &client : clients)
+		client.join();
+
+	uint64_t fast = 0, slow = 0;
+	for (int i = 0; i < numClients; i++)
+		(i % 8 == 7 ? slow : fast) += received[i];
+	int numSlow = numClients / 8;
+
+	printf("%d clients, %llu frames encoded, %llu sent, %llu dropped\n",
+	       numClients, (unsigned long long)encoded, (unsigned long long)sent,
+	       (unsigned long long)dropped);
+	printf("fast client KiB %.1f  slow client KiB %.1f  max submit %.2f ms\n",
+	       fast / 1024.0 / (numClients - numSlow),
+	       numSlow ? slow / 1024.0 / numSlow : 0.0, maxSubmit);
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Cost of a metric update on the hot path, with one and four threads
+ * hammering the same series, and the cost of rendering a scrape.
+ */
+static int bench_metrics(int iterations)
+{
+	MetricsRegistry registry;
+	Counter &counter = registry.counter("bench_total", "Benchmark counter");
+	Histogram &histogram = registry.histogram("bench_seconds", "Benchmark histogram");
+	for (int i = 0; i < 16; i++)
+		registry.histogram("bench_seconds", "Benchmark histogram",
+				   "source=\"" + std::to_string(i) + "\"");
+
+	const int updates = 100000 * iterations;
+
+	for (unsigned int threads : { 1u, 4u }) {
+		std::vector<std::thread> workers;
+
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned int t = 0; t < threads; t++)
+			workers.emplace_back([&counter, updates]() {
+				for (int i = 0; i < updates; i++)
+					counter.inc();
+			});
+		for (std::thread &worker : workers)
+			worker.join();
+		double counterNs = elapsed_ms(start) * 1e6 / updates;
+
+		workers.clear();
+		start = std::chrono::steady_clock::now();
+		for (unsigned int t = 0; t < threads; t++)
+			workers.emplace_back([&histogram, updates]() {
+				for (int i = 0; i < updates; i++)
+					histogram.observe((i % 1000) * 1e-4);
+			});
+		for (std::thread &worker : workers)
+			worker.join();
+		double histogramNs = elapsed_ms(start) * 1e6 / updates;
+
+		printf("%u thread(s): counter inc %.1f ns  histogram observe %.1f ns\n",
+		       threads, counterNs, histogramNs);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	size_t bytes = 0;
+	for (int i = 0; i < iterations; i++)
+		bytes += registry.render().size();
+	printf("render %.3f ms per scrape, %zu bytes\n",
+	       elapsed_ms(start) / iterations, bytes / iterations);
+
+	return EXIT_SUCCESS;
+}
+
+static long status_kib(const char *field)
+{
+	std::ifstream in("/proc/self/status");
+	std::string line;
+	while (std::getline(in, line))
+		if (line.compare(0, strlen(field), field) == 0)
+			return atol(line.c_str() + strlen(field) + 1);
+	return 0;
+}
+
+/*
+ * Cold model load from the text param and weights, a mapped bundle and
+ * the bundle linked into this executable, each in a fresh child process
+ * so that allocator state and page cache residency of one method cannot
+ * flatter the next. RSS is read after the load and after a first
+ * inference, which faults in weights that a bundle only references.
+ */
+static int bench_model_load(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	struct Method {
+		const char *name;
+		std::function<int(Detector &)> load;
+	};
+	const Method methods[] = {
+		{ "text", [](Detector &d) { return d.load(model_param, model_bin); } },
+		{ "bundle", [](Detector &d) { return d.load(ModelBundle::open(MODEL_BUNDLE_PATH)); } },
+		{ "embedded", [](Detector &d) { return d.load(ModelBundle::embedded()); } },
+	};
+
+	std::cout << "method    load ms  first ms  RSS KiB  peak KiB" << std::endl;
+	for (const Method &method : methods) {
+		for (int it = 0; it < iterations; it++) {
+			pid_t pid = fork();
+			if (pid < 0)
+				return EXIT_FAILURE;
+
+			if (pid == 0) {
+				Detector detector;
+				auto start = std::chrono::steady_clock::now();
+				if (method.load(detector))
+					_exit(EXIT_FAILURE);
+				double loadMs = elapsed_ms(start);
+
+				start = std::chrono::steady_clock::now();
+				detector.detect(images[0]);
+				double firstMs = elapsed_ms(start);
+
+				printf("%-8s  %7.1f  %8.1f  %7ld  %8ld\n", method.name, loadMs,
+				       firstMs, status_kib("VmRSS:"), status_kib("VmHWM:"));
+				fflush(stdout);
+				_exit(EXIT_SUCCESS);
+			}
+
+			int status;
+			waitpid(pid, &status, 0);
+			if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+				printf("%-8s  unavailable\n", method.name);
+				break;
+			}
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static double percentile(std::vector<double> values, double p)
+{
+	if (values.empty())
+		return 0;
+
+	size_t index = std::min(values.size() - 1,
+				static_cast<size_t>(p * (values.size() - 1) + 0.5));
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index];
+}
+
+/*
+ * Replay capture through the inference scheduler for `seconds` per run,
+ * with a background thread writing and syncing 1 MiB blocks the way a
+ * segment writer does, unplaced, pinned, and pinned with SCHED_FIFO
+ * capture. Each run is a fresh child process so that placement cannot
+ * leak into the next. Latency is capture to result, jitter the deviation
+ * of replay delivery intervals from the nominal frame period.
+ */
+static int bench_placement(int seconds)
+{
+	const double fps = 10.0;
+	const int cpus = std::max(1u, std::thread::hardware_concurrency());
+
+	/* Capture and I/O share core 0, inference gets the others. */
+	ThreadPlacement pinned;
+	pinned.capture = { 0 };
+	pinned.io = { 0 };
+	for (int cpu = cpus > 1 ? 1 : 0; cpu < cpus; cpu++)
+		pinned.inference.push_back(cpu);
+
+	ThreadPlacement realtime = pinned;
+	realtime.capturePriority = 10;
+
+	struct Run {
+		const char *name;
+		ThreadPlacement placement;
+	};
+	const Run runs[] = {
+		{ "none", ThreadPlacement() },
+		{ "pinned", pinned },
+		{ "fifo", realtime },
+	};
+
+	std::vector<std::string> paths(std::begin(bundled_images), std::end(bundled_images));
+
+	std::cout << "placement  frames  dropped  p50 ms  p99 ms  jitter ms  max jitter ms" << std::endl;
+	for (const Run &run : runs) {
+		pid_t pid = fork();
+		if (pid < 0)
+			return EXIT_FAILURE;
+
+		if (pid == 0) {
+			set_thread_placement(run.placement);
+
+			Detector detector;
+			if (detector.load(model_param, model_bin))
+				_exit(EXIT_FAILURE);
+			if (!run.placement.inference.empty())
+				detector.num_threads = run.placement.inference.size();
+
+			ReplaySource source(paths, fps);
+			if (source.load())
+				_exit(EXIT_FAILURE);
+
+			InferenceScheduler scheduler(detector, 1);
+			source.setId(scheduler.addSource(source.name()));
+
+			std::mutex lock;
+			std::vector<double> latencies;
+			std::vector<std::chrono::steady_clock::time_point> delivered;
+			scheduler.setResultHandler([&](const Frame &frame, const std::vector<Object> &) {
+				std::unique_lock<std::mutex> locker(lock);
+				latencies.push_back(elapsed_ms(frame.timestamp));
+			});
+			source.setFrameHandler([&](Frame &&frame) {
+				{
+					std::unique_lock<std::mutex> locker(lock);
+					delivered.push_back(frame.timestamp);
+				}
+				scheduler.submit(std::move(frame));
+			});
+
+			std::atomic<bool> writing(true);
+			std::thread writer([&writing]() {
+				place_current_thread(ThreadRole::Io);
+
+				std::vector<char> block(1 << 20, 'x');
+				int fd = open("bench_placement.tmp", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+				if (fd < 0)
+					return;
+				for (int i = 0; writing; i++) {
+					if (i % 64 == 0)
+						lseek(fd, 0, SEEK_SET);
+					if (write(fd, block.data(), block.size()) < 0)
+						break;
+					fdatasync(fd);
+				}
+				close(fd);
+				unlink("bench_placement.tmp");
+			});
+
+			scheduler.start();
+			source.start();
+			std::this_thread::sleep_for(std::chrono::seconds(seconds));
+			source.stop();
+			scheduler.stop();
+			writing = false;
+			writer.join();
+
+			std::vector<double> jitter;
+			for (size_t i = 1; i < delivered.size(); i++) {
+				std::chrono::duration<double, std::milli> interval =
+					delivered[i] - delivered[i - 1];
+				jitter.push_back(std::abs(interval.count() - 1000.0 / fps));
+			}
+
+			double jitterSum = 0;
+			for (double j : jitter)
+				jitterSum += j * j;
+
+			printf("%-9s  %6zu  %7lu  %6.1f  %6.1f  %9.2f  %13.2f\n", run.name,
+			       latencies.size(), static_cast<unsigned long>(source.dropped()),
+			       percentile(latencies, 0.5), percentile(latencies, 0.99),
+			       jitter.empty() ? 0 : std::sqrt(jitterSum / jitter.size()),
+			       jitter.empty() ? 0 : *std::max_element(jitter.begin(), jitter.end()));
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			printf("%-9s  unavailable\n", run.name);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Time the stages of the capture path on the bundled images: JPEG decode
+ * as done by replay, letterbox preprocessing, detection and JPEG encode.
+ * Also the training workload of the profile-guided build. Given the output
+ * of a previous run, typically of the default build, the speedup of each
+ * stage is reported against it.
+ */
+static int bench_stages(int iterations, const char *baseline)
+{
+	std::vector<std::vector<unsigned char>> files;
+	for (const char *path : bundled_images) {
+		std::ifstream in(path, std::ios::binary);
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(in)),
+						std::istreambuf_iterator<char>());
+		if (!data.empty())
+			files.push_back(std::move(data));
+	}
+
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty() || files.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin))
+		return EXIT_FAILURE;
+	detector.detect(images[0]);
+
+	struct Stage {
+		const char *name;
+		std::function<void()> run;
+		double ms;
+	};
+	std::vector<Stage> stages = {
+		{ "decode", [&]() {
+			for (const std::vector<unsigned char> &file : files)
+				cv::imdecode(file, cv::IMREAD_COLOR);
+		}, 0 },
+		{ "preprocess", [&]() {
+			DetectorInput input;
+			for (const cv::Mat &image : images)
+				detector.preprocess(image, detector.target_size, input);
+		}, 0 },
+		{ "detect", [&]() {
+			for (const cv::Mat &image : images)
+				detector.detect(image);
+		}, 0 },
+		{ "encode", [&]() {
+			std::vector<unsigned char> jpeg;
+			for (const cv::Mat &image : images)
+				encode_jpeg(image, 85, jpeg);
+		}, 0 },
+	};
+
+	for (Stage &stage : stages) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			stage.run();
+		stage.ms = elapsed_ms(start) / (iterations * images.size());
+	}
+
+	std::map<std::string, double> reference;
+	if (baseline) {
+		std::ifstream in(baseline);
+		std::string name;
+		double ms;
+		while (in >> name >> ms)
+			reference[name] = ms;
+	}
+
+	for (const Stage &stage : stages) {
+		printf("%-10s %9.3f", stage.name, stage.ms);
+		if (reference.count(stage.name) && stage.ms > 0)
+			printf("  %5.2fx", reference[stage.name] / stage.ms);
+		printf("\n");
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static void remove_files(const std::string &dir)
+{
+	DIR *d = opendir(dir.c_str());
+	if (!d)
+		return;
+	while (struct dirent *entry = readdir(d))
+		if (entry->d_name[0] != '.')
+			unlink((dir + "/" + entry->d_name).c_str());
+	closedir(d);
+	rmdir(dir.c_str());
+}
+
+/*
+ * Replay a sequence modelled on someone standing in view: for each bundled
+ * image, `iterations` frames with sensor noise, every third one motion
+ * blurred, followed by an empty scene, standing in for the background,
+ * for longer than the post-roll. Each
+ * image is one event. The same sequence is recorded keeping every frame,
+ * skipping near-duplicates, and keeping the best 3 shots per event, and
+ * the JPEG encodes and bytes written are compared.
+ */
+static int bench_dedup(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin))
+		return EXIT_FAILURE;
+
+	std::vector<int> classes;
+	std::vector<std::vector<Object>> detections;
+	for (cv::Mat &image : images) {
+		cv::resize(image, image, cv::Size(1280, 1280 * image.rows / image.cols));
+		detections.push_back(detector.detect(image));
+		for (const Object &obj : detections.back())
+			classes.push_back(obj.label);
+	}
+
+	std::vector<cv::Mat> backgrounds(images.size());
+	for (unsigned int i = 0; i < images.size(); i++)
+		cv::flip(images[i], backgrounds[i], 1);
+
+	/*
+	 * Frames are generated on the fly from a reseeded generator, so that
+	 * every mode sees the same sequence without holding it in memory.
+	 */
+	const std::vector<Object> none;
+	const int gap = 30;
+	auto replay = [&](const std::function<void(const cv::Mat &,
+						     const std::vector<Object> &)> &consume) {
+		cv::theRNG().state = 0x5eed;
+		cv::Mat noise, frame;
+		for (unsigned int i = 0; i < images.size(); i++) {
+			for (int f = 0; f < iterations + gap; f++) {
+				bool present = f < iterations;
+				noise.create(images[i].rows, images[i].cols, CV_8UC3);
+				cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(2));
+
+				cv::add(present ? images[i] : backgrounds[i], noise, frame);
+				if (present && f % 3 == 2)
+					cv::GaussianBlur(frame, frame, cv::Size(9, 9), 0);
+				consume(frame, present ? detections[i] : none);
+			}
+		}
+	};
+
+	double hashMs = 0;
+	unsigned int frames = 0;
+	replay([&](const cv::Mat &image, const std::vector<Object> &) {
+		auto start = std::chrono::steady_clock::now();
+		frame_dhash(image);
+		hashMs += elapsed_ms(start);
+		frames++;
+	});
+	printf("%u frames, dHash %.3f ms per %dx%d frame\n", frames, hashMs / frames,
+	       images[0].cols, images[0].rows);
+
+	struct Mode {
+		const char *name;
+		int dedupBits;
+		unsigned int bestShots;
+	};
+	const Mode modes[] = {
+		{ "all", -1, 0 },
+		{ "dedup", 5, 0 },
+		{ "dedup+best3", 5, 3 },
+	};
+
+	Counter &encodes = metrics().counter("radaria_jpeg_encodes_total",
+		"JPEG images compressed by output", "output=\"event\"");
+	Counter &written = metrics().counter("radaria_jpeg_bytes_written_total",
+		"JPEG bytes written to disk by output", "output=\"event\"");
+
+	double baseEncodes = 0, baseBytes = 0;
+	std::cout << "mode          encodes  files  MiB written  encode saved  bytes saved" << std::endl;
+	for (const Mode &mode : modes) {
+		char dir[] = "/tmp/bench_dedup_XXXXXX";
+		if (!mkdtemp(dir))
+			return EXIT_FAILURE;
+
+		uint64_t encodesBefore = encodes.value();
+		uint64_t writtenBefore = written.value();
+		unsigned int files = 0;
+		{
+			EventRecorder recorder(std::string(dir) + "/event", 64 << 20);
+			recorder.setTriggerClasses(classes);
+			recorder.setPreRoll(1.0);
+			recorder.setPostRoll(1.0);
+			recorder.setDeduplication(mode.dedupBits);
+			recorder.setBestShots(mode.bestShots);
+
+			auto timestamp = std::chrono::steady_clock::now();
+			uint64_t number = 0;
+			replay([&](const cv::Mat &image, const std::vector<Object> &objects) {
+				Frame frame;
+				frame.sequence = number++;
+				frame.timestamp = timestamp;
+				frame.image = image;
+				recorder.addFrame(frame, objects);
+				timestamp += std::chrono::milliseconds(100);
+			});
+			recorder.close();
+
+			DIR *d = opendir(dir);
+			while (struct dirent *entry = d ? readdir(d) : nullptr)
+				files += entry->d_name[0] != '.';
+			if (d)
+				closedir(d);
+		}
+		remove_files(dir);
+
+		double modeEncodes = encodes.value() - encodesBefore;
+		double modeBytes = written.value() - writtenBefore;
+		if (!baseEncodes) {
+			baseEncodes = modeEncodes;
+			baseBytes = modeBytes;
+		}
+
+		printf("%-12s  %7.0f  %5u  %11.1f  %11.1f%%  %10.1f%%\n", mode.name,
+		       modeEncodes, files, modeBytes / (1 << 20),
+		       baseEncodes ? 100.0 * (1 - modeEncodes / baseEncodes) : 0,
+		       baseBytes ? 100.0 * (1 - modeBytes / baseBytes) : 0);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/* Frame source paced by the caller, recording the durations asked of it. */
+class SimulatedSource : public FrameSource
+{
+public:
+	std::string name() const override { return "Simulated"; }
+	int start() override { return 0; }
+	void stop() override {}
+
+	int setFrameDuration(std::chrono::microseconds duration) override
+	{
+		duration_ = duration;
+		return 0;
+	}
+
+	std::chrono::microseconds duration_ = std::chrono::microseconds(0);
+};
+
+/*
+ * Pre-event ring integrity: noise frames of mixed sizes, which compress
+ * to JPEGs from a few percent to over half of a deliberately small ring,
+ * are stored untriggered so the ring keeps wrapping, and every tenth frame
+ * triggers a flush into a container. Each frame is also compressed here
+ * with the recorder's settings, and every frame read back from the
+ * container must match its own JPEG byte for byte.
+ */
+static int bench_ring(int iterations)
+{
+	const int quality = 85;
+	const size_t ringBytes = 96 << 10;
+
+	char dir[] = "/tmp/bench_ring_XXXXXX";
+	if (!mkdtemp(dir))
+		return EXIT_FAILURE;
+
+	tjhandle tj = tjInitCompress();
+	std::map<uint64_t, std::vector<unsigned char>> expected;
+	std::string segment;
+	unsigned int events = 0;
+	{
+		MjpegWriter writer(std::string(dir) + "/ring");
+		EventRecorder recorder(std::string(dir) + "/event", ringBytes, 16);
+		recorder.setTriggerClasses({ 0 });
+		recorder.setPreRoll(3600);
+		recorder.setPostRoll(0);
+		recorder.setQuality(quality);
+		recorder.setWriter(&writer);
+
+		std::mt19937 generator(0x5eed);
+		std::vector<Object> trigger(1);
+		trigger[0].label = 0;
+		trigger[0].prob = 0.9f;
+		const std::vector<Object> none;
+
+		auto timestamp = std::chrono::steady_clock::now();
+		for (int n = 0; n < iterations * 100; n++) {
+			int side = 32 + generator() % 160;
+			cv::Mat image(side, side + generator() % 64, CV_8UC3);
+			cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(256));
+
+			unsigned char *jpeg = nullptr;
+			unsigned long size = 0;
+			if (tjCompress2(tj, image.data, image.cols, (int)image.step, image.rows,
+					TJPF_BGR, &jpeg, &size, TJSAMP_420, quality,
+					TJFLAG_FASTDCT) < 0) {
+				std::cerr << "JPEG compression failed" << std::endl;
+				tjDestroy(tj);
+				remove_files(dir);
+				return EXIT_FAILURE;
+			}
+			expected[n].assign(jpeg, jpeg + size);
+			tjFree(jpeg);
+
+			bool triggered = n % 10 == 9;
+			events += triggered;
+
+			Frame frame;
+			frame.sequence = n;
+			frame.timestamp = timestamp;
+			frame.image = image;
+			recorder.addFrame(frame, triggered ? trigger : none);
+			timestamp += std::chrono::milliseconds(100);
+		}
+
+		recorder.close();
+		segment = writer.segmentPath();
+	}
+	tjDestroy(tj);
+
+	MjpegReader reader;
+	if (reader.open(segment)) {
+		remove_files(dir);
+		return EXIT_FAILURE;
+	}
+
+	unsigned int corrupt = 0;
+	for (size_t i = 0; i < reader.count(); i++) {
+		const IndexEntry &entry = reader.entry(i);
+		const std::vector<unsigned char> &jpeg = expected[entry.sequence];
+		if (jpeg.size() != entry.size ||
+		    memcmp(jpeg.data(), reader.frame(i), entry.size))
+			corrupt++;
+	}
+
+	printf("%u events, %zu frames written from a %zu KiB ring, %u corrupt\n",
+	       events, reader.count(), ringBytes >> 10, corrupt);
+
+	reader.close();
+	remove_files(dir);
+
+	return corrupt || !reader.count() ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * Drive the governor through a heat wave from a simulated temperature
+ * file, one control period per step, detecting on the bundled images at
+ * every level it picks. Fails if any period finds fewer objects than the
+ * level 0 run, as happens when a level hands the model a shape it cannot
+ * take, or if the governor never reaches the cheapest level and back.
+ */
+static int bench_governor(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	Detector detector;
+	if (detector.load(model_param, model_bin) != 0)
+		return EXIT_FAILURE;
+
+	size_t expected = 0;
+	for (const cv::Mat &image : images)
+		expected += detector.detect(image).size();
+
+	char path[] = "/tmp/bench_governor_XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0)
+		return EXIT_FAILURE;
+	close(fd);
+
+	auto setTemperature = [&path](double celsius) {
+		std::ofstream(path) << static_cast<long>(celsius * 1000) << std::endl;
+	};
+
+	EventLoop loop;
+	/* No latency target, so only the temperature moves the levels. */
+	Governor governor(loop, std::chrono::milliseconds(0));
+	governor.setThermalPath(path);
+	governor.setTemperatureLimits(75, 80);
+	governor.setLevelHandler([&detector](const GovernorLevel &level) {
+		detector.num_threads = level.threads;
+	});
+
+	/* Warm, then over the critical limit, then cooling down for good. */
+	std::vector<double> profile;
+	for (int i = 0; i < 5; i++)
+		profile.push_back(60);
+	for (double t = 60; t < 84; t += 2)
+		profile.push_back(t);
+	for (double t = 84; t > 60; t -= 1)
+		profile.push_back(t);
+	for (int i = 0; i < 60; i++)
+		profile.push_back(60);
+
+	setTemperature(profile[0]);
+	if (governor.start())
+		return EXIT_FAILURE;
+
+	unsigned int deepest = 0, starved = 0;
+	printf("period  temp C  level  threads  objects  mean ms\n");
+	for (size_t period = 0; period < profile.size(); period++) {
+		setTemperature(profile[period]);
+		governor.update();
+
+		const GovernorLevel &level = governor.level();
+		deepest = std::max(deepest, level.index);
+
+		size_t objects = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int it = 0; it < iterations; it++) {
+			for (const cv::Mat &image : images) {
+				auto begin = std::chrono::steady_clock::now();
+				std::vector<Object> found = detector.detect(image);
+				governor.observe(std::chrono::steady_clock::now() - begin);
+				if (!it)
+					objects += found.size();
+			}
+		}
+		double mean = elapsed_ms(start) / (iterations * images.size());
+
+		if (objects < expected)
+			starved++;
+		printf("%6zu  %6.0f  %5u  %7d  %7zu  %7.2f\n", period, profile[period],
+		       level.index, level.threads, objects, mean);
+	}
+
+	governor.stop();
+	unlink(path);
+
+	const unsigned int last = governor.levels().size() - 1;
+	printf("%u of %zu periods short of the %zu objects found at level 0, "
+	       "deepest level %u, final level %u\n", starved, profile.size(),
+	       expected, deepest, governor.level().index);
+
+	return starved || deepest != last || governor.level().index
+	       ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/* Package energy from RAPL in microjoules, -1 where it is not exposed. */
+static double energy_uj()
+{
+	std::ifstream in("/sys/class/powercap/intel-rapl:0/energy_uj");
+	double value;
+	return in >> value ? value : -1;
+}
+
+static double cpu_seconds()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * First a simulated hour at 10 fps full and 1 fps idle rate: a noisy
+ * static scene with three visits showing a detection and one passer-by
+ * showing only motion. The frames captured, the wake-up delay and
+ * the time at full rate are reported against capturing flat out.
+ *
+ * Then the real pipeline replays a static scene for `seconds` at full
+ * rate and duty cycled, each in a fresh child process, reporting the CPU
+ * time and, where RAPL is readable, the package energy per hour.
+ */
+static int bench_duty(int seconds)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.size() < 2)
+		return EXIT_FAILURE;
+
+	cv::Mat scene, visitor, passing;
+	cv::resize(images[0], scene, cv::Size(640, 640 * images[0].rows / images[0].cols));
+	cv::resize(images[1], visitor, scene.size());
+	cv::flip(scene, passing, 1);
+
+	const auto full = std::chrono::microseconds(100000);
+	const auto idle = std::chrono::microseconds(1000000);
+	const auto hour = std::chrono::hours(1);
+
+	struct Visit {
+		std::chrono::seconds start;
+		std::chrono::seconds length;
+		bool detection;
+	};
+	const Visit visits[] = {
+		{ std::chrono::seconds(600), std::chrono::seconds(20), true },
+		{ std::chrono::seconds(1500), std::chrono::seconds(60), true },
+		{ std::chrono::seconds(2400), std::chrono::seconds(5), true },
+		{ std::chrono::seconds(3000), std::chrono::seconds(10), false },
+	};
+
+	SimulatedSource source;
+	DutyCycle dutyCycle(source, idle, std::chrono::seconds(30));
+	if (dutyCycle.start())
+		return EXIT_FAILURE;
+
+	Object person = {};
+	person.rect = cv::Rect_<float>(100, 100, 80, 200);
+	person.prob = 0.8f;
+	const std::vector<Object> none, detected = { person };
+
+	cv::theRNG().state = 0x5eed;
+	cv::Mat noise, image;
+	const auto origin = std::chrono::steady_clock::time_point();
+	auto now = origin;
+	std::chrono::steady_clock::duration activeTime(0);
+	uint64_t frames = 0;
+	const Visit *current = nullptr;
+
+	printf("visit at   kind       wake-up s\n");
+	while (now - origin < hour) {
+		const Visit *visit = nullptr;
+		for (const Visit &v : visits)
+			if (now - origin >= v.start && now - origin < v.start + v.length)
+				visit = &v;
+
+		noise.create(scene.rows, scene.cols, CV_8UC3);
+		cv::randn(noise, cv::Scalar::all(0), cv::Scalar::all(2));
+		cv::add(visit ? (visit->detection ? visitor : passing) : scene, noise, image);
+
+		bool wasActive = dutyCycle.active();
+
+		Frame frame;
+		frame.sequence = frames++;
+		frame.timestamp = now;
+		frame.image = image;
+		dutyCycle.observe(frame, visit && visit->detection ? detected : none);
+
+		if (visit && visit != current && !wasActive && dutyCycle.active())
+			printf("%6llds   %-9s  %9.1f\n", static_cast<long long>(visit->start.count()),
+			       visit->detection ? "detection" : "motion",
+			       std::chrono::duration<double>(now - origin - visit->start).count());
+		if (visit)
+			current = visit;
+
+		auto duration = source.duration_.count() ? std::chrono::steady_clock::duration(source.duration_)
+							 : std::chrono::steady_clock::duration(full);
+		if (dutyCycle.active())
+			activeTime += duration;
+		now += duration;
+	}
+
+	uint64_t flatOut = hour / full;
+	printf("%llu of %llu frames captured (%.1f%%), %.0f s at full rate\n",
+	       static_cast<unsigned long long>(frames), static_cast<unsigned long long>(flatOut),
+	       100.0 * frames / flatOut, std::chrono::duration<double>(activeTime).count());
+
+	const char *scenePath = "bench_duty_scene.png";
+	if (!cv::imwrite(scenePath, scene))
+		return EXIT_FAILURE;
+
+	printf("\nmode   frames  CPU s  CPU s/hour  energy J/hour\n");
+	for (bool cycled : { false, true }) {
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid < 0)
+			break;
+
+		if (pid == 0) {
+			Detector detector;
+			if (detector.load(model_param, model_bin))
+				_exit(EXIT_FAILURE);
+
+			ReplaySource replay({ scenePath }, 1e6 / full.count());
+			if (replay.load())
+				_exit(EXIT_FAILURE);
+
+			InferenceScheduler scheduler(detector, 1);
+			replay.setId(scheduler.addSource(replay.name()));
+
+			DutyCycle replayCycle(replay, idle, std::chrono::seconds(30));
+			if (cycled && replayCycle.start())
+				_exit(EXIT_FAILURE);
+
+			std::atomic<uint64_t> inferred(0);
+			scheduler.setResultHandler([&](const Frame &frame, const std::vector<Object> &objects) {
+				if (cycled)
+					replayCycle.observe(frame, objects);
+				inferred++;
+			});
+			replay.setFrameHandler([&scheduler](Frame &&frame) {
+				scheduler.submit(std::move(frame));
+			});
+
+			/* Warm up so that model loading stays out of the figures. */
+			detector.detect(scene);
+
+			double cpuStart = cpu_seconds();
+			double energyStart = energy_uj();
+			auto start = std::chrono::steady_clock::now();
+
+			scheduler.start();
+			replay.start();
+			std::this_thread::sleep_for(std::chrono::seconds(seconds));
+			replay.stop();
+			scheduler.stop();
+
+			double scale = 3600 / (elapsed_ms(start) / 1000);
+			double cpu = cpu_seconds() - cpuStart;
+			double energy = energy_uj();
+			printf("%-5s  %6llu  %5.1f  %10.0f  ", cycled ? "duty" : "full",
+			       static_cast<unsigned long long>(inferred.load()), cpu, cpu * scale);
+			if (energyStart < 0 || energy < energyStart)
+				printf("%13s\n", "n/a");
+			else
+				printf("%13.0f\n", (energy - energyStart) / 1e6 * scale);
+			fflush(stdout);
+			_exit(EXIT_SUCCESS);
+		}
+
+		int status;
+		waitpid(pid, &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			printf("%-5s  unavailable\n", cycled ? "duty" : "full");
+	}
+
+	unlink(scenePath);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Encode a full-resolution 3280x2464 frame, upscaled from the first
+ * bundled image, with cv::imencode() and in strips on 1 to 4 threads.
+ * Each strip encode is decoded again and compared with the one-thread
+ * output to check that the stitched stream is valid.
+ */
+static int bench_jpeg_strips(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	if (images.empty())
+		return EXIT_FAILURE;
+
+	cv::Mat frame;
+	cv::resize(images[0], frame, cv::Size(3280, 2464));
+
+	auto median_ms = [&](const std::function<bool(std::vector<unsigned char> &)> &encode,
+			     std::vector<unsigned char> &jpeg) {
+		std::vector<double> times;
+		for (int i = 0; i < iterations; i++) {
+			auto start = std::chrono::steady_clock::now();
+			if (!encode(jpeg))
+				return -1.0;
+			times.push_back(elapsed_ms(start));
+		}
+		return percentile(times, 0.5);
+	};
+
+	std::vector<unsigned char> jpeg;
+	double baseline = median_ms([&](std::vector<unsigned char> &out) {
+		return cv::imencode(".jpg", frame, out, { cv::IMWRITE_JPEG_QUALITY, 85 });
+	}, jpeg);
+	printf("%dx%d, median of %d\n", frame.cols, frame.rows, iterations);
+	printf("encoder    ms     speedup  KiB    max diff\n");
+	printf("imencode   %6.1f  %6.2fx  %5zu  -\n", baseline, 1.0, jpeg.size() >> 10);
+
+	cv::Mat reference;
+	double single = 0;
+	for (unsigned int threads = 1; threads <= 4; threads++) {
+		StripEncoder encoder(threads);
+		double ms = median_ms([&](std::vector<unsigned char> &out) {
+			return encoder.encode(frame, 85, out);
+		}, jpeg);
+		if (ms < 0)
+			return EXIT_FAILURE;
+		if (threads == 1)
+			single = ms;
+
+		cv::Mat decoded = cv::imdecode(jpeg, cv::IMREAD_COLOR);
+		if (decoded.size() != frame.size()) {
+			printf("strips %u: output does not decode\n", threads);
+			return EXIT_FAILURE;
+		}
+		if (reference.empty())
+			reference = decoded;
+
+		double maxDiff = cv::norm(decoded, reference, cv::NORM_INF);
+		printf("strips %u   %6.1f  %6.2fx  %5zu  %.0f\n", threads, ms, single / ms,
+		       jpeg.size() >> 10, maxDiff);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Per-frame cost of the classifier cascade on a 10 fps replay of each
+ * bundled image, `iterations` frames each, with and without per-track
+ * caching. The detections of each image are computed once and jittered
+ * by a few pixels and a few points of confidence per frame, as a stable
+ * scene comes out of the detector.
+ */
+static int bench_cascade(int iterations, const char *model)
+{
+	const char *comma = model ? strchr(model, ',') : nullptr;
+	if (!comma) {
+		std::cerr << "Usage: bench cascade [iterations] PARAM,BIN" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string param(model, comma), bin(comma + 1);
+
+	std::vector<cv::Mat> images = load_bundled_images();
+	Detector detector;
+	Classifier classifier;
+	if (images.empty() || detector.load(model_param, model_bin) ||
+	    classifier.load(param, bin))
+		return EXIT_FAILURE;
+
+	std::vector<std::vector<Object>> detections;
+	size_t boxes = 0;
+	for (const cv::Mat &image : images) {
+		detections.push_back(detector.detect(image));
+		boxes += detections.back().size();
+	}
+	printf("%zu images, %zu detections, %d frames each\n", images.size(), boxes, iterations);
+
+	Counter &classifiedTotal = metrics().counter("radaria_classifier_crops_total",
+		"Detections given a second-stage class", "result=\"classified\"");
+
+	std::cout << "mode       ms/frame  crops/frame  classified" << std::endl;
+	for (bool caching : { false, true }) {
+		ClassifierCascade cascade(classifier, {});
+		cascade.setCaching(caching);
+
+		std::mt19937 generator(0);
+		std::uniform_real_distribution<float> jitter(-1.f, 1.f);
+		auto timestamp = std::chrono::steady_clock::now();
+		double totalMs = 0;
+		uint64_t frames = 0;
+		uint64_t classified = classifiedTotal.value();
+
+		for (unsigned int i = 0; i < images.size(); i++) {
+			for (int f = 0; f < iterations; f++) {
+				std::vector<Object> objects = detections[i];
+				for (Object &obj : objects) {
+					obj.rect.x += 2 * jitter(generator);
+					obj.rect.y += 2 * jitter(generator);
+					obj.prob += 0.02f * jitter(generator);
+				}
+
+				Frame frame;
+				frame.source = 0;
+				frame.sequence = frames++;
+				frame.timestamp = timestamp;
+				frame.image = images[i];
+
+				auto start = std::chrono::steady_clock::now();
+				cascade.process(frame, objects);
+				totalMs += elapsed_ms(start);
+
+				timestamp += std::chrono::milliseconds(100);
+			}
+			/* The next image is a new scene, its tracks start afresh. */
+			timestamp += std::chrono::seconds(5);
+		}
+
+		classified = classifiedTotal.value() - classified;
+		printf("%-9s  %8.2f  %11.2f  %10llu\n", caching ? "cached" : "uncached",
+		       totalMs / frames, static_cast<double>(classified) / frames,
+		       static_cast<unsigned long long>(classified));
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Detect and encode the bundled images with counting off, then on, to
+ * show what counting costs, and report the counters of the second run.
+ * ncnn runs on a single thread so the forward pass is counted whole.
+ */
+static int bench_perf(int iterations)
+{
+	std::vector<cv::Mat> images = load_bundled_images();
+	Detector detector;
+	if (images.empty() || detector.load(model_param, model_bin))
+		return EXIT_FAILURE;
+	detector.num_threads = 1;
+	detector.detect(images[0]);
+
+	auto run = [&]() {
+		std::vector<unsigned char> jpeg;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			for (const cv::Mat &image : images) {
+				detector.detect(image);
+				encode_jpeg(image, 85, jpeg);
+			}
+		}
+		return elapsed_ms(start) / (iterations * images.size());
+	};
+
+	double off = run();
+	if (perf_counters_enable())
+		return EXIT_FAILURE;
+	perf_counters_reset();
+	double on = run();
+
+	printf("counters off %8.3f ms/image\n", off);
+	printf("counters on  %8.3f ms/image  %+.2f%%\n\n", on, 100 * (on - off) / off);
+	perf_counters_report(std::cout);
+
+	return EXIT_SUCCESS;
+}
+
+static void usage()
+{
+	std::cerr << "Usage: bench <benchmark> [iterations] [baseline]" << std::endl
+		  << "Benchmarks:" << std::endl
+		  << "  detect_batch   detect() vs detect_batch() for batch sizes 1-8" << std::endl
+		  << "  input_size     latency and recall at input sizes 320-640" << std::endl
+		  << "  roi            whole frame vs region of interest detection" << std::endl
+		  << "  crop_save      full-frame save_jpeg() vs save_crops()" << std::endl
+		  << "  container      one file per frame vs container segments" << std::endl
+		  << "  publish        detection ring publish-to-consume latency" << std::endl
+		  << "  preview        preview server load test with many local clients" << std::endl
+		  << "  metrics        metric update and scrape overhead" << std::endl
+		  << "  model_load     text model vs mapped and embedded bundles" << std::endl
+		  << "  stages         per-image stage times, with speedup over a baseline run" << std::endl
+		  << "  dedup          event frames encoded and written with dedup and best shots" << std::endl
+		  << "  ring           pre-event ring wrapping, flushed frames checked byte for byte" << std::endl
+		  << "  governor       governor levels under a simulated heat wave, detections checked" << std::endl
+		  << "  placement      replay latency and jitter over N seconds, with and without placement" << std::endl
+		  << "  perf           hardware counters per stage, and the cost of counting" << std::endl
+		  << "  cascade        classifier cascade cost per frame with and without caching" << std::endl
+		  << "  jpeg_strips    full-resolution JPEG encode on 1 to 4 threads" << std::endl
+		  << "  duty           idle duty cycling, simulated and CPU and energy over N seconds" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	std::string name = argv[1];
+	int iterations = argc > 2 ? std::max(1, atoi(argv[2])) : 10;
+
+	if (name == "detect_batch")
+		return bench_detect_batch(iterations);
+	if (name == "input_size")
+		return bench_input_size(iterations);
+	if (name == "roi")
+		return bench_roi(iterations);
+	if (name == "crop_save")
+		return bench_crop_save(iterations);
+	if (name == "container")
+		return bench_container(iterations);
+	if (name == "publish")
+		return bench_publish(iterations);
+	if (name == "preview")
+		return bench_preview(iterations);
+	if (name == "metrics")
+		return bench_metrics(iterations);
+	if (name == "model_load")
+		return bench_model_load(iterations);
+	if (name == "stages")
+		return bench_stages(iterations, argc > 3 ? argv[3] : nullptr);
+	if (name == "dedup")
+		return bench_dedup(iterations);
+	if (name == "ring")
+		return bench_ring(iterations);
+	if (name == "governor")
+		return bench_governor(iterations);
+	if (name == "placement")
+		return bench_placement(iterations);
+	if (name == "cascade")
+		return bench_cascade(iterations, argc > 3 ? argv[3] : nullptr);
+	if (name == "perf")
+		return bench_perf(iterations);
+	if (name == "jpeg_strips")
+		return bench_jpeg_strips(iterations);
+	if (name == "duty")
+		return bench_duty(iterations);
+
+	usage();
+	return EXIT_FAILURE;
+}
@@ -5,441 +5,1159 @@
  * A simple libcamera capture example
  */
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <sstream>
 
-// Include for mmap, munmap, etc.
-#include <sys/mman.h>
+#include <getopt.h>
 
 #include <libcamera/libcamera.h>
-#include <libcamera/formats.h>
 #include <opencv4/opencv2/core.hpp>
 #include <opencv4/opencv2/opencv.hpp>
 #include "ncnn_inference.h"
 
+#include "camera_source.h"
+#include "classifier.h"
+#include "detection_publisher.h"
+#include "duty_cycle.h"
 #include "event_loop.h"
+#include "event_recorder.h"
+#include "event_store.h"
+#include "frame_signature.h"
+#include "governor.h"
+#include "inference_scheduler.h"
+#include "mjpeg_container.h"
+#include "metrics.h"
+#include "model_bundle.h"
+#include "perf_counters.h"
+#include "preview_server.h"
+#include "region_filter.h"
+#include "runtime_config.h"
+#include "startup_profiler.h"
+#include "thread_placement.h"
+#include "replay_source.h"
+#include "retention.h"
 #include "save_jpeg.h"
+#include "sensor_mode.h"
 
 #define TIMEOUT_SEC 1
+/* Full readout of the IMX219, for cameras that list no sensor modes. */
 #define CAM_WIDTH 3280
 #define CAM_HEIGHT 2464
 
+#define MODEL_PARAM "code/yolo11n_ncnn_model/model.ncnn.param"
+#define MODEL_BIN "code/yolo11n_ncnn_model/model.ncnn.bin"
+
 using namespace libcamera;
-static std::shared_ptr<Camera> camera;
 static EventLoop loop;
 
-/*
- * --------------------------------------------------------------------
- * Handle RequestComplete
- *
- * For each Camera::requestCompleted Signal emitted from the Camera the
- * connected Slot is invoked.
- *
- * The Slot is invoked in the CameraManager's thread, hence one should avoid
- * any heavy processing here. The processing of the request shall be re-directed
- * to the application's thread instead, so as not to block the CameraManager's
- * thread for large amount of time.
- *
- * The Slot receives the Request as a parameter.
- */
+struct Options
+{
+	/* Camera indices to open, empty for none. */
+	std::vector<unsigned int> cameras;
+	bool allCameras = false;
+	/* One replay source per entry, each a list of image paths. */
+	std::vector<std::vector<std::string>> replays;
+	double replayFps = 10.0;
+	std::vector<unsigned int> weights;
+	unsigned int workers = 1;
+	/*
+	 * Detector input size, the side of the square letterboxed input. Only
+	 * the size the model was exported for works, 0 picks it.
+	 */
+	int inputSize = 0;
+	/* Normalised polygons restricting detection on every source. */
+	std::vector<RegionFilter::Polygon> regions;
+	std::vector<RegionFilter::Polygon> exclusions;
+	unsigned int timeout = TIMEOUT_SEC;
+	/* Event recording, enabled when trigger classes are given. */
+	std::vector<int> recordClasses;
+	double preRoll = 5.0;
+	double postRoll = 5.0;
+	unsigned int ringMegabytes = 64;
+	int quality = 85;
+	/* Threads encoding each full-resolution JPEG, in strips. */
+	unsigned int jpegThreads = 1;
+	/* Skip frames within N dHash bits of the last saved one, -1 to save all. */
+	int dedupBits = -1;
+	/* Keep the best K frames of each recorded event, 0 for all. */
+	unsigned int bestShots = 0;
+	/* Save only padded detection crops instead of full frames. */
+	bool saveCrops = false;
+	/* Save nothing outside of events, for inference-only operation. */
+	bool saveFrames = true;
+	CropSaveOptions crops;
+	/* Append frames to segmented containers instead of one file each. */
+	std::string container;
+	unsigned int segmentMegabytes = 256;
+	unsigned int segmentSeconds = 600;
+	/* Quota on media in the working directory, 0 for unlimited. */
+	uint64_t keepMegabytes = 0;
+	uint64_t keepFiles = 0;
+	/* Indexed log of every detection, empty to disable. */
+	std::string eventStore;
+	/* Local publication of detections and frames, empty to disable. */
+	std::string publishName;
+	std::string publishFrames;
+	/* MJPEG preview over HTTP, port 0 to disable. */
+	uint16_t previewPort = 0;
+	std::string previewAddress = "127.0.0.1";
+	int previewWidth = 640;
+	double previewFps = 5.0;
 
-static void processRequest(Request *request);
+	/* Prometheus /metrics endpoint, port 0 to disable. */
+	uint16_t metricsPort = 0;
+	std::string metricsAddress = "127.0.0.1";
 
-static void requestComplete(Request *request)
-{
-	if (request->status() == Request::RequestCancelled)
-		return;
+	/* Adaptive thermal and latency governor. */
+	bool governor = false;
+	unsigned int latencyTarget = 500;
+	std::string thermalPath = "/sys/class/thermal/thermal_zone0/temp";
 
-	loop.callLater(std::bind(&processRequest, request));
-}
+	/* Frame rate of quiet scenes, 0 to always capture at full rate. */
+	double idleFps = 0;
+	unsigned int idleAfter = 30;
 
-static void processRequest(Request *request)
-{
-	std::cout << std::endl
-		  << "Request completed: " << request->toString() << std::endl;
+	/* Second-stage classifier on detection crops, disabled without a model. */
+	std::string classifierParam;
+	std::string classifierBin;
+	std::string classifierLabels;
+	std::vector<int> classifyClasses;
+	double reclassifySeconds = 2.0;
+	float reclassifyDelta = 0.15f;
 
-	/*
-	 * When a request has completed, it is populated with a metadata control
-	 * list that allows an application to determine various properties of
-	 * the completed request. This can include the timestamp of the Sensor
-	 * capture, or its gain and exposure values, or properties from the IPA
-	 * such as the state of the 3A algorithms.
-	 *
-	 * ControlValue types have a toString, so to examine each request, print
-	 * all the metadata for inspection. A custom application can parse each
-	 * of these items and process them according to its needs.
-	 */
-	const ControlList &requestMetadata = request->metadata();
-	for (const auto &ctrl : requestMetadata) {
-		const ControlId *id = controls::controls.at(ctrl.first);
-		const ControlValue &value = ctrl.second;
-        if (id->name() == "FrameWallClock") {
-            std::cout << "\t" << id->name() << " = " << value.toString()
-			  << std::endl;
-        }
-	}
+	/* Count cycles, cache and branch misses per stage, printed at exit. */
+	bool perfCounters = false;
 
-	/*
-	 * Each buffer has its own FrameMetadata to describe its state, or the
-	 * usage of each buffer. While in our simple capture we only provide one
-	 * buffer per request, a request can have a buffer for each stream that
-	 * is established when configuring the camera.
-	 *
-	 * This allows a viewfinder and a still image to be processed at the
-	 * same time, or to allow obtaining the RAW capture buffer from the
-	 * sensor along with the image as processed by the ISP.
-	 */
-	const Request::BufferMap &buffers = request->buffers();
-	for (auto bufferPair : buffers) {
-        const Stream *stream = bufferPair.first;
-		FrameBuffer *buffer = bufferPair.second;
-		const FrameMetadata &metadata = buffer->metadata();
-        StreamConfiguration const &cfg = stream->configuration();
+	/* Binary model bundle, "embedded" for the copy linked in. */
+	std::string modelBundle;
 
-		/*
-		 * Image data can be accessed here, but the FrameBuffer
-		 * must be mapped by the application
-		 */
-		void *mappedBuffer = mmap(NULL, buffer->planes()[0].length, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->planes()[0].fd.get(), 0);
-        if (mappedBuffer == MAP_FAILED) {
-            std::cerr << "Failed to map buffer memory: " << strerror(errno) << std::endl;
-            break;
-        }
-        //unsigned char* rgbBuffer = reinterpret_cast<unsigned char*>(mappedBuffer);
-        uint8_t *ptr = static_cast<uint8_t *>(mappedBuffer);
-		
-        cv::Mat image(cfg.size.height, cfg.size.width, CV_8UC3, ptr, cfg.stride);
-
-        //perform_inference(image);
-		//save_jpeg(rgbBuffer, CAM_WIDTH, CAM_HEIGHT);
-		save_jpeg(image);
-		munmap(mappedBuffer, buffer->planes()[0].length);
-	}
+	/* Load the model and warm up while the cameras are brought up. */
+	bool fastStart = false;
+
+	/* Watched configuration file overriding the options above. */
+	std::string configPath;
+
+	/* Cores per thread role and capture real-time priority. */
+	ThreadPlacement placement;
+};
 
-	/* Re-queue the Request to the camera. */
-	request->reuse(Request::ReuseBuffers);
-	camera->queueRequest(request);
+static std::vector<std::string> splitList(const std::string &list)
+{
+	std::vector<std::string> items;
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			items.push_back(item);
+	return items;
+}
+
+static void usage(const char *argv0)
+{
+	std::cerr << "Usage: " << argv0 << " [options]" << std::endl
+		  << "  -c, --camera all|N[,N...]  cameras to open (default 0)" << std::endl
+		  << "  -r, --replay FILE[,FILE]   add a replay source looping over the images" << std::endl
+		  << "  -f, --fps N                replay frame rate (default 10)" << std::endl
+		  << "  -w, --weight W[,W...]      scheduler weight per source, in source order" << std::endl
+		  << "  -j, --workers N            inference worker threads (default 1)" << std::endl
+		  << "  -t, --timeout SEC          capture duration (default " << TIMEOUT_SEC << ")" << std::endl
+		  << "  -e, --record CLASS[,CLASS] only save events showing these classes" << std::endl
+		  << "      --pre-roll SEC         seconds kept before an event (default 5)" << std::endl
+		  << "      --post-roll SEC        seconds saved after the last trigger (default 5)" << std::endl
+		  << "      --ring-mb N            pre-event ring size per source (default 64)" << std::endl
+		  << "      --dedup BITS           skip frames within BITS of the last saved one (0-64)" << std::endl
+		  << "      --best-shots K         save only the K best frames of each event" << std::endl
+		  << "  -q, --quality Q            JPEG quality of recorded frames and crops (default 85)" << std::endl
+		  << "      --jpeg-threads N       encode large frames in N parallel strips (default 1)" << std::endl
+		  << "  -s, --save full|crops|none save full frames, detection crops or nothing (default full)" << std::endl
+		  << "      --crop-padding F       margin around crops as a fraction of the box (default 0.15)" << std::endl
+		  << "      --thumbnail-width N    width of the crop context image, 0 to disable (default 320)" << std::endl
+		  << "  -o, --container PREFIX     write frames to PREFIX_<time>.mjpc segments" << std::endl
+		  << "      --segment-mb N         rotate segments at N MiB (default 256)" << std::endl
+		  << "      --segment-sec N        rotate segments after N seconds (default 600)" << std::endl
+		  << "      --keep-mb N            delete the oldest media beyond N MiB" << std::endl
+		  << "      --keep-files N         delete the oldest media beyond N files" << std::endl
+		  << "      --event-store PATH     log every detection to an indexed store at PATH" << std::endl
+		  << "  -p, --publish NAME         publish detections to shared memory NAME" << std::endl
+		  << "      --publish-frames PATH  pass frame buffers to clients of socket PATH" << std::endl
+		  << "      --preview PORT         serve an MJPEG preview on PORT" << std::endl
+		  << "      --preview-address ADDR preview listen address (default 127.0.0.1)" << std::endl
+		  << "      --preview-width N      preview width in pixels (default 640)" << std::endl
+		  << "      --preview-fps N        maximum preview frame rate (default 5)" << std::endl
+		  << "      --metrics PORT         serve Prometheus metrics on PORT" << std::endl
+		  << "      --metrics-address ADDR metrics listen address (default 127.0.0.1)" << std::endl
+		  << "      --input-size N         detector input size, the model's export size (default)" << std::endl
+		  << "      --roi POLYGON          detect only inside \"x,y x,y x,y ...\" (0-1, repeatable)" << std::endl
+		  << "      --exclude POLYGON      drop detections centred inside POLYGON (repeatable)" << std::endl
+		  << "      --classifier PARAM,BIN second-stage classifier run on detection crops" << std::endl
+		  << "      --classifier-labels FILE classifier class names, one per line" << std::endl
+		  << "      --classify CLASS[,CLASS] detections to classify (default all)" << std::endl
+		  << "      --reclassify-sec SEC   reuse a track's class for SEC seconds (default 2)" << std::endl
+		  << "      --reclassify-delta P   or until its confidence moves by P (default 0.15)" << std::endl
+		  << "      --perf-counters        report hardware counters per stage at exit" << std::endl
+		  << "      --model-bundle PATH    load the model from a binary bundle, or \"embedded\"" << std::endl
+		  << "      --fast-start           load the model concurrently with camera bring-up" << std::endl
+		  << "      --config FILE          load settings from FILE and reload it on change" << std::endl
+		  << "      --governor             adapt rate, threads and quality to heat and load" << std::endl
+		  << "      --latency-target MS    governor p90 latency target (default 500)" << std::endl
+		  << "      --thermal-path PATH    temperature file read by the governor" << std::endl
+		  << "      --idle-fps N           capture at N fps until motion or a detection" << std::endl
+		  << "      --idle-after SEC       return to the idle rate after SEC quiet seconds (default 30)" << std::endl
+		  << "      --pin ROLE=CPUS        run capture, inference or io threads on CPUS (repeatable)" << std::endl
+		  << "      --rt-priority N        SCHED_FIFO priority of the capture threads" << std::endl;
 }
 
+enum {
+	OptPreRoll = 256,
+	OptPostRoll,
+	OptRingMegabytes,
+	OptCropPadding,
+	OptThumbnailWidth,
+	OptSegmentMegabytes,
+	OptSegmentSeconds,
+	OptKeepMegabytes,
+	OptKeepFiles,
+	OptPublishFrames,
+	OptPreview,
+	OptPreviewAddress,
+	OptPreviewWidth,
+	OptPreviewFps,
+	OptMetrics,
+	OptMetricsAddress,
+	OptInputSize,
+	OptRoi,
+	OptExclude,
+	OptModelBundle,
+	OptFastStart,
+	OptConfig,
+	OptGovernor,
+	OptLatencyTarget,
+	OptThermalPath,
+	OptPin,
+	OptRtPriority,
+	OptDedup,
+	OptBestShots,
+	OptEventStore,
+	OptIdleFps,
+	OptIdleAfter,
+	OptJpegThreads,
+	OptClassifier,
+	OptClassifierLabels,
+	OptClassify,
+	OptReclassifySeconds,
+	OptReclassifyDelta,
+	OptPerfCounters,
+};
+
 /*
- * ----------------------------------------------------------------------------
- * Camera Naming.
- *
- * Applications are responsible for deciding how to name cameras, and present
- * that information to the users. Every camera has a unique identifier, though
- * this string is not designed to be friendly for a human reader.
- *
- * To support human consumable names, libcamera provides camera properties
- * that allow an application to determine a naming scheme based on its needs.
- *
- * In this example, we focus on the location property, but also detail the
- * model string for external cameras, as this is more likely to be visible
- * information to the user of an externally connected device.
- *
- * The unique camera ID is appended for informative purposes.
+ * Input size the model to be loaded at startup was exported for, read the
+ * way load_detector() picks the model, or -1 if it cannot be read.
  */
-std::string cameraName(Camera *camera)
+static int model_input_size(const std::string &modelBundle)
+{
+	std::shared_ptr<const ModelBundle> bundle;
+	if (modelBundle == "embedded" || (modelBundle.empty() && ModelBundle::embedded()))
+		bundle = ModelBundle::embedded();
+	else if (!modelBundle.empty())
+		bundle = ModelBundle::open(modelBundle);
+	else
+		return param_input_size(MODEL_PARAM);
+
+	return bundle ? bundle->inputSize() : -1;
+}
+
+static int parseOptions(int argc, char **argv, Options &options)
 {
-	const ControlList &props = camera->properties();
-	std::string name;
+	static const struct option longOptions[] = {
+		{ "camera", required_argument, nullptr, 'c' },
+		{ "replay", required_argument, nullptr, 'r' },
+		{ "fps", required_argument, nullptr, 'f' },
+		{ "weight", required_argument, nullptr, 'w' },
+		{ "workers", required_argument, nullptr, 'j' },
+		{ "timeout", required_argument, nullptr, 't' },
+		{ "record", required_argument, nullptr, 'e' },
+		{ "pre-roll", required_argument, nullptr, OptPreRoll },
+		{ "post-roll", required_argument, nullptr, OptPostRoll },
+		{ "ring-mb", required_argument, nullptr, OptRingMegabytes },
+		{ "quality", required_argument, nullptr, 'q' },
+		{ "save", required_argument, nullptr, 's' },
+		{ "crop-padding", required_argument, nullptr, OptCropPadding },
+		{ "thumbnail-width", required_argument, nullptr, OptThumbnailWidth },
+		{ "container", required_argument, nullptr, 'o' },
+		{ "segment-mb", required_argument, nullptr, OptSegmentMegabytes },
+		{ "segment-sec", required_argument, nullptr, OptSegmentSeconds },
+		{ "keep-mb", required_argument, nullptr, OptKeepMegabytes },
+		{ "keep-files", required_argument, nullptr, OptKeepFiles },
+		{ "publish", required_argument, nullptr, 'p' },
+		{ "publish-frames", required_argument, nullptr, OptPublishFrames },
+		{ "preview", required_argument, nullptr, OptPreview },
+		{ "preview-address", required_argument, nullptr, OptPreviewAddress },
+		{ "preview-width", required_argument, nullptr, OptPreviewWidth },
+		{ "preview-fps", required_argument, nullptr, OptPreviewFps },
+		{ "metrics", required_argument, nullptr, OptMetrics },
+		{ "metrics-address", required_argument, nullptr, OptMetricsAddress },
+		{ "input-size", required_argument, nullptr, OptInputSize },
+		{ "roi", required_argument, nullptr, OptRoi },
+		{ "exclude", required_argument, nullptr, OptExclude },
+		{ "model-bundle", required_argument, nullptr, OptModelBundle },
+		{ "fast-start", no_argument, nullptr, OptFastStart },
+		{ "config", required_argument, nullptr, OptConfig },
+		{ "governor", no_argument, nullptr, OptGovernor },
+		{ "latency-target", required_argument, nullptr, OptLatencyTarget },
+		{ "thermal-path", required_argument, nullptr, OptThermalPath },
+		{ "pin", required_argument, nullptr, OptPin },
+		{ "rt-priority", required_argument, nullptr, OptRtPriority },
+		{ "dedup", required_argument, nullptr, OptDedup },
+		{ "best-shots", required_argument, nullptr, OptBestShots },
+		{ "event-store", required_argument, nullptr, OptEventStore },
+		{ "idle-fps", required_argument, nullptr, OptIdleFps },
+		{ "idle-after", required_argument, nullptr, OptIdleAfter },
+		{ "jpeg-threads", required_argument, nullptr, OptJpegThreads },
+		{ "classifier", required_argument, nullptr, OptClassifier },
+		{ "classifier-labels", required_argument, nullptr, OptClassifierLabels },
+		{ "classify", required_argument, nullptr, OptClassify },
+		{ "reclassify-sec", required_argument, nullptr, OptReclassifySeconds },
+		{ "reclassify-delta", required_argument, nullptr, OptReclassifyDelta },
+		{ "perf-counters", no_argument, nullptr, OptPerfCounters },
+		{ "help", no_argument, nullptr, 'h' },
+		{ nullptr, 0, nullptr, 0 },
+	};
 
-	const auto &location = props.get(properties::Location);
-	if (location) {
-		switch (*location) {
-		case properties::CameraLocationFront:
-			name = "Internal front camera";
+	bool cameraGiven = false;
+	int opt;
+	while ((opt = getopt_long(argc, argv, "c:r:f:w:j:t:e:q:s:o:p:h", longOptions, nullptr)) != -1) {
+		switch (opt) {
+		case 'c':
+			cameraGiven = true;
+			if (std::string(optarg) == "all") {
+				options.allCameras = true;
+				break;
+			}
+			for (const std::string &index : splitList(optarg))
+				options.cameras.push_back(std::stoul(index));
+			break;
+		case 'r':
+			options.replays.push_back(splitList(optarg));
+			break;
+		case 'f':
+			options.replayFps = std::stod(optarg);
+			break;
+		case 'w':
+			for (const std::string &weight : splitList(optarg))
+				options.weights.push_back(std::stoul(weight));
+			break;
+		case 'j':
+			options.workers = std::stoul(optarg);
+			break;
+		case 't':
+			options.timeout = std::stoul(optarg);
+			break;
+		case 'e':
+			for (const std::string &name : splitList(optarg)) {
+				int label = class_index(name);
+				if (label < 0) {
+					std::cerr << "Unknown class " << name << std::endl;
+					return -1;
+				}
+				options.recordClasses.push_back(label);
+			}
+			break;
+		case OptPreRoll:
+			options.preRoll = std::stod(optarg);
+			break;
+		case OptPostRoll:
+			options.postRoll = std::stod(optarg);
+			break;
+		case OptRingMegabytes:
+			options.ringMegabytes = std::stoul(optarg);
+			break;
+		case 'q':
+			options.quality = std::stoi(optarg);
+			options.crops.quality = options.quality;
+			break;
+		case 's':
+			if (std::string(optarg) == "crops") {
+				options.saveCrops = true;
+			} else if (std::string(optarg) == "none") {
+				options.saveFrames = false;
+			} else if (std::string(optarg) != "full") {
+				usage(argv[0]);
+				return -1;
+			}
+			break;
+		case OptCropPadding:
+			options.crops.padding = std::stof(optarg);
+			break;
+		case OptThumbnailWidth:
+			options.crops.thumbnailWidth = std::stoi(optarg);
+			break;
+		case 'o':
+			options.container = optarg;
+			break;
+		case OptSegmentMegabytes:
+			options.segmentMegabytes = std::stoul(optarg);
+			break;
+		case OptSegmentSeconds:
+			options.segmentSeconds = std::stoul(optarg);
+			break;
+		case OptKeepMegabytes:
+			options.keepMegabytes = std::stoull(optarg);
+			break;
+		case OptKeepFiles:
+			options.keepFiles = std::stoull(optarg);
+			break;
+		case 'p':
+			options.publishName = optarg;
+			break;
+		case OptPublishFrames:
+			options.publishFrames = optarg;
+			break;
+		case OptPreview:
+			options.previewPort = std::stoul(optarg);
+			break;
+		case OptPreviewAddress:
+			options.previewAddress = optarg;
+			break;
+		case OptPreviewWidth:
+			options.previewWidth = std::stoi(optarg);
+			break;
+		case OptPreviewFps:
+			options.previewFps = std::stod(optarg);
+			break;
+		case OptMetrics:
+			options.metricsPort = std::stoul(optarg);
+			break;
+		case OptMetricsAddress:
+			options.metricsAddress = optarg;
+			break;
+		case OptInputSize:
+			options.inputSize = std::stoi(optarg);
+			if (!valid_input_size(options.inputSize)) {
+				std::cerr << "Input size must be a multiple of 32 up to 1280" << std::endl;
+				return -1;
+			}
 			break;
-		case properties::CameraLocationBack:
-			name = "Internal back camera";
+		case OptRoi:
+		case OptExclude: {
+			RegionFilter::Polygon polygon;
+			if (!RegionFilter::parsePolygon(optarg, polygon)) {
+				std::cerr << "Invalid polygon '" << optarg << "'" << std::endl;
+				return -1;
+			}
+			(opt == OptRoi ? options.regions : options.exclusions).push_back(polygon);
 			break;
-		case properties::CameraLocationExternal:
-			name = "External camera";
-			const auto &model = props.get(properties::Model);
-			if (model)
-				name = " '" + *model + "'";
+		}
+		case OptModelBundle:
+			options.modelBundle = optarg;
+			break;
+		case OptFastStart:
+			options.fastStart = true;
+			break;
+		case OptConfig:
+			options.configPath = optarg;
+			break;
+		case OptGovernor:
+			options.governor = true;
+			break;
+		case OptLatencyTarget:
+			options.latencyTarget = std::stoul(optarg);
+			break;
+		case OptThermalPath:
+			options.thermalPath = optarg;
+			break;
+		case OptPin:
+			if (parse_thread_pin(optarg, options.placement)) {
+				std::cerr << "Invalid pin '" << optarg << "'" << std::endl;
+				return -1;
+			}
+			break;
+		case OptDedup:
+			options.dedupBits = std::stoi(optarg);
+			if (options.dedupBits < 0 || options.dedupBits > 64) {
+				std::cerr << "Deduplication distance must be between 0 and 64 bits" << std::endl;
+				return -1;
+			}
+			break;
+		case OptBestShots:
+			options.bestShots = std::stoul(optarg);
+			break;
+		case OptEventStore:
+			options.eventStore = optarg;
+			break;
+		case OptIdleFps:
+			options.idleFps = std::stod(optarg);
+			if (options.idleFps < 0) {
+				std::cerr << "Idle frame rate must not be negative" << std::endl;
+				return -1;
+			}
+			break;
+		case OptIdleAfter:
+			options.idleAfter = std::stoul(optarg);
+			break;
+		case OptJpegThreads:
+			options.jpegThreads = std::max(1ul, std::stoul(optarg));
+			break;
+		case OptClassifier: {
+			std::vector<std::string> paths = splitList(optarg);
+			if (paths.size() != 2) {
+				std::cerr << "Classifier must be given as PARAM,BIN" << std::endl;
+				return -1;
+			}
+			options.classifierParam = paths[0];
+			options.classifierBin = paths[1];
 			break;
 		}
+		case OptClassifierLabels:
+			options.classifierLabels = optarg;
+			break;
+		case OptClassify:
+			for (const std::string &name : splitList(optarg)) {
+				int label = class_index(name);
+				if (label < 0) {
+					std::cerr << "Unknown class " << name << std::endl;
+					return -1;
+				}
+				options.classifyClasses.push_back(label);
+			}
+			break;
+		case OptReclassifySeconds:
+			options.reclassifySeconds = std::stod(optarg);
+			break;
+		case OptReclassifyDelta:
+			options.reclassifyDelta = std::stof(optarg);
+			break;
+		case OptPerfCounters:
+			options.perfCounters = true;
+			break;
+		case OptRtPriority:
+			options.placement.capturePriority = std::stoi(optarg);
+			if (options.placement.capturePriority < 0 ||
+			    options.placement.capturePriority > 99) {
+				std::cerr << "Real-time priority must be between 0 and 99" << std::endl;
+				return -1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	/* The container holds saved frames and event recordings, it needs one. */
+	if (!options.saveFrames && options.recordClasses.empty() &&
+	    !options.container.empty()) {
+		std::cerr << "--container needs frames to hold, from --save or --record"
+			  << std::endl;
+		return -1;
+	}
+
+	/* The model is a fixed-shape export, it takes no other input size. */
+	int modelSize = model_input_size(options.modelBundle);
+	if (modelSize < 0) {
+		std::cerr << "Cannot read the input size of the model" << std::endl;
+		return -1;
+	}
+	if (options.inputSize && options.inputSize != modelSize) {
+		std::cerr << "The model was exported for a " << modelSize
+			  << " input, --input-size " << options.inputSize
+			  << " cannot be used" << std::endl;
+		return -1;
 	}
+	options.inputSize = modelSize;
 
-	name += " (" + camera->id() + ")";
+	/* Without any source selected, behave as before and use camera 0. */
+	if (!cameraGiven && options.replays.empty())
+		options.cameras.push_back(0);
 
-	return name;
+	return 0;
 }
 
-int main()
+/*
+ * Load the detector from the configured bundle if any, else from the text
+ * param and weights. Without either option, a bundle linked into the
+ * executable is preferred.
+ */
+static int load_detector(Detector &detector, const RuntimeConfig &settings)
 {
-	/*
-	 * --------------------------------------------------------------------
-	 * Create a Camera Manager.
-	 *
-	 * The Camera Manager is responsible for enumerating all the Camera
-	 * in the system, by associating Pipeline Handlers with media entities
-	 * registered in the system.
-	 *
-	 * The CameraManager provides a list of available Cameras that
-	 * applications can operate on.
-	 *
-	 * When the CameraManager is no longer to be used, it should be deleted.
-	 * We use a unique_ptr here to manage the lifetime automatically during
-	 * the scope of this function.
-	 *
-	 * There can only be a single CameraManager constructed within any
-	 * process space.
-	 */
-	std::unique_ptr<CameraManager> cm = std::make_unique<CameraManager>();
-	cm->start();
+	if (settings.modelBundle == "embedded")
+		return detector.load(ModelBundle::embedded());
+	if (!settings.modelBundle.empty())
+		return detector.load(ModelBundle::open(settings.modelBundle));
+
+	return detector.load(settings.modelParam, settings.modelBin);
+}
+
+/* Detections of one frame as event store entries, boxes relative to the frame. */
+static std::vector<EventDetection> event_detections(const Frame &frame,
+						    const std::vector<Object> &objects)
+{
+	std::vector<EventDetection> detections;
+	const float w = frame.image.cols;
+	const float h = frame.image.rows;
+	if (w <= 0 || h <= 0)
+		return detections;
+
+	detections.reserve(objects.size());
+	for (const Object &obj : objects)
+		detections.push_back({ obj.label, obj.prob, obj.rect.x / w, obj.rect.y / h,
+				       obj.rect.width / w, obj.rect.height / h });
+	return detections;
+}
+
+int main(int argc, char **argv)
+{
+	StartupProfiler profiler;
+	profiler.mark("main");
+
+	Options options;
+	if (parseOptions(argc, argv, options))
+		return EXIT_FAILURE;
 
 	/*
-	 * Just as a test, generate names of the Cameras registered in the
-	 * system, and list them.
+	 * Every role thread applies its placement when it starts. The main
+	 * thread only takes the capture placement once it becomes the event
+	 * loop, so that the threads it creates until then do not inherit it.
 	 */
-	for (auto const &camera : cm->cameras())
-		std::cout << " - " << cameraName(camera.get()) << std::endl;
+	set_thread_placement(options.placement);
+	set_jpeg_threads(options.jpegThreads);
+	if (options.perfCounters)
+		perf_counters_enable();
 
 	/*
-	 * --------------------------------------------------------------------
-	 * Camera
-	 *
-	 * Camera are entities created by pipeline handlers, inspecting the
-	 * entities registered in the system and reported to applications
-	 * by the CameraManager.
-	 *
-	 * In general terms, a Camera corresponds to a single image source
-	 * available in the system, such as an image sensor.
-	 *
-	 * Application lock usage of Camera by 'acquiring' them.
-	 * Once done with it, application shall similarly 'release' the Camera.
-	 *
-	 * As an example, use the first available camera in the system after
-	 * making sure that at least one camera is available.
-	 *
-	 * Cameras can be obtained by their ID or their index, to demonstrate
-	 * this, the following code gets the ID of the first camera; then gets
-	 * the camera associated with that ID (which is of course the same as
-	 * cm->cameras()[0]).
+	 * Settings that may change at runtime are read from the current
+	 * configuration snapshot, which starts from the command line and is
+	 * replaced whenever the configuration file changes.
 	 */
-	if (cm->cameras().empty()) {
-		std::cout << "No cameras were identified on the system."
-			  << std::endl;
-		cm->stop();
-		return EXIT_FAILURE;
-	}
+	RuntimeConfig defaults;
+	defaults.inputSize = options.inputSize;
+	defaults.quality = options.quality;
+	defaults.timeout = options.timeout;
+	/* Chosen from the sensor modes unless the configuration sets a size. */
+	defaults.width = 0;
+	defaults.height = 0;
+	defaults.modelParam = MODEL_PARAM;
+	defaults.modelBin = MODEL_BIN;
+	defaults.modelBundle = options.modelBundle;
+	if (defaults.modelBundle.empty() && ModelBundle::embedded())
+		defaults.modelBundle = "embedded";
+	defaults.regions = options.regions;
+	defaults.exclusions = options.exclusions;
 
-	std::string cameraId = cm->cameras()[0]->id();
-	camera = cm->get(cameraId);
-	camera->acquire();
+	ConfigWatcher config(loop, defaults);
+	if (!options.configPath.empty() && config.watch(options.configPath))
+		return EXIT_FAILURE;
+	std::shared_ptr<const RuntimeConfig> initial = config.snapshot();
 
 	/*
-	 * Stream
-	 *
-	 * Each Camera supports a variable number of Stream. A Stream is
-	 * produced by processing data produced by an image source, usually
-	 * by an ISP.
-	 *
-	 *   +-------------------------------------------------------+
-	 *   | Camera                                                |
-	 *   |                +-----------+                          |
-	 *   | +--------+     |           |------> [  Main output  ] |
-	 *   | | Image  |     |           |                          |
-	 *   | |        |---->|    ISP    |------> [   Viewfinder  ] |
-	 *   | | Source |     |           |                          |
-	 *   | +--------+     |           |------> [ Still Capture ] |
-	 *   |                +-----------+                          |
-	 *   +-------------------------------------------------------+
-	 *
-	 * The number and capabilities of the Stream in a Camera are
-	 * a platform dependent property, and it's the pipeline handler
-	 * implementation that has the responsibility of correctly
-	 * report them.
+	 * One Detector is shared by every source. Frames from all cameras and
+	 * replays are funnelled through a single pool of inference workers.
 	 */
+	Detector detector;
+	detector.target_size = initial->inputSize;
+	detector.prob_threshold = initial->probThreshold;
+	detector.nms_threshold = initial->nmsThreshold;
 
 	/*
-	 * --------------------------------------------------------------------
-	 * Camera Configuration.
-	 *
-	 * Camera configuration is tricky! It boils down to assign resources
-	 * of the system (such as DMA engines, scalers, format converters) to
-	 * the different image streams an application has requested.
-	 *
-	 * Depending on the system characteristics, some combinations of
-	 * sizes, formats and stream usages might or might not be possible.
-	 *
-	 * A Camera produces a CameraConfigration based on a set of intended
-	 * roles for each Stream the application requires.
+	 * With pinned inference cores, the ncnn threads of all workers share
+	 * those cores rather than one thread per big core each.
 	 */
-	std::unique_ptr<CameraConfiguration> config =
-		camera->generateConfiguration( { StreamRole::Viewfinder } );
+	int inferenceThreads = 0;
+	if (!options.placement.inference.empty())
+		inferenceThreads = std::max<int>(1, options.placement.inference.size() /
+						    std::max(1u, options.workers));
+	detector.num_threads = inferenceThreads;
 
 	/*
-	 * The CameraConfiguration contains a StreamConfiguration instance
-	 * for each StreamRole requested by the application, provided
-	 * the Camera can support all of them.
-	 *
-	 * Each StreamConfiguration has default size and format, assigned
-	 * by the Camera depending on the Role the application has requested.
+	 * In fast-start mode the model is loaded and the default camera input
+	 * shape warmed up with a blank image on a helper thread, overlapping
+	 * with camera enumeration, configuration and buffer allocation. The
+	 * result is collected just before capture starts.
 	 */
-	StreamConfiguration &streamConfig = config->at(0);
-	std::cout << "Default viewfinder configuration is: "
-		  << streamConfig.toString() << std::endl;
+	auto loadModel = [&]() {
+		if (load_detector(detector, *initial) != 0)
+			return -1;
+		profiler.mark("model loaded");
+
+		if (options.fastStart) {
+			cv::Size size(initial->width ? initial->width : CAM_WIDTH,
+				      initial->height ? initial->height : CAM_HEIGHT);
+			RegionFilter regions(initial->regions, initial->exclusions);
+			if (!regions.empty()) {
+				cv::Rect crop = regions.crop(size);
+				size = cv::Size(crop.width, crop.height);
+			}
+
+			detector.prepare(initial->inputSize, size.width, size.height);
+			profiler.mark("warm-up inference");
+		}
+		return 0;
+	};
+
+	std::future<int> modelReady;
+	if (options.fastStart)
+		modelReady = std::async(std::launch::async, loadModel);
+	else if (loadModel())
+		return EXIT_FAILURE;
+
+	InferenceScheduler scheduler(detector, options.workers);
 
 	/*
-	 * Each StreamConfiguration parameter which is part of a
-	 * CameraConfiguration can be independently modified by the
-	 * application.
-	 *
-	 * In order to validate the modified parameter, the CameraConfiguration
-	 * should be validated -before- the CameraConfiguration gets applied
-	 * to the Camera.
-	 *
-	 * The CameraConfiguration validation process adjusts each
-	 * StreamConfiguration to a valid value.
+	 * The classifier shares the inference workers, and their ncnn thread
+	 * count, with the detector.
 	 */
+	Classifier classifier;
+	std::unique_ptr<ClassifierCascade> cascade;
+	if (!options.classifierParam.empty()) {
+		if (classifier.load(options.classifierParam, options.classifierBin))
+			return EXIT_FAILURE;
+		if (!options.classifierLabels.empty() &&
+		    classifier.loadLabels(options.classifierLabels))
+			return EXIT_FAILURE;
+		classifier.num_threads = inferenceThreads;
+
+		cascade = std::make_unique<ClassifierCascade>(classifier, options.classifyClasses);
+		cascade->setInterval(std::chrono::milliseconds(
+			static_cast<int64_t>(options.reclassifySeconds * 1000)));
+		cascade->setProbDelta(options.reclassifyDelta);
+		scheduler.setCascade(cascade.get());
+	}
+	std::vector<std::unique_ptr<FrameSource>> sources;
 
 	/*
-	 * The Camera configuration procedure fails with invalid parameters.
+	 * Without trigger classes every frame is saved as before, either in
+	 * full or as detection crops. Otherwise each source gets an
+	 * EventRecorder and only events reach the disk. Full frames go to a
+	 * shared container when one is configured.
 	 */
-	streamConfig.size.width = CAM_WIDTH; //4096
-	streamConfig.size.height = CAM_HEIGHT; //2560
-	streamConfig.pixelFormat = formats::RGB888;
+	std::unique_ptr<MjpegWriter> writer;
+	if (!options.container.empty()) {
+		writer = std::make_unique<MjpegWriter>(options.container,
+						       static_cast<uint64_t>(options.segmentMegabytes) << 20,
+						       options.segmentSeconds);
 
-	int ret = camera->configure(config.get());
-	if (ret) {
-		std::cout << "CONFIGURATION FAILED!" << std::endl;
+		Counter &written = metrics().counter("radaria_jpeg_bytes_written_total",
+			"JPEG bytes written to disk by output", "output=\"container\"");
+		writer->setAppendHandler([&written](size_t size) { written.inc(size); });
+		writer->setSegmentHandler(&RetentionManager::track);
+	}
+
+	EventStore eventStore;
+	if (!options.eventStore.empty()) {
+		if (eventStore.open(options.eventStore))
+			return EXIT_FAILURE;
+
+		metrics().counterCallback("radaria_event_store_records_total",
+			"Detections written to the event store",
+			[&eventStore]() { return eventStore.stored(); });
+		metrics().counterCallback("radaria_event_store_dropped_total",
+			"Detections not stored because the event store writer fell behind",
+			[&eventStore]() { return eventStore.dropped(); });
+		eventStore.setThreadInit([]() { place_current_thread(ThreadRole::Io); });
+		eventStore.start();
+	}
+
+	DetectionPublisher publisher;
+	if (!options.publishName.empty() && publisher.open(options.publishName))
+		return EXIT_FAILURE;
+
+	FramePublisher framePublisher;
+	if (!options.publishFrames.empty() && framePublisher.open(options.publishFrames))
 		return EXIT_FAILURE;
+
+	PreviewServer preview(loop);
+	if (options.previewPort) {
+		preview.setWidth(options.previewWidth);
+		preview.setMaxFps(options.previewFps);
+		if (preview.listen(options.previewAddress, options.previewPort))
+			return EXIT_FAILURE;
 	}
 
-	/*
-	 * Validating a CameraConfiguration -before- applying it will adjust it
-	 * to a valid configuration which is as close as possible to the one
-	 * requested.
-	 */
-	config->validate();
-	std::cout << "Validated viewfinder configuration is: "
-		  << streamConfig.toString() << std::endl;
+	MetricsServer metricsServer(loop, metrics());
+	if (options.metricsPort) {
+		register_process_metrics(metrics());
+		if (metricsServer.listen(options.metricsAddress, options.metricsPort))
+			return EXIT_FAILURE;
+	}
 
-	/*
-	 * Once we have a validated configuration, we can apply it to the
-	 * Camera.
-	 */
-	camera->configure(config.get());
+	/* Upper bound on JPEG quality, lowered by the governor under load. */
+	std::atomic<int> qualityCap(100);
+
+	Governor governor(loop, std::chrono::milliseconds(options.latencyTarget));
+	governor.setThermalPath(options.thermalPath);
+
+	std::vector<std::unique_ptr<EventRecorder>> recorders;
+
+	/* Per source when idling is enabled, null for sources with a fixed rate. */
+	std::vector<std::unique_ptr<DutyCycle>> dutyCycles;
 
 	/*
-	 * --------------------------------------------------------------------
-	 * Buffer Allocation
-	 *
-	 * Now that a camera has been configured, it knows all about its
-	 * Streams sizes and formats. The captured images need to be stored in
-	 * framebuffers which can either be provided by the application to the
-	 * library, or allocated in the Camera and exposed to the application
-	 * by libcamera.
-	 *
-	 * An application may decide to allocate framebuffers from elsewhere,
-	 * for example in memory allocated by the display driver that will
-	 * render the captured frames. The application will provide them to
-	 * libcamera by constructing FrameBuffer instances to capture images
-	 * directly into.
-	 *
-	 * Alternatively libcamera can help the application by exporting
-	 * buffers allocated in the Camera using a FrameBufferAllocator
-	 * instance and referencing a configured Camera to determine the
-	 * appropriate buffer size and types to create.
+	 * Without recorders, near-duplicates of the last saved frame of a
+	 * source are not saved at all, in full, as crops or to the container.
 	 */
-	FrameBufferAllocator *allocator = new FrameBufferAllocator(camera);
+	std::deque<NearDuplicateFilter> duplicates;
+	Counter &deduplicated = metrics().counter("radaria_frames_deduplicated_total",
+		"Frames not saved as near-duplicates of the last saved frame");
 
-	for (StreamConfiguration &cfg : *config) {
-		int ret = allocator->allocate(cfg.stream());
-		if (ret < 0) {
-			std::cerr << "Can't allocate buffers" << std::endl;
-			return EXIT_FAILURE;
+	scheduler.setResultHandler([&](const Frame &frame, const std::vector<Object> &objects) {
+		thread_local ConfigReader reader(config);
+		const RuntimeConfig &settings = reader.get();
+
+		profiler.firstDetection();
+
+		print_objects(objects);
+		if (cascade)
+			cascade->print(objects);
+		if (!options.eventStore.empty() && !objects.empty())
+			eventStore.append(wallclock_ns(), frame.sequence, frame.source,
+					  event_detections(frame, objects));
+		publisher.publish(frame, objects);
+		framePublisher.publish(frame);
+		preview.submit(frame, objects);
+
+		if (!recorders.empty()) {
+			recorders[frame.source]->addFrame(frame, objects);
+		} else if (!options.saveFrames) {
+			/* Detections only reach the event store and subscribers. */
+		} else if (duplicates[frame.source].duplicate(frame.image)) {
+			deduplicated.inc();
+		} else if (options.saveCrops) {
+			if (!objects.empty())
+				save_crops(frame.image, objects, options.crops);
+		} else if (writer) {
+			std::vector<unsigned char> jpeg;
+			if (encode_jpeg(frame.image, std::min<int>(settings.quality, qualityCap), jpeg))
+				writer->append(jpeg.data(), jpeg.size(), wallclock_ns(),
+					       frame.sequence, frame.source);
+		} else {
+			save_jpeg(frame.image, std::min<int>(settings.quality, qualityCap));
 		}
 
-		size_t allocated = allocator->buffers(cfg.stream()).size();
-		std::cout << "Allocated " << allocated << " buffers for stream" << std::endl;
-	}
+		if (!dutyCycles.empty() && dutyCycles[frame.source])
+			dutyCycles[frame.source]->observe(frame, objects);
+
+		if (options.governor)
+			governor.observe(std::chrono::steady_clock::now() - frame.timestamp);
+	});
 
 	/*
 	 * --------------------------------------------------------------------
-	 * Frame Capture
-	 *
-	 * libcamera frames capture model is based on the 'Request' concept.
-	 * For each frame a Request has to be queued to the Camera.
-	 *
-	 * A Request refers to (at least one) Stream for which a Buffer that
-	 * will be filled with image data shall be added to the Request.
+	 * Create a Camera Manager.
 	 *
-	 * A Request is associated with a list of Controls, which are tunable
-	 * parameters (similar to v4l2_controls) that have to be applied to
-	 * the image.
+	 * The Camera Manager is responsible for enumerating all the Camera
+	 * in the system, by associating Pipeline Handlers with media entities
+	 * registered in the system.
 	 *
-	 * Once a request completes, all its buffers will contain image data
-	 * that applications can access and for each of them a list of metadata
-	 * properties that reports the capture parameters applied to the image.
+	 * There can only be a single CameraManager constructed within any
+	 * process space, it is only started when cameras have been requested.
 	 */
-	Stream *stream = streamConfig.stream();
-	const std::vector<std::unique_ptr<FrameBuffer>> &buffers = allocator->buffers(stream);
-	std::vector<std::unique_ptr<Request>> requests;
-	for (unsigned int i = 0; i < buffers.size(); ++i) {
-		std::unique_ptr<Request> request = camera->createRequest();
-		if (!request)
-		{
-			std::cerr << "Can't create request" << std::endl;
-			return EXIT_FAILURE;
+	std::unique_ptr<CameraManager> cm;
+	std::vector<CameraSource *> cameras;
+
+	/*
+	 * Without a size in the configuration, each camera streams the
+	 * smallest binned sensor mode that serves the detector and preview,
+	 * and the full readout only when stills are saved.
+	 */
+	auto streamSize = [&](CameraSource &camera, const RuntimeConfig &settings) {
+		if (settings.width && settings.height)
+			return cv::Size(settings.width, settings.height);
+
+		std::vector<cv::Size> modes = camera.sensorModes();
+		if (modes.empty())
+			return cv::Size(CAM_WIDTH, CAM_HEIGHT);
+
+		StreamNeeds needs;
+		needs.inputSize = settings.inputSize;
+		needs.previewWidth = options.previewPort ? options.previewWidth : 0;
+		needs.fullResolution = !options.recordClasses.empty() || options.saveFrames;
+
+		RegionFilter regions(settings.regions, settings.exclusions);
+		if (!regions.empty()) {
+			cv::Size full = *std::max_element(modes.begin(), modes.end(),
+				[](const cv::Size &a, const cv::Size &b) { return a.area() < b.area(); });
+			cv::Rect crop = regions.crop(full);
+			needs.region = cv::Rect2f(static_cast<float>(crop.x) / full.width,
+						  static_cast<float>(crop.y) / full.height,
+						  static_cast<float>(crop.width) / full.width,
+						  static_cast<float>(crop.height) / full.height);
 		}
 
-		const std::unique_ptr<FrameBuffer> &buffer = buffers[i];
-		int ret = request->addBuffer(stream, buffer.get());
-		if (ret < 0)
-		{
-			std::cerr << "Can't set buffer for request"
+		cv::Size size = select_sensor_mode(modes, needs);
+		if (size != camera.requestedSize())
+			std::cout << camera.name() << ": sensor mode " << size.width << "x"
+				  << size.height << (needs.fullResolution ? " for full-resolution stills"
+									  : " for inference")
+				  << std::endl;
+		return size;
+	};
+
+	if (options.allCameras || !options.cameras.empty()) {
+		cm = std::make_unique<CameraManager>();
+		cm->start();
+		profiler.mark("camera manager started");
+
+		for (auto const &camera : cm->cameras())
+			std::cout << " - " << cameraName(camera.get()) << std::endl;
+
+		if (cm->cameras().empty()) {
+			std::cout << "No cameras were identified on the system."
 				  << std::endl;
+			cm->stop();
 			return EXIT_FAILURE;
 		}
 
+		if (options.allCameras) {
+			options.cameras.clear();
+			for (unsigned int i = 0; i < cm->cameras().size(); i++)
+				options.cameras.push_back(i);
+		}
+
 		/*
-		 * Controls can be added to a request on a per frame basis.
+		 * Each selected camera is acquired, configured and given its
+		 * own request ring by a CameraSource.
 		 */
-		//ControlList &controls = request->controls();
-		//controls.set(controls::Brightness, 0.5);
+		for (unsigned int index : options.cameras) {
+			if (index >= cm->cameras().size()) {
+				std::cerr << "Camera " << index << " does not exist" << std::endl;
+				return EXIT_FAILURE;
+			}
+
+			std::unique_ptr<CameraSource> source =
+				std::make_unique<CameraSource>(cm->cameras()[index], loop);
+			cv::Size size = streamSize(*source, *initial);
+			if (source->configure(size.width, size.height))
+				return EXIT_FAILURE;
 
-		requests.push_back(std::move(request));
+			cameras.push_back(source.get());
+			sources.push_back(std::move(source));
+		}
+		profiler.mark("cameras configured");
 	}
 
+	for (const std::vector<std::string> &paths : options.replays) {
+		std::unique_ptr<ReplaySource> source =
+			std::make_unique<ReplaySource>(paths, options.replayFps);
+		if (source->load())
+			return EXIT_FAILURE;
+
+		sources.push_back(std::move(source));
+	}
+
+	for (unsigned int i = 0; i < sources.size(); i++) {
+		FrameSource *source = sources[i].get();
+		unsigned int weight = i < options.weights.size() ? options.weights[i] : 1;
+
+		source->setId(scheduler.addSource(source->name(), weight));
+
+		if (!options.recordClasses.empty()) {
+			std::unique_ptr<EventRecorder> recorder =
+				std::make_unique<EventRecorder>("event_src" + std::to_string(i),
+								static_cast<size_t>(options.ringMegabytes) << 20);
+			recorder->setTriggerClasses(options.recordClasses);
+			recorder->setPreRoll(options.preRoll);
+			recorder->setPostRoll(options.postRoll);
+			recorder->setQuality(initial->quality);
+			recorder->setDeduplication(options.dedupBits);
+			recorder->setBestShots(options.bestShots);
+			recorder->setWriter(writer.get());
+			recorders.push_back(std::move(recorder));
+		}
+		duplicates.emplace_back(options.dedupBits);
+
+		if (options.idleFps > 0) {
+			std::unique_ptr<DutyCycle> dutyCycle = std::make_unique<DutyCycle>(
+				*source,
+				std::chrono::duration_cast<std::chrono::microseconds>(
+					std::chrono::duration<double>(1.0 / options.idleFps)),
+				std::chrono::seconds(options.idleAfter));
+			if (dutyCycle->start())
+				dutyCycle.reset();
+			dutyCycles.push_back(std::move(dutyCycle));
+		}
+
+		source->setFrameHandler([&scheduler, &profiler](Frame &&frame) {
+			profiler.firstFrame();
+			scheduler.submit(std::move(frame));
+		});
+	}
+	profiler.mark("sources ready");
+
 	/*
-	 * --------------------------------------------------------------------
-	 * Signal&Slots
-	 *
-	 * libcamera uses a Signal&Slot based system to connect events to
-	 * callback operations meant to handle them, inspired by the QT graphic
-	 * toolkit.
-	 *
-	 * Signals are events 'emitted' by a class instance.
-	 * Slots are callbacks that can be 'connected' to a Signal.
-	 *
-	 * A Camera exposes Signals, to report the completion of a Request and
-	 * the completion of a Buffer part of a Request to support partial
-	 * Request completions.
-	 *
-	 * In order to receive the notification for request completions,
-	 * applications shall connecte a Slot to the Camera 'requestCompleted'
-	 * Signal before the camera is started.
+	 * Only the names written here are managed: frames and crops, events
+	 * of each source and container segments. Other media in the working
+	 * directory is never deleted.
 	 */
-	camera->requestCompleted.connect(requestComplete);
+	std::unique_ptr<RetentionManager> retention;
+	if (options.keepMegabytes || options.keepFiles) {
+		std::vector<std::string> prefixes = { "" };
+		for (unsigned int i = 0; i < sources.size(); i++)
+			prefixes.push_back("event_src" + std::to_string(i) + "_");
+		if (!options.container.empty())
+			prefixes.push_back(options.container + "_");
+
+		retention = std::make_unique<RetentionManager>(".", prefixes,
+								options.keepMegabytes << 20,
+								options.keepFiles);
+		if (retention->scan())
+			return EXIT_FAILURE;
+		retention->start();
+	}
+
+	if (modelReady.valid() && modelReady.get())
+		return EXIT_FAILURE;
+
+	if (options.governor) {
+		governor.setLevelHandler([&](const GovernorLevel &level) {
+			detector.num_threads = inferenceThreads && level.threads
+					     ? std::min(level.threads, inferenceThreads)
+					     : std::max(level.threads, inferenceThreads);
+			classifier.num_threads = detector.num_threads.load();
+			scheduler.setFrameInterval(level.frameInterval);
+			qualityCap = level.quality;
+			for (std::unique_ptr<EventRecorder> &recorder : recorders)
+				recorder->setQuality(std::min(config.snapshot()->quality, level.quality));
+		});
+		if (governor.start())
+			return EXIT_FAILURE;
+	}
+
+	/*
+	 * Restrict every source to the regions of interest, then prepare the
+	 * input shape of each, so a change of regions at runtime costs no
+	 * warm-up on the capture path.
+	 */
+	auto applyRegions = [&](const RuntimeConfig &settings) {
+		std::shared_ptr<const RegionFilter> regions =
+			std::make_shared<RegionFilter>(settings.regions, settings.exclusions);
+
+		for (std::unique_ptr<FrameSource> &source : sources) {
+			scheduler.setRegions(source->id(), regions);
+			if (regions->empty())
+				continue;
+
+			cv::Size size = source->frameSize();
+			cv::Rect crop = regions->crop(size);
+			std::cout << source->name() << ": detecting on " << crop.width << "x"
+				  << crop.height << " of " << size.width << "x" << size.height
+				  << ", " << std::setprecision(3)
+				  << static_cast<double>(std::max(size.width, size.height)) /
+				     std::max(crop.width, crop.height)
+				  << "x effective resolution" << std::endl;
+		}
+	};
+
+	auto prepareShapes = [&](const RuntimeConfig &settings) {
+		RegionFilter regions(settings.regions, settings.exclusions);
+
+		for (std::unique_ptr<FrameSource> &source : sources) {
+			cv::Size size = source->frameSize();
+			if (!regions.empty()) {
+				cv::Rect crop = regions.crop(size);
+				size = cv::Size(crop.width, crop.height);
+			}
+
+			if (detector.prepared(settings.inputSize, size.width, size.height))
+				continue;
+
+			cv::Size shape = letterbox_shape(settings.inputSize, size.width, size.height);
+			double ms = detector.prepare(settings.inputSize, size.width, size.height);
+			if (ms < 0) {
+				std::cerr << "Failed to prepare the " << shape.width << "x"
+					  << shape.height << " input, the model takes "
+					  << detector.input_size() << std::endl;
+				return -1;
+			}
+
+			std::cout << "Prepared " << shape.width << "x" << shape.height
+				  << " input in " << ms << " ms" << std::endl;
+		}
+
+		return 0;
+	};
+
+	applyRegions(*initial);
+	if (prepareShapes(*initial))
+		return EXIT_FAILURE;
+	profiler.mark("shapes prepared");
+
+	/*
+	 * Apply a reloaded configuration on the EventLoop thread, touching
+	 * only what changed. Thresholds and quality take effect on the next
+	 * frame. A new model or stream size needs the inference pool drained
+	 * first, and only then are the detector or the cameras rebuilt.
+	 */
+	std::chrono::steady_clock::time_point captureStart;
+	config.setChangeHandler([&](const RuntimeConfig &previous, const RuntimeConfig &current) {
+		detector.prob_threshold = current.probThreshold;
+		detector.nms_threshold = current.nmsThreshold;
+
+		detector.target_size = current.inputSize;
+
+		for (std::unique_ptr<EventRecorder> &recorder : recorders)
+			recorder->setQuality(std::min<int>(current.quality, qualityCap));
+
+		if (!current.sameRegions(previous))
+			applyRegions(current);
+
+		/* The input size and regions also decide the sensor mode. */
+		std::vector<cv::Size> streamSizes;
+		bool resize = false;
+		for (CameraSource *camera : cameras) {
+			streamSizes.push_back(streamSize(*camera, current));
+			resize |= streamSizes.back() != camera->requestedSize();
+		}
+
+		if (!current.sameModel(previous) || resize) {
+			scheduler.stop();
+
+			if (!current.sameModel(previous) &&
+			    load_detector(detector, current)) {
+				std::cerr << "Restoring the previous model" << std::endl;
+				load_detector(detector, previous);
+			}
+
+			for (unsigned int i = 0; i < cameras.size(); i++) {
+				if (cameras[i]->reconfigure(streamSizes[i].width, streamSizes[i].height))
+					loop.exit(EXIT_FAILURE);
+			}
+
+			if (prepareShapes(current))
+				loop.exit(EXIT_FAILURE);
+			scheduler.start();
+		} else if (current.inputSize != previous.inputSize ||
+			   !current.sameRegions(previous)) {
+			if (prepareShapes(current))
+				loop.exit(EXIT_FAILURE);
+		}
+
+		if (current.timeout != previous.timeout) {
+			std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - captureStart;
+			loop.timeout(std::max(0, static_cast<int>(current.timeout - elapsed.count())));
+		}
+	});
 
 	/*
 	 * --------------------------------------------------------------------
 	 * Start Capture
 	 *
-	 * In order to capture frames the Camera has to be started and
-	 * Request queued to it. Enough Request to fill the Camera pipeline
-	 * depth have to be queued before the Camera start delivering frames.
-	 *
-	 * For each delivered frame, the Slot connected to the
-	 * Camera::requestCompleted Signal is called.
+	 * Cameras start delivering frames once their request rings are
+	 * queued, replay sources once their pacing thread runs.
 	 */
-	camera->start();
-	for (std::unique_ptr<Request> &request : requests)
-		camera->queueRequest(request.get());
+	scheduler.start();
+	for (std::unique_ptr<FrameSource> &source : sources) {
+		if (source->start()) {
+			scheduler.stop();
+			return EXIT_FAILURE;
+		}
+	}
+	profiler.mark("capture started");
 
 	/*
 	 * --------------------------------------------------------------------
@@ -448,24 +1166,40 @@ int main()
 	 * In order to dispatch events received from the video devices, such
 	 * as buffer completions, an event loop has to be run.
 	 */
-	loop.timeout(TIMEOUT_SEC);
-	ret = loop.exec();
-	std::cout << "Capture ran for " << TIMEOUT_SEC << " seconds and "
+	place_current_thread(ThreadRole::Control);
+
+	captureStart = std::chrono::steady_clock::now();
+	loop.timeout(initial->timeout);
+	int ret = loop.exec();
+	std::cout << "Capture ran for " << config.snapshot()->timeout << " seconds and "
 		  << "stopped with exit status: " << ret << std::endl;
 
 	/*
 	 * --------------------------------------------------------------------
 	 * Clean Up
 	 *
-	 * Stop the Camera, release resources and stop the CameraManager.
-	 * libcamera has now released all resources it owned.
+	 * Stop the sources first so no new frames are submitted, then drain
+	 * the inference pool, which releases every outstanding frame, before
+	 * the sources and the CameraManager go away.
 	 */
-	camera->stop();
-	allocator->free(stream);
-	delete allocator;
-	camera->release();
-	camera.reset();
-	cm->stop();
+	for (std::unique_ptr<FrameSource> &source : sources)
+		source->stop();
+	scheduler.stop();
+	scheduler.printStats(std::cout);
+	perf_counters_report(std::cout);
+	eventStore.stop();
+	for (std::unique_ptr<EventRecorder> &recorder : recorders)
+		recorder->close();
+	if (writer)
+		writer->close();
+	if (retention)
+		retention->stop();
+	/* Camera buffers still lent to frame subscribers go back to the sources. */
+	framePublisher.close();
+
+	sources.clear();
+	if (cm)
+		cm->stop();
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,435 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * camera_source.cpp - FrameSource backed by a libcamera Camera
+ */
+
+#include "camera_source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <sys/mman.h>
+
+#include <libcamera/formats.h>
+
+#include "thread_placement.h"
+
+using namespace libcamera;
+
+/*
+ * Frame durations from which capture is considered idle, and the number of
+ * requests then kept queued: enough to never starve the sensor, few enough
+ * that a faster rate applies within a couple of idle frames.
+ */
+#define IDLE_FRAME_DURATION_US 200000
+#define IDLE_QUEUE_DEPTH 2
+
+CameraSource::CameraSource(std::shared_ptr<Camera> camera, EventLoop &loop)
+	: camera_(camera), loop_(loop), stream_(nullptr), width_(0), height_(0),
+	  frameDuration_(0), appliedDuration_(0), queued_(0), generation_(0),
+	  acquired_(false), running_(false)
+{
+}
+
+CameraSource::~CameraSource()
+{
+	stop();
+	releaseBuffers();
+
+	if (acquired_)
+		camera_->release();
+}
+
+void CameraSource::releaseBuffers()
+{
+	camera_->requestCompleted.disconnect(this);
+
+	for (auto &mapped : mapped_)
+		munmap(mapped.second.memory, mapped.second.length);
+	mapped_.clear();
+
+	parked_.clear();
+	requests_.clear();
+	if (allocator_ && stream_)
+		allocator_->free(stream_);
+	allocator_.reset();
+	stream_ = nullptr;
+}
+
+std::string CameraSource::name() const
+{
+	return cameraName(camera_.get());
+}
+
+cv::Size CameraSource::frameSize() const
+{
+	if (!config_)
+		return cv::Size();
+
+	const StreamConfiguration &cfg = config_->at(0);
+	return cv::Size(cfg.size.width, cfg.size.height);
+}
+
+std::vector<cv::Size> CameraSource::sensorModes() const
+{
+	std::vector<cv::Size> modes;
+
+	std::unique_ptr<CameraConfiguration> config =
+		camera_->generateConfiguration( { StreamRole::Raw } );
+	if (!config || config->empty())
+		return modes;
+
+	const StreamFormats &formats = config->at(0).formats();
+	for (const PixelFormat &format : formats.pixelformats()) {
+		for (const Size &size : formats.sizes(format)) {
+			cv::Size mode(size.width, size.height);
+			if (std::find(modes.begin(), modes.end(), mode) == modes.end())
+				modes.push_back(mode);
+		}
+	}
+
+	return modes;
+}
+
+int CameraSource::configure(unsigned int width, unsigned int height)
+{
+	if (!acquired_) {
+		if (camera_->acquire()) {
+			std::cerr << "Failed to acquire " << name() << std::endl;
+			return -1;
+		}
+		acquired_ = true;
+	}
+
+	width_ = width;
+	height_ = height;
+
+	/*
+	 * --------------------------------------------------------------------
+	 * Camera Configuration.
+	 *
+	 * A Camera produces a CameraConfigration based on a set of intended
+	 * roles for each Stream the application requires. Each
+	 * StreamConfiguration has default size and format, assigned by the
+	 * Camera depending on the Role the application has requested.
+	 */
+	config_ = camera_->generateConfiguration( { StreamRole::Viewfinder } );
+
+	StreamConfiguration &streamConfig = config_->at(0);
+	std::cout << "Default viewfinder configuration is: "
+		  << streamConfig.toString() << std::endl;
+
+	streamConfig.size.width = width;
+	streamConfig.size.height = height;
+	streamConfig.pixelFormat = formats::RGB888;
+
+	/*
+	 * Validating a CameraConfiguration -before- applying it will adjust it
+	 * to a valid configuration which is as close as possible to the one
+	 * requested, so the Camera only has to be configured once.
+	 */
+	if (config_->validate() == CameraConfiguration::Invalid) {
+		std::cerr << "Invalid configuration for " << name() << std::endl;
+		return -1;
+	}
+	std::cout << "Validated viewfinder configuration is: "
+		  << streamConfig.toString() << std::endl;
+
+	/*
+	 * Once we have a validated configuration, we can apply it to the
+	 * Camera.
+	 */
+	int ret = camera_->configure(config_.get());
+	if (ret) {
+		std::cout << "CONFIGURATION FAILED!" << std::endl;
+		return -1;
+	}
+
+	/*
+	 * --------------------------------------------------------------------
+	 * Buffer Allocation
+	 *
+	 * libcamera exports buffers allocated in the Camera through a
+	 * FrameBufferAllocator. Every buffer is mapped once here rather than
+	 * on each completed request.
+	 */
+	allocator_ = std::make_unique<FrameBufferAllocator>(camera_);
+	stream_ = streamConfig.stream();
+
+	ret = allocator_->allocate(stream_);
+	if (ret < 0) {
+		std::cerr << "Can't allocate buffers" << std::endl;
+		return -1;
+	}
+
+	const std::vector<std::unique_ptr<FrameBuffer>> &buffers = allocator_->buffers(stream_);
+	std::cout << "Allocated " << buffers.size() << " buffers for stream" << std::endl;
+
+	/*
+	 * --------------------------------------------------------------------
+	 * Frame Capture
+	 *
+	 * For each frame a Request has to be queued to the Camera. Requests
+	 * are created once and recycled, forming this camera's request ring.
+	 */
+	for (const std::unique_ptr<FrameBuffer> &buffer : buffers) {
+		const FrameBuffer::Plane &plane = buffer->planes()[0];
+		void *memory = mmap(NULL, plane.length, PROT_READ | PROT_WRITE,
+				    MAP_SHARED, plane.fd.get(), 0);
+		if (memory == MAP_FAILED) {
+			std::cerr << "Failed to map buffer memory: " << strerror(errno) << std::endl;
+			return -1;
+		}
+		mapped_[buffer.get()] = { memory, plane.length };
+
+		std::unique_ptr<Request> request = camera_->createRequest();
+		if (!request)
+		{
+			std::cerr << "Can't create request" << std::endl;
+			return -1;
+		}
+
+		ret = request->addBuffer(stream_, buffer.get());
+		if (ret < 0)
+		{
+			std::cerr << "Can't set buffer for request"
+				  << std::endl;
+			return -1;
+		}
+
+		requests_.push_back(std::move(request));
+	}
+
+	/*
+	 * In order to receive the notification for request completions,
+	 * applications shall connect a Slot to the Camera 'requestCompleted'
+	 * Signal before the camera is started.
+	 */
+	camera_->requestCompleted.connect(this, &CameraSource::requestComplete);
+
+	return 0;
+}
+
+int CameraSource::reconfigure(unsigned int width, unsigned int height)
+{
+	if (width == width_ && height == height_)
+		return 0;
+
+	bool wasRunning = running_;
+	stop();
+	releaseBuffers();
+	generation_++;
+
+	std::cout << "Reconfiguring " << name() << " for " << width << "x"
+		  << height << std::endl;
+	if (configure(width, height))
+		return -1;
+
+	return wasRunning ? start() : 0;
+}
+
+int CameraSource::start()
+{
+	int ret = camera_->start();
+	if (ret) {
+		std::cerr << "Failed to start " << name() << std::endl;
+		return ret;
+	}
+	running_ = true;
+
+	/* The camera starts from its default controls. */
+	appliedDuration_ = 0;
+	queued_ = 0;
+	parked_.clear();
+	for (std::unique_ptr<Request> &request : requests_)
+		queue(request.get());
+
+	return 0;
+}
+
+void CameraSource::stop()
+{
+	if (!running_)
+		return;
+
+	running_ = false;
+	camera_->stop();
+	camera_->requestCompleted.disconnect(this);
+}
+
+/*
+ * The Slot is invoked in the CameraManager's thread, hence one should avoid
+ * any heavy processing here. The processing of the request shall be
+ * re-directed to the application's thread instead, so as not to block the
+ * CameraManager's thread for large amount of time.
+ *
+ * That thread is created by libcamera, so it takes the capture placement on
+ * its first completion.
+ */
+void CameraSource::requestComplete(Request *request)
+{
+	static thread_local bool placed = false;
+	if (!placed) {
+		place_current_thread(ThreadRole::Capture);
+		placed = true;
+	}
+
+	if (request->status() == Request::RequestCancelled)
+		return;
+
+	loop_.callLater(std::bind(&CameraSource::processRequest, this, request,
+				  generation_.load()));
+}
+
+int CameraSource::setFrameDuration(std::chrono::microseconds duration)
+{
+	if (!camera_->controls().count(&controls::FrameDurationLimits))
+		return -1;
+
+	int64_t previous = frameDuration_.exchange(duration.count());
+	if (previous && previous > duration.count())
+		loop_.callLater(std::bind(&CameraSource::unpark, this, generation_.load()));
+
+	return 0;
+}
+
+/* Queue a request, carrying the frame duration if it changed. */
+void CameraSource::queue(Request *request)
+{
+	int64_t duration = frameDuration_;
+
+	if (duration != appliedDuration_) {
+		int64_t min = duration, max = duration;
+		if (!duration) {
+			const ControlInfo &info = camera_->controls().at(&controls::FrameDurationLimits);
+			min = info.min().get<int64_t>();
+			max = info.max().get<int64_t>();
+		}
+		request->controls().set(controls::FrameDurationLimits,
+					Span<const int64_t, 2>({ min, max }));
+		appliedDuration_ = duration;
+	}
+
+	queued_++;
+	camera_->queueRequest(request);
+}
+
+void CameraSource::unpark(unsigned int generation)
+{
+	if (!running_ || generation != generation_)
+		return;
+
+	for (Request *request : parked_)
+		queue(request);
+	parked_.clear();
+}
+
+void CameraSource::processRequest(Request *request, unsigned int generation)
+{
+	if (!running_ || generation != generation_)
+		return;
+
+	queued_--;
+
+	/*
+	 * Only one stream is configured, hence a request carries a single
+	 * buffer.
+	 */
+	const Request::BufferMap &buffers = request->buffers();
+	auto bufferPair = buffers.begin();
+	if (bufferPair == buffers.end() || !frameReady_) {
+		requeue(request, generation);
+		return;
+	}
+
+	const StreamConfiguration &cfg = bufferPair->first->configuration();
+	const FrameBuffer *buffer = bufferPair->second;
+	const MappedBuffer &mapped = mapped_[buffer];
+
+	Frame frame;
+	frame.source = id_;
+	frame.sequence = buffer->metadata().sequence;
+	frame.timestamp = std::chrono::steady_clock::now();
+	frame.image = cv::Mat(cfg.size.height, cfg.size.width, CV_8UC3,
+			      mapped.memory, cfg.stride);
+	frame.fd = buffer->planes()[0].fd.get();
+	frame.fdOffset = buffer->planes()[0].offset;
+	frame.fdLength = buffer->planes()[0].length;
+
+	/* The request goes back once the frame and every hold are released. */
+	auto references = std::make_shared<std::atomic<unsigned int>>(1);
+	std::function<void()> drop = [this, request, generation, references]() {
+		if (references->fetch_sub(1) == 1)
+			loop_.callLater(std::bind(&CameraSource::requeue, this, request,
+						  generation));
+	};
+	frame.release = drop;
+	frame.hold = [references, drop]() {
+		references->fetch_add(1);
+		return drop;
+	};
+
+	frameReady_(std::move(frame));
+}
+
+void CameraSource::requeue(Request *request, unsigned int generation)
+{
+	if (!running_ || generation != generation_)
+		return;
+
+	/* Re-queue the Request to the camera. */
+	request->reuse(Request::ReuseBuffers);
+	if (frameDuration_ >= IDLE_FRAME_DURATION_US && queued_ >= IDLE_QUEUE_DEPTH) {
+		parked_.push_back(request);
+		return;
+	}
+	queue(request);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Camera Naming.
+ *
+ * Applications are responsible for deciding how to name cameras, and present
+ * that information to the users. Every camera has a unique identifier, though
+ * this string is not designed to be friendly for a human reader.
+ *
+ * To support human consumable names, libcamera provides camera properties
+ * that allow an application to determine a naming scheme based on its needs.
+ *
+ * In this example, we focus on the location property, but also detail the
+ * model string for external cameras, as this is more likely to be visible
+ * information to the user of an externally connected device.
+ *
+ * The unique camera ID is appended for informative purposes.
+ */
+std::string cameraName(Camera *camera)
+{
+	const ControlList &props = camera->properties();
+	std::string name;
+
+	const auto &location = props.get(properties::Location);
+	if (location) {
+		switch (*location) {
+		case properties::CameraLocationFront:
+			name = "Internal front camera";
+			break;
+		case properties::CameraLocationBack:
+			name = "Internal back camera";
+			break;
+		case properties::CameraLocationExternal:
+			name = "External camera";
+			const auto &model = props.get(properties::Model);
+			if (model)
+				name = " '" + *model + "'";
+			break;
+		}
+	}
+
+	name += " (" + camera->id() + ")";
+
+	return name;
+}
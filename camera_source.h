@@ -0,0 +1,102 @@
+/*
+ * camera_source.h - FrameSource backed by a libcamera Camera
+ */
+#ifndef CAMERA_SOURCE_H
+#define CAMERA_SOURCE_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <libcamera/libcamera.h>
+
+#include "event_loop.h"
+#include "frame_source.h"
+
+class CameraSource : public FrameSource
+{
+public:
+	CameraSource(std::shared_ptr<libcamera::Camera> camera, EventLoop &loop);
+	~CameraSource();
+
+	std::string name() const override;
+	cv::Size frameSize() const override;
+
+	/*
+	 * Sizes the sensor reads out, from the formats of its raw stream, for
+	 * select_sensor_mode(). Empty if the camera has no raw stream.
+	 */
+	std::vector<cv::Size> sensorModes() const;
+
+	/*
+	 * Acquire and configure the camera, then allocate and map the request
+	 * ring. Each camera owns one Request per allocated buffer.
+	 */
+	int configure(unsigned int width, unsigned int height);
+
+	/*
+	 * Switch to a new stream size, restarting capture if it was running.
+	 * A no-op when the size is unchanged. Frames of the previous stream
+	 * must all have been released.
+	 */
+	int reconfigure(unsigned int width, unsigned int height);
+
+	/* The size last asked of configure(), before validation adjusted it. */
+	cv::Size requestedSize() const { return cv::Size(width_, height_); }
+
+	int start() override;
+	void stop() override;
+	int setFrameDuration(std::chrono::microseconds duration) override;
+
+private:
+	struct MappedBuffer {
+		void *memory;
+		size_t length;
+	};
+
+	void requestComplete(libcamera::Request *request);
+	void processRequest(libcamera::Request *request, unsigned int generation);
+	void requeue(libcamera::Request *request, unsigned int generation);
+	void queue(libcamera::Request *request);
+	void unpark(unsigned int generation);
+	void releaseBuffers();
+
+	std::shared_ptr<libcamera::Camera> camera_;
+	EventLoop &loop_;
+
+	std::unique_ptr<libcamera::CameraConfiguration> config_;
+	std::unique_ptr<libcamera::FrameBufferAllocator> allocator_;
+	libcamera::Stream *stream_;
+
+	std::vector<std::unique_ptr<libcamera::Request>> requests_;
+	std::map<const libcamera::FrameBuffer *, MappedBuffer> mapped_;
+
+	unsigned int width_;
+	unsigned int height_;
+
+	/*
+	 * Requested frame duration in microseconds, zero for the sensor
+	 * default, and the one last sent with a request. At a long duration
+	 * only a few requests are kept queued and the others parked, so a
+	 * switch back to full rate is not stuck behind a queue of slow frames.
+	 */
+	std::atomic<int64_t> frameDuration_;
+	int64_t appliedDuration_;
+	unsigned int queued_;
+	std::vector<libcamera::Request *> parked_;
+
+	/*
+	 * Bumped whenever the request ring is rebuilt, so that completions
+	 * and releases still queued on the event loop for the old ring are
+	 * ignored.
+	 */
+	std::atomic<unsigned int> generation_;
+
+	bool acquired_;
+	bool running_;
+};
+
+std::string cameraName(libcamera::Camera *camera);
+
+#endif
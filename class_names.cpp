@@ -0,0 +1,34 @@
+/*
+ * class_names.cpp - COCO class names of the detector labels
+ */
+
+#include "class_names.h"
+
+static const char *class_names[] = {
+	"person", "bicycle", "car", "motorcycle", "airplane", "bus", "train", "truck", "boat", "traffic light",
+	"fire hydrant", "stop sign", "parking meter", "bench", "bird", "cat", "dog", "horse", "sheep", "cow",
+	"elephant", "bear", "zebra", "giraffe", "backpack", "umbrella", "handbag", "tie", "suitcase", "frisbee",
+	"skis", "snowboard", "sports ball", "kite", "baseball bat", "baseball glove", "skateboard", "surfboard",
+	"tennis racket", "bottle", "wine glass", "cup", "fork", "knife", "spoon", "bowl", "banana", "apple",
+	"sandwich", "orange", "broccoli", "carrot", "hot dog", "pizza", "donut", "cake", "chair", "couch",
+	"potted plant", "bed", "dining table", "toilet", "tv", "laptop", "mouse", "remote", "keyboard", "cell phone",
+	"microwave", "oven", "toaster", "sink", "refrigerator", "book", "clock", "vase", "scissors", "teddy bear",
+	"hair drier", "toothbrush"
+};
+
+const char *class_name(int label)
+{
+	const int num_names = sizeof(class_names) / sizeof(class_names[0]);
+	if (label < 0 || label >= num_names)
+		return "unknown";
+	return class_names[label];
+}
+
+int class_index(const std::string &name)
+{
+	const int num_names = sizeof(class_names) / sizeof(class_names[0]);
+	for (int i = 0; i < num_names; i++)
+		if (name == class_names[i])
+			return i;
+	return -1;
+}
@@ -0,0 +1,17 @@
+/*
+ * class_names.h - COCO class names of the detector labels
+ *
+ * Kept apart from the detector so that tools reading stored labels do not
+ * depend on ncnn or OpenCV.
+ */
+#ifndef CLASS_NAMES_H
+#define CLASS_NAMES_H
+
+#include <string>
+
+/* "unknown" for a label outside the table. */
+const char *class_name(int label);
+/* -1 for a name not in the table. */
+int class_index(const std::string &name);
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * classifier.cpp - Second-stage classification of detected objects
+ */
+
+#include "classifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "perf_counters.h"
+
+/* Minimum overlap for a detection to continue a track. */
+#define TRACK_MIN_IOU 0.3f
+#define TRACK_TIMEOUT std::chrono::seconds(2)
+
+/* Crops smaller than this on either side are not worth classifying. */
+#define MIN_CROP_SIZE 8
+
+Classifier::Classifier()
+	: loaded_(false)
+{
+}
+
+Classifier::~Classifier()
+{
+	net_.clear();
+}
+
+int Classifier::load(const std::string &param_path, const std::string &bin_path)
+{
+	net_.clear();
+	loaded_ = false;
+
+	if (net_.load_param(param_path.c_str()) != 0) {
+		std::cerr << "Failed to load classifier param " << param_path << std::endl;
+		return -1;
+	}
+	if (net_.load_model(bin_path.c_str()) != 0) {
+		std::cerr << "Failed to load classifier model " << bin_path << std::endl;
+		return -1;
+	}
+
+	loaded_ = true;
+	return 0;
+}
+
+int Classifier::loadLabels(const std::string &path)
+{
+	std::ifstream in(path);
+	if (!in) {
+		std::cerr << "Failed to read classifier labels " << path << std::endl;
+		return -1;
+	}
+
+	labels_.clear();
+	std::string line;
+	while (std::getline(in, line))
+		labels_.push_back(line);
+	return 0;
+}
+
+const char *Classifier::labelName(int label) const
+{
+	if (label >= 0 && label < (int)labels_.size())
+		return labels_[label].c_str();
+	return "unknown";
+}
+
+/*
+ * Ultralytics classifiers are trained on the centre square of the image
+ * resized to the input size, so crops are cut the same way.
+ */
+std::vector<Classification> Classifier::classify(const std::vector<cv::Mat> &crops)
+{
+	std::vector<Classification> results(crops.size());
+	if (!loaded_)
+		return results;
+
+	PerfScope perf(PerfStage::Classify);
+
+	const int size = input_size;
+	const int threads = num_threads;
+	const float norm_vals[3] = { 1 / 255.f, 1 / 255.f, 1 / 255.f };
+
+	for (size_t i = 0; i < crops.size(); i++) {
+		const cv::Mat &crop = crops[i];
+		int side = std::min(crop.cols, crop.rows);
+		cv::Mat square = crop(cv::Rect((crop.cols - side) / 2, (crop.rows - side) / 2,
+					       side, side));
+
+		ncnn::Mat in = ncnn::Mat::from_pixels_resize(square.data, ncnn::Mat::PIXEL_BGR2RGB,
+							     side, side, (int)square.step,
+							     size, size);
+		in.substract_mean_normalize(0, norm_vals);
+
+		ncnn::Extractor ex = net_.create_extractor();
+		ex.set_blob_allocator(&blob_allocator_);
+		ex.set_workspace_allocator(&workspace_allocator_);
+		if (threads > 0)
+			ex.set_num_threads(threads);
+
+		ncnn::Mat out;
+		ex.input("in0", in);
+		if (ex.extract("out0", out) != 0)
+			continue;
+
+		const float *scores = out;
+		const int count = out.w * out.h * out.c;
+		if (!count)
+			continue;
+
+		/* Exports without a final softmax give logits. */
+		float sum = 0, max = scores[0];
+		for (int k = 0; k < count; k++) {
+			sum += scores[k];
+			max = std::max(max, scores[k]);
+		}
+		bool probabilities = std::fabs(sum - 1.f) < 0.01f;
+
+		int best = std::max_element(scores, scores + count) - scores;
+		float prob = scores[best];
+		if (!probabilities) {
+			float total = 0;
+			for (int k = 0; k < count; k++)
+				total += std::exp(scores[k] - max);
+			prob = 1.f / total;
+		}
+
+		results[i] = { best, prob };
+	}
+
+	return results;
+}
+
+static float iou(const cv::Rect_<float> &a, const cv::Rect_<float> &b)
+{
+	float inter = (a & b).area();
+	float uni = a.area() + b.area() - inter;
+	return uni > 0 ? inter / uni : 0;
+}
+
+ObjectTracker::ObjectTracker()
+	: nextId_(0)
+{
+}
+
+void ObjectTracker::update(std::vector<Object> &objects,
+			   std::chrono::steady_clock::time_point now)
+{
+	tracks_.erase(std::remove_if(tracks_.begin(), tracks_.end(), [now](const Track &track) {
+		return now - track.seen > TRACK_TIMEOUT;
+	}), tracks_.end());
+
+	struct Match {
+		float iou;
+		unsigned int object;
+		unsigned int track;
+	};
+	std::vector<Match> matches;
+	for (unsigned int i = 0; i < objects.size(); i++) {
+		for (unsigned int t = 0; t < tracks_.size(); t++) {
+			if (objects[i].label != tracks_[t].label)
+				continue;
+			float overlap = iou(objects[i].rect, tracks_[t].rect);
+			if (overlap >= TRACK_MIN_IOU)
+				matches.push_back({ overlap, i, t });
+		}
+	}
+	std::sort(matches.begin(), matches.end(), [](const Match &a, const Match &b) {
+		return a.iou > b.iou;
+	});
+
+	std::vector<bool> trackUsed(tracks_.size(), false);
+	for (Object &obj : objects)
+		obj.track = -1;
+
+	for (const Match &match : matches) {
+		Object &obj = objects[match.object];
+		if (obj.track >= 0 || trackUsed[match.track])
+			continue;
+
+		Track &track = tracks_[match.track];
+		track.rect = obj.rect;
+		track.seen = now;
+		trackUsed[match.track] = true;
+		obj.track = track.id;
+	}
+
+	for (Object &obj : objects) {
+		if (obj.track >= 0)
+			continue;
+
+		obj.track = nextId_++;
+		tracks_.push_back({ obj.track, obj.label, obj.rect, now });
+	}
+}
+
+bool ObjectTracker::alive(int track) const
+{
+	return std::any_of(tracks_.begin(), tracks_.end(), [track](const Track &t) {
+		return t.id == track;
+	});
+}
+
+ClassifierCascade::ClassifierCascade(Classifier &classifier, const std::vector<int> &classes)
+	: classifier_(classifier), classes_(classes), interval_(2000), probDelta_(0.15f),
+	  caching_(true),
+	  classified_(metrics().counter("radaria_classifier_crops_total",
+					"Detections given a second-stage class", "result=\"classified\"")),
+	  cached_(metrics().counter("radaria_classifier_crops_total",
+				    "Detections given a second-stage class", "result=\"cached\""))
+{
+}
+
+bool ClassifierCascade::wanted(int label) const
+{
+	return classes_.empty() ||
+	       std::find(classes_.begin(), classes_.end(), label) != classes_.end();
+}
+
+void ClassifierCascade::process(const Frame &frame, std::vector<Object> &objects)
+{
+	const cv::Rect bounds(0, 0, frame.image.cols, frame.image.rows);
+	std::vector<cv::Mat> crops;
+	std::vector<unsigned int> pending;
+
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		SourceState &state = sources_[frame.source];
+
+		state.tracker.update(objects, frame.timestamp);
+		for (auto it = state.cache.begin(); it != state.cache.end();) {
+			if (state.tracker.alive(it->first))
+				++it;
+			else
+				it = state.cache.erase(it);
+		}
+
+		for (unsigned int i = 0; i < objects.size(); i++) {
+			Object &obj = objects[i];
+			if (!wanted(obj.label))
+				continue;
+
+			auto cached = state.cache.find(obj.track);
+			if (caching_ && cached != state.cache.end() &&
+			    frame.timestamp - cached->second.time < interval_ &&
+			    std::fabs(obj.prob - cached->second.detectionProb) <= probDelta_) {
+				obj.attribute = cached->second.result.label;
+				obj.attributeProb = cached->second.result.prob;
+				cached_.inc();
+				continue;
+			}
+
+			cv::Rect crop = cv::Rect(obj.rect) & bounds;
+			if (crop.width < MIN_CROP_SIZE || crop.height < MIN_CROP_SIZE)
+				continue;
+
+			crops.push_back(frame.image(crop));
+			pending.push_back(i);
+		}
+	}
+
+	if (crops.empty())
+		return;
+
+	std::vector<Classification> results = classifier_.classify(crops);
+
+	/*
+	 * A crop the network failed on keeps its attribute unset and is not
+	 * cached, so the next frame of its track tries again.
+	 */
+	std::unique_lock<std::mutex> locker(lock_);
+	SourceState &state = sources_[frame.source];
+	for (unsigned int k = 0; k < pending.size(); k++) {
+		if (results[k].label < 0)
+			continue;
+
+		classified_.inc();
+
+		Object &obj = objects[pending[k]];
+		obj.attribute = results[k].label;
+		obj.attributeProb = results[k].prob;
+		state.cache[obj.track] = { results[k], obj.prob, frame.timestamp };
+	}
+}
+
+void ClassifierCascade::print(const std::vector<Object> &objects) const
+{
+	for (const Object &obj : objects) {
+		if (obj.attribute < 0)
+			continue;
+
+		fprintf(stderr, "  track %d %s: %s = %.5f\n", obj.track, class_name(obj.label),
+			classifier_.labelName(obj.attribute), obj.attributeProb);
+	}
+}
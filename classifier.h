@@ -0,0 +1,143 @@
+/*
+ * classifier.h - Second-stage classification of detected objects
+ */
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv4/opencv2/core.hpp>
+
+#include "net.h" // NCNN
+
+#include "frame_source.h"
+#include "metrics.h"
+#include "ncnn_inference.h"
+
+struct Classification
+{
+	int label = -1;
+	float prob = 0.f;
+};
+
+/*
+ * Image classifier run on detection crops, such as a vehicle type model.
+ * Expects an Ultralytics classification export: a square RGB input scaled
+ * to 0-1 in "in0" and class probabilities in "out0". Like Detector, the
+ * network is only read while classifying and may be shared by threads.
+ */
+class Classifier
+{
+public:
+	Classifier();
+	~Classifier();
+
+	int load(const std::string &param_path, const std::string &bin_path);
+	bool loaded() const { return loaded_; }
+
+	/* One label per line, in output order. */
+	int loadLabels(const std::string &path);
+	const char *labelName(int label) const;
+
+	/*
+	 * Classify the crops back to back on the same warm network, one
+	 * result per crop in input order. ncnn has no batch dimension, so a
+	 * batch saves the per-call setup rather than the convolutions.
+	 */
+	std::vector<Classification> classify(const std::vector<cv::Mat> &crops);
+
+	std::atomic<int> input_size{224};
+	std::atomic<int> num_threads{0};
+
+private:
+	ncnn::Net net_;
+	ncnn::PoolAllocator blob_allocator_;
+	ncnn::PoolAllocator workspace_allocator_;
+	bool loaded_;
+	std::vector<std::string> labels_;
+};
+
+/*
+ * Follows detections across the frames of one source. Each detection is
+ * matched greedily, best overlap first, to the live track of the same
+ * class it overlaps most, or starts a new track. Tracks not matched for
+ * TRACK_TIMEOUT are dropped.
+ */
+class ObjectTracker
+{
+public:
+	ObjectTracker();
+
+	/* Set Object::track on every detection. */
+	void update(std::vector<Object> &objects, std::chrono::steady_clock::time_point now);
+
+	bool alive(int track) const;
+
+private:
+	struct Track {
+		int id;
+		int label;
+		cv::Rect_<float> rect;
+		std::chrono::steady_clock::time_point seen;
+	};
+
+	std::vector<Track> tracks_;
+	int nextId_;
+};
+
+/*
+ * Runs the classifier on the crops of the detections of interest, all
+ * crops of a frame in one batch, and caches each result on its track. A
+ * tracked object is classified again only once `interval` has passed or
+ * its detection confidence moved by more than `probDelta` since, so a
+ * stable scene costs almost nothing after the first frame. Thread-safe;
+ * frames of each source should arrive roughly in order.
+ */
+class ClassifierCascade
+{
+public:
+	ClassifierCascade(Classifier &classifier, const std::vector<int> &classes);
+
+	void setInterval(std::chrono::milliseconds interval) { interval_ = interval; }
+	void setProbDelta(float delta) { probDelta_ = delta; }
+	/* Classify every crop on every frame, to measure what caching saves. */
+	void setCaching(bool caching) { caching_ = caching; }
+
+	/* Fill in track, attribute and attributeProb of each detection. */
+	void process(const Frame &frame, std::vector<Object> &objects);
+
+	void print(const std::vector<Object> &objects) const;
+
+private:
+	struct CachedResult {
+		Classification result;
+		float detectionProb;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	struct SourceState {
+		ObjectTracker tracker;
+		std::map<int, CachedResult> cache;
+	};
+
+	bool wanted(int label) const;
+
+	Classifier &classifier_;
+	std::vector<int> classes_;
+	std::chrono::milliseconds interval_;
+	float probDelta_;
+	bool caching_;
+
+	std::map<unsigned int, SourceState> sources_;
+	std::mutex lock_;
+
+	Counter &classified_;
+	Counter &cached_;
+};
+
+#endif
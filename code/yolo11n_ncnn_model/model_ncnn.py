@@ -1,3 +1,5 @@
+import sys
+
 import numpy as np
 import ncnn
 import torch
@@ -23,4 +25,9 @@ def test_inference():
         return tuple(out)
 
 if __name__ == "__main__":
-    print(test_inference())
+    out0 = test_inference()
+    print(out0)
+
+    # Optionally dump out0 as raw float32, the golden tool's .out0 format
+    if len(sys.argv) > 1:
+        out0.squeeze(0).numpy().astype(np.float32).tofile(sys.argv[1])
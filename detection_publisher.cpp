@@ -0,0 +1,364 @@
+/*
+ * detection_publisher.cpp - Publish detections and frames to local consumers
+ */
+
+#include "detection_publisher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+uint64_t monotonic_ns(std::chrono::steady_clock::time_point time)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		time.time_since_epoch()).count();
+}
+
+DetectionPublisher::DetectionPublisher()
+	: header_(nullptr), slots_(nullptr), size_(0)
+{
+}
+
+DetectionPublisher::~DetectionPublisher()
+{
+	close();
+}
+
+int DetectionPublisher::open(const std::string &name, uint32_t capacity)
+{
+	name_ = name;
+	size_ = detection_ring_size(capacity);
+
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		std::cerr << "Failed to create " << name << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	if (ftruncate(fd, size_) < 0) {
+		std::cerr << "Failed to size " << name << ": " << strerror(errno) << std::endl;
+		::close(fd);
+		return -1;
+	}
+
+	void *map = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map " << name << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	/* The object is zero-filled by ftruncate(), every seqlock starts even. */
+	header_ = static_cast<DetectionRingHeader *>(map);
+	slots_ = detection_ring_slots(header_);
+
+	header_->version = DETECTION_RING_VERSION;
+	header_->capacity = capacity;
+	header_->head.store(0, std::memory_order_relaxed);
+	header_->futex.store(0, std::memory_order_relaxed);
+
+	/* Readers check the magic last, once everything else is in place. */
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(header_->magic, DETECTION_RING_MAGIC, sizeof(header_->magic));
+
+	return 0;
+}
+
+void DetectionPublisher::close()
+{
+	if (!header_)
+		return;
+
+	munmap(header_, size_);
+	shm_unlink(name_.c_str());
+	header_ = nullptr;
+	slots_ = nullptr;
+}
+
+void DetectionPublisher::publish(const Frame &frame, const std::vector<Object> &objects)
+{
+	if (!header_)
+		return;
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	uint64_t index = header_->head.load(std::memory_order_relaxed);
+	DetectionSlot &slot = slots_[index % header_->capacity];
+
+	uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+	slot.seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	DetectionRecord &record = slot.record;
+	record.index = index;
+	record.frameSequence = frame.sequence;
+	record.captureNs = monotonic_ns(frame.timestamp);
+	record.source = frame.source;
+	record.count = std::min<size_t>(objects.size(), DETECTION_MAX_BOXES);
+	for (uint32_t i = 0; i < record.count; i++) {
+		const Object &obj = objects[i];
+		record.boxes[i] = { obj.rect.x, obj.rect.y, obj.rect.width,
+				    obj.rect.height, obj.prob, obj.label };
+	}
+	record.publishNs = monotonic_ns(std::chrono::steady_clock::now());
+
+	slot.seq.store(seq + 2, std::memory_order_release);
+	header_->head.store(index + 1, std::memory_order_release);
+
+	header_->futex.fetch_add(1, std::memory_order_release);
+	syscall(SYS_futex, &header_->futex, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+FramePublisher::FramePublisher(unsigned int buffers, unsigned int lent)
+	: listenFd_(-1), buffers_(buffers), lent_(lent)
+{
+}
+
+FramePublisher::~FramePublisher()
+{
+	close();
+
+	for (Buffer &buffer : buffers_) {
+		if (buffer.memory)
+			munmap(buffer.memory, buffer.length);
+		if (buffer.fd >= 0)
+			::close(buffer.fd);
+	}
+}
+
+int FramePublisher::open(const std::string &path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)) {
+		std::cerr << "Socket path too long: " << path << std::endl;
+		return -1;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	listenFd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd_ < 0) {
+		std::cerr << "Failed to create socket: " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	unlink(path.c_str());
+	if (bind(listenFd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+	    listen(listenFd_, 8) < 0) {
+		std::cerr << "Failed to listen on " << path << ": " << strerror(errno) << std::endl;
+		::close(listenFd_);
+		listenFd_ = -1;
+		return -1;
+	}
+
+	path_ = path;
+	return 0;
+}
+
+void FramePublisher::close()
+{
+	while (!clients_.empty())
+		dropClient(clients_.back());
+
+	if (listenFd_ >= 0) {
+		::close(listenFd_);
+		unlink(path_.c_str());
+		listenFd_ = -1;
+	}
+}
+
+void FramePublisher::acceptClients()
+{
+	while (true) {
+		int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			return;
+		clients_.push_back({ fd, {} });
+	}
+}
+
+/* Give back the buffers of a client that is gone, and forget it. */
+void FramePublisher::dropClient(Client &client)
+{
+	for (unsigned int index : client.held)
+		releaseBuffer(index);
+	::close(client.fd);
+
+	clients_.erase(clients_.begin() + (&client - clients_.data()));
+}
+
+void FramePublisher::readReleases()
+{
+	for (size_t i = 0; i < clients_.size(); ) {
+		Client &client = clients_[i];
+		bool gone = false;
+
+		while (true) {
+			FrameRelease release;
+			ssize_t ret = recv(client.fd, &release, sizeof(release), MSG_DONTWAIT);
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			if (ret != sizeof(release) || client.held.empty()) {
+				gone = true;
+				break;
+			}
+
+			releaseBuffer(client.held.front());
+			client.held.pop_front();
+		}
+
+		if (gone)
+			dropClient(client);
+		else
+			i++;
+	}
+}
+
+/* Drop one client's hold, handing a lent buffer back once none is left. */
+void FramePublisher::releaseBuffer(unsigned int index)
+{
+	Buffer &buffer = buffers_[index];
+	if (--buffer.holders || !buffer.unhold)
+		return;
+
+	buffer.unhold();
+	buffer.unhold = nullptr;
+}
+
+/* Index of a buffer no client holds, to lend a source buffer in, or -1. */
+int FramePublisher::acquireSlot()
+{
+	unsigned int lent = 0;
+	int free = -1;
+
+	for (unsigned int i = 0; i < buffers_.size(); i++) {
+		if (buffers_[i].unhold)
+			lent++;
+		else if (!buffers_[i].holders && free < 0)
+			free = i;
+	}
+
+	return lent < lent_ ? free : -1;
+}
+
+/* Index of a buffer no client holds, its memfd grown to `length`, or -1. */
+int FramePublisher::acquireBuffer(size_t length)
+{
+	for (unsigned int i = 0; i < buffers_.size(); i++) {
+		Buffer &buffer = buffers_[i];
+		if (buffer.holders)
+			continue;
+
+		if (buffer.length == length)
+			return i;
+
+		if (buffer.memory)
+			munmap(buffer.memory, buffer.length);
+		buffer.memory = nullptr;
+		buffer.length = 0;
+
+		if (buffer.fd < 0)
+			buffer.fd = memfd_create("radaria_frame", MFD_CLOEXEC);
+		if (buffer.fd < 0 || ftruncate(buffer.fd, length) < 0) {
+			std::cerr << "Failed to size frame buffer: " << strerror(errno) << std::endl;
+			return -1;
+		}
+
+		void *memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+				    buffer.fd, 0);
+		if (memory == MAP_FAILED) {
+			std::cerr << "Failed to map frame buffer: " << strerror(errno) << std::endl;
+			return -1;
+		}
+
+		buffer.memory = memory;
+		buffer.length = length;
+		return i;
+	}
+
+	return -1;
+}
+
+void FramePublisher::publish(const Frame &frame)
+{
+	if (listenFd_ < 0 || frame.image.empty())
+		return;
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	acceptClients();
+	readReleases();
+	if (clients_.empty())
+		return;
+
+	const size_t stride = frame.image.step;
+	const bool lend = frame.fd >= 0 && frame.hold;
+	int index = lend ? acquireSlot() : acquireBuffer(stride * frame.image.rows);
+	if (index < 0)
+		return;
+
+	Buffer &buffer = buffers_[index];
+	int fd = frame.fd;
+	size_t offset = frame.fdOffset;
+	size_t length = frame.fdLength;
+	if (!lend) {
+		cv::Mat copy(frame.image.rows, frame.image.cols, frame.image.type(),
+			     buffer.memory, stride);
+		frame.image.copyTo(copy);
+		fd = buffer.fd;
+		offset = 0;
+		length = buffer.length;
+	}
+
+	FrameMessage message = {};
+	message.sequence = frame.sequence;
+	message.captureNs = monotonic_ns(frame.timestamp);
+	message.source = frame.source;
+	message.width = frame.image.cols;
+	message.height = frame.image.rows;
+	message.stride = stride;
+	message.offset = offset;
+	message.length = length;
+
+	struct iovec iov = { &message, sizeof(message) };
+	char control[CMSG_SPACE(sizeof(int))] = {};
+
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	for (size_t i = 0; i < clients_.size(); ) {
+		Client &client = clients_[i];
+		ssize_t ret = sendmsg(client.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			dropClient(client);
+			continue;
+		}
+
+		if (ret >= 0) {
+			client.held.push_back(index);
+			buffer.holders++;
+		}
+		i++;
+	}
+
+	/* Releases are only read under the lock, none can have arrived yet. */
+	if (lend && buffer.holders)
+		buffer.unhold = frame.hold();
+}
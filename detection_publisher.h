@@ -0,0 +1,101 @@
+/*
+ * detection_publisher.h - Publish detections and frames to local consumers
+ */
+#ifndef DETECTION_PUBLISHER_H
+#define DETECTION_PUBLISHER_H
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "detection_ring.h"
+#include "frame_source.h"
+#include "ncnn_inference.h"
+
+/*
+ * Writes one DetectionRecord per inferred frame into a seqlock-protected
+ * ring in POSIX shared memory named `name` (e.g. "/radaria_detections").
+ * Readers live in other processes, see DetectionSubscriber.
+ */
+class DetectionPublisher
+{
+public:
+	DetectionPublisher();
+	~DetectionPublisher();
+
+	int open(const std::string &name, uint32_t capacity = 1024);
+	void close();
+
+	/* Thread-safe, publications from several workers are serialised. */
+	void publish(const Frame &frame, const std::vector<Object> &objects);
+
+private:
+	std::string name_;
+	DetectionRingHeader *header_;
+	DetectionSlot *slots_;
+	uint64_t size_;
+
+	std::mutex lock_;
+};
+
+/*
+ * Shares frames with the clients connected on a Unix socket, passing the
+ * file descriptor of the frame memory for clients to mmap. A frame backed
+ * by a source buffer, such as a camera dmabuf, is sent as is and held
+ * from the source until every client it was sent to has released it; at
+ * most `lent` such buffers are kept from a source at once, so capture
+ * never runs out of buffers. Frames without a backing fd, from replay, are
+ * copied once into one of `buffers` memfds owned by the publisher, reused
+ * only after every client released them. Nothing here blocks: a client
+ * whose socket is full misses the frame, and so does every client when no
+ * buffer is free. Frames are only handled while clients are connected.
+ */
+class FramePublisher
+{
+public:
+	FramePublisher(unsigned int buffers = 4, unsigned int lent = 1);
+	~FramePublisher();
+
+	int open(const std::string &path);
+	void close();
+
+	void publish(const Frame &frame);
+
+private:
+	struct Buffer {
+		/* Memfd of the publisher, for frames copied into it. */
+		int fd = -1;
+		void *memory = nullptr;
+		size_t length = 0;
+		/* Drops the hold on a lent source buffer, empty for the memfd. */
+		std::function<void()> unhold;
+		unsigned int holders = 0;
+	};
+
+	struct Client {
+		int fd;
+		/* Buffers sent and not yet released, oldest first. */
+		std::deque<unsigned int> held;
+	};
+
+	void acceptClients();
+	void readReleases();
+	void dropClient(Client &client);
+	void releaseBuffer(unsigned int index);
+	int acquireBuffer(size_t length);
+	int acquireSlot();
+
+	std::string path_;
+	int listenFd_;
+	std::vector<Buffer> buffers_;
+	unsigned int lent_;
+	std::vector<Client> clients_;
+
+	std::mutex lock_;
+};
+
+uint64_t monotonic_ns(std::chrono::steady_clock::time_point time);
+
+#endif
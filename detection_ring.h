@@ -0,0 +1,102 @@
+/*
+ * detection_ring.h - Shared-memory layout for published detections
+ *
+ * The publisher owns a POSIX shared memory object holding a header and a
+ * ring of fixed-size slots. Each slot is guarded by a seqlock: the writer
+ * makes the slot sequence odd, copies the record and makes it even again.
+ * Readers copy the record and retry if the sequence was odd or changed
+ * meanwhile, so the writer never waits for a reader. The header counter
+ * `futex` is bumped after each record so idle readers can sleep in
+ * FUTEX_WAIT instead of polling.
+ */
+#ifndef DETECTION_RING_H
+#define DETECTION_RING_H
+
+#include <atomic>
+#include <cstdint>
+
+#define DETECTION_RING_MAGIC "RDDETRG1"
+#define DETECTION_RING_VERSION 1
+#define DETECTION_MAX_BOXES 32
+
+struct DetectionBox
+{
+	float x;
+	float y;
+	float width;
+	float height;
+	float prob;
+	int32_t label;
+};
+
+struct DetectionRecord
+{
+	/* Position of this record in the publish order, starting at 0. */
+	uint64_t index;
+	uint64_t frameSequence;
+	/* CLOCK_MONOTONIC nanoseconds of capture and of publication. */
+	uint64_t captureNs;
+	uint64_t publishNs;
+	uint32_t source;
+	uint32_t count;
+	DetectionBox boxes[DETECTION_MAX_BOXES];
+};
+
+struct DetectionSlot
+{
+	std::atomic<uint32_t> seq;
+	uint32_t reserved;
+	DetectionRecord record;
+};
+
+struct DetectionRingHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity;
+	/* Number of records published so far. */
+	std::atomic<uint64_t> head;
+	std::atomic<uint32_t> futex;
+	uint32_t reserved;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+	      "the ring needs lock-free 64-bit atomics in shared memory");
+
+/*
+ * Frame channel: one message per frame on a SOCK_SEQPACKET Unix socket,
+ * with the memory holding the pixels attached as SCM_RIGHTS: the camera
+ * dmabuf itself, or a publisher memfd with a copy for frames not backed by
+ * one. Pixels are packed BGR888 rows of `stride` bytes starting at
+ * `offset`. The client answers every frame with a FrameRelease, in the
+ * order received, once it no longer reads the pixels; until then the
+ * publisher does not reuse the memory.
+ */
+struct FrameMessage
+{
+	uint64_t sequence;
+	uint64_t captureNs;
+	uint32_t source;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint64_t offset;
+	uint64_t length;
+};
+
+struct FrameRelease
+{
+	uint64_t sequence;
+};
+
+static inline uint64_t detection_ring_size(uint32_t capacity)
+{
+	return sizeof(DetectionRingHeader) + uint64_t(capacity) * sizeof(DetectionSlot);
+}
+
+static inline DetectionSlot *detection_ring_slots(DetectionRingHeader *header)
+{
+	return reinterpret_cast<DetectionSlot *>(header + 1);
+}
+
+#endif
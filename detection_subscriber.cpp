@@ -0,0 +1,249 @@
+/*
+ * detection_subscriber.cpp - Client side of the detection and frame channels
+ */
+
+#include "detection_subscriber.h"
+
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+DetectionSubscriber::DetectionSubscriber()
+	: header_(nullptr), slots_(nullptr), size_(0), cursor_(0), missed_(0)
+{
+}
+
+DetectionSubscriber::~DetectionSubscriber()
+{
+	close();
+}
+
+int DetectionSubscriber::open(const std::string &name)
+{
+	int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		std::cerr << "Failed to open " << name << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(DetectionRingHeader))) {
+		std::cerr << name << " is not a detection ring" << std::endl;
+		::close(fd);
+		return -1;
+	}
+
+	/*
+	 * The futex word lives in the header, FUTEX_WAIT only needs read
+	 * access to it.
+	 */
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map " << name << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	header_ = static_cast<DetectionRingHeader *>(map);
+	size_ = st.st_size;
+
+	if (memcmp(header_->magic, DETECTION_RING_MAGIC, sizeof(header_->magic)) ||
+	    header_->version != DETECTION_RING_VERSION ||
+	    detection_ring_size(header_->capacity) > size_) {
+		std::cerr << name << " is not a compatible detection ring" << std::endl;
+		close();
+		return -1;
+	}
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	slots_ = detection_ring_slots(header_);
+	cursor_ = header_->head.load(std::memory_order_acquire);
+
+	return 0;
+}
+
+void DetectionSubscriber::close()
+{
+	if (header_)
+		munmap(header_, size_);
+	header_ = nullptr;
+	slots_ = nullptr;
+}
+
+bool DetectionSubscriber::tryRead(DetectionRecord &record)
+{
+	while (true) {
+		uint64_t head = header_->head.load(std::memory_order_acquire);
+		if (cursor_ >= head)
+			return false;
+
+		/* The writer lapped us, skip to the oldest record still held. */
+		if (head - cursor_ > header_->capacity) {
+			missed_ += head - header_->capacity - cursor_;
+			cursor_ = head - header_->capacity;
+		}
+
+		const DetectionSlot &slot = slots_[cursor_ % header_->capacity];
+
+		uint32_t seq = slot.seq.load(std::memory_order_acquire);
+		if (seq & 1)
+			continue;
+
+		memcpy(&record, &slot.record, sizeof(record));
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		if (slot.seq.load(std::memory_order_relaxed) != seq)
+			continue;
+
+		/* Overwritten by a later lap between the head check and the copy. */
+		if (record.index != cursor_) {
+			missed_++;
+			cursor_++;
+			continue;
+		}
+
+		cursor_++;
+		return true;
+	}
+}
+
+bool DetectionSubscriber::next(DetectionRecord &record, int timeoutMs)
+{
+	if (!header_)
+		return false;
+
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeoutMs / 1000;
+	deadline.tv_nsec += (timeoutMs % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while (true) {
+		uint32_t futex = header_->futex.load(std::memory_order_acquire);
+		if (tryRead(record))
+			return true;
+
+		struct timespec timeout;
+		struct timespec *ptimeout = nullptr;
+		if (timeoutMs >= 0) {
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			long long ns = (deadline.tv_sec - now.tv_sec) * 1000000000LL +
+				       (deadline.tv_nsec - now.tv_nsec);
+			if (ns <= 0)
+				return false;
+			timeout.tv_sec = ns / 1000000000LL;
+			timeout.tv_nsec = ns % 1000000000LL;
+			ptimeout = &timeout;
+		}
+
+		syscall(SYS_futex, &header_->futex, FUTEX_WAIT, futex, ptimeout, nullptr, 0);
+	}
+}
+
+FrameSubscriber::FrameSubscriber()
+	: fd_(-1), frameFd_(-1), map_(nullptr), mapLength_(0), holding_(false),
+	  heldSequence_(0)
+{
+}
+
+FrameSubscriber::~FrameSubscriber()
+{
+	close();
+}
+
+int FrameSubscriber::connect(const std::string &path)
+{
+	struct sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		return -1;
+	strcpy(addr.sun_path, path.c_str());
+
+	fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd_ < 0)
+		return -1;
+
+	if (::connect(fd_, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+		std::cerr << "Failed to connect to " << path << ": " << strerror(errno) << std::endl;
+		::close(fd_);
+		fd_ = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+void FrameSubscriber::unmap()
+{
+	/* Closing the socket releases everything, so only tell a live one. */
+	if (holding_ && fd_ >= 0) {
+		FrameRelease release = { heldSequence_ };
+		send(fd_, &release, sizeof(release), MSG_NOSIGNAL);
+	}
+	holding_ = false;
+
+	if (map_)
+		munmap(map_, mapLength_);
+	if (frameFd_ >= 0)
+		::close(frameFd_);
+	map_ = nullptr;
+	frameFd_ = -1;
+}
+
+void FrameSubscriber::close()
+{
+	unmap();
+	if (fd_ >= 0)
+		::close(fd_);
+	fd_ = -1;
+}
+
+const uint8_t *FrameSubscriber::next(FrameMessage &message)
+{
+	unmap();
+
+	struct iovec iov = { &message, sizeof(message) };
+	char control[CMSG_SPACE(sizeof(int))] = {};
+
+	struct msghdr msg = {};
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	ssize_t ret = recvmsg(fd_, &msg, MSG_CMSG_CLOEXEC);
+	if (ret != sizeof(message))
+		return nullptr;
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+		return nullptr;
+	memcpy(&frameFd_, CMSG_DATA(cmsg), sizeof(int));
+
+	/* From here on the frame is ours, and must be released even if unusable. */
+	holding_ = true;
+	heldSequence_ = message.sequence;
+
+	mapLength_ = message.offset + message.length;
+	map_ = mmap(nullptr, mapLength_, PROT_READ, MAP_SHARED, frameFd_, 0);
+	if (map_ == MAP_FAILED) {
+		map_ = nullptr;
+		return nullptr;
+	}
+
+	return static_cast<const uint8_t *>(map_) + message.offset;
+}
@@ -0,0 +1,78 @@
+/*
+ * detection_subscriber.h - Client side of the detection and frame channels
+ *
+ * Consumers only need this header, detection_ring.h and
+ * detection_subscriber.cpp; nothing here depends on libcamera or ncnn.
+ */
+#ifndef DETECTION_SUBSCRIBER_H
+#define DETECTION_SUBSCRIBER_H
+
+#include <cstdint>
+#include <string>
+
+#include "detection_ring.h"
+
+class DetectionSubscriber
+{
+public:
+	DetectionSubscriber();
+	~DetectionSubscriber();
+
+	/* Attach to a ring and start after the most recent record. */
+	int open(const std::string &name);
+	void close();
+
+	/*
+	 * Copy the next record into `record`. Waits up to timeoutMs
+	 * milliseconds for a new record, -1 waits forever. Returns false on
+	 * timeout. Records overwritten before they could be read are skipped
+	 * and counted in missed().
+	 */
+	bool next(DetectionRecord &record, int timeoutMs = -1);
+
+	uint64_t missed() const { return missed_; }
+
+private:
+	bool tryRead(DetectionRecord &record);
+
+	DetectionRingHeader *header_;
+	DetectionSlot *slots_;
+	uint64_t size_;
+	uint64_t cursor_;
+	uint64_t missed_;
+};
+
+/*
+ * Receives frames from a FramePublisher socket. Each received frame stays
+ * mapped and unchanged until the next call or close(), which release it
+ * back to the publisher. A client holding a frame for long makes the
+ * publisher drop frames once all its buffers are held.
+ */
+class FrameSubscriber
+{
+public:
+	FrameSubscriber();
+	~FrameSubscriber();
+
+	int connect(const std::string &path);
+	void close();
+
+	/*
+	 * Block until a frame arrives, map it and return a pointer to its
+	 * first pixel, or nullptr on error.
+	 */
+	const uint8_t *next(FrameMessage &message);
+
+private:
+	void unmap();
+
+	int fd_;
+	int frameFd_;
+	void *map_;
+	size_t mapLength_;
+	/* Sequence of the frame held, to release with the next call. */
+	bool holding_;
+	uint64_t heldSequence_;
+};
+
+#endif
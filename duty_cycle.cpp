@@ -0,0 +1,81 @@
+/*
+ * duty_cycle.cpp - Low idle frame rate for sources watching a quiet scene
+ */
+
+#include "duty_cycle.h"
+
+#include <iostream>
+
+#include "frame_signature.h"
+
+static std::string source_labels(const FrameSource &source)
+{
+	return "source=\"" + std::to_string(source.id()) + "\"";
+}
+
+DutyCycle::DutyCycle(FrameSource &source, std::chrono::microseconds idleDuration,
+		     std::chrono::milliseconds quiet)
+	: source_(source), idleDuration_(idleDuration), quiet_(quiet),
+	  motionBits_(DUTY_CYCLE_MOTION_BITS), active_(false), hashValid_(false),
+	  lastHash_(0),
+	  activeGauge_(metrics().gauge("radaria_duty_cycle_active",
+				       "Whether the source runs at full frame rate",
+				       source_labels(source))),
+	  motionWakeups_(metrics().counter("radaria_duty_cycle_wakeups_total",
+					   "Switches from the idle to the full frame rate",
+					   source_labels(source) + ",reason=\"motion\"")),
+	  detectionWakeups_(metrics().counter("radaria_duty_cycle_wakeups_total",
+					      "Switches from the idle to the full frame rate",
+					      source_labels(source) + ",reason=\"detection\""))
+{
+}
+
+int DutyCycle::start()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	if (source_.setFrameDuration(idleDuration_)) {
+		std::cerr << source_.name() << ": frame rate cannot be changed, "
+			  << "duty cycling disabled" << std::endl;
+		return -1;
+	}
+
+	active_ = false;
+	hashValid_ = false;
+	activeGauge_.set(0);
+	return 0;
+}
+
+void DutyCycle::setActive(bool active, const char *reason)
+{
+	if (active == active_)
+		return;
+
+	/* Zero restores the rate the source was configured with. */
+	source_.setFrameDuration(active ? std::chrono::microseconds(0) : idleDuration_);
+	active_ = active;
+	activeGauge_.set(active);
+
+	std::cout << source_.name() << ": " << (active ? "full" : "idle")
+		  << " frame rate, " << reason << std::endl;
+}
+
+void DutyCycle::observe(const Frame &frame, const std::vector<Object> &objects)
+{
+	uint64_t hash = frame_dhash(frame.image);
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	bool motion = hashValid_ && dhash_distance(hash, lastHash_) > motionBits_;
+	lastHash_ = hash;
+	hashValid_ = true;
+
+	if (!objects.empty() || motion) {
+		lastActivity_ = std::max(lastActivity_, frame.timestamp);
+		if (!active_)
+			(objects.empty() ? motionWakeups_ : detectionWakeups_).inc();
+		setActive(true, objects.empty() ? "motion" : "detection");
+	} else if (active_ && frame.timestamp - lastActivity_ >= quiet_) {
+		setActive(false, "quiet");
+	}
+}
@@ -0,0 +1,63 @@
+/*
+ * duty_cycle.h - Low idle frame rate for sources watching a quiet scene
+ */
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "frame_source.h"
+#include "metrics.h"
+#include "ncnn_inference.h"
+
+/* dHash bits two consecutive frames must differ by to count as motion. */
+#define DUTY_CYCLE_MOTION_BITS 6
+
+/*
+ * Drives the frame duration of one source. The source captures at the idle
+ * duration until a frame shows motion, a dHash distance from the previous
+ * frame over the motion threshold, or any detection. It then runs at full
+ * rate and falls back once `quiet` has passed without either.
+ *
+ * Time is taken from the frame timestamps only, so a simulated source
+ * drives the state machine exactly like a camera. observe() is thread-safe
+ * and is meant to be called with the results of every inferred frame.
+ */
+class DutyCycle
+{
+public:
+	DutyCycle(FrameSource &source, std::chrono::microseconds idleDuration,
+		  std::chrono::milliseconds quiet);
+
+	void setMotionThreshold(int bits) { motionBits_ = bits; }
+
+	/* Enter the idle state. Fails if the source cannot change its rate. */
+	int start();
+
+	void observe(const Frame &frame, const std::vector<Object> &objects);
+
+	bool active() const { return active_; }
+
+private:
+	void setActive(bool active, const char *reason);
+
+	FrameSource &source_;
+	std::chrono::microseconds idleDuration_;
+	std::chrono::steady_clock::duration quiet_;
+	int motionBits_;
+
+	std::mutex lock_;
+	bool active_;
+	bool hashValid_;
+	uint64_t lastHash_;
+	std::chrono::steady_clock::time_point lastActivity_;
+
+	Gauge &activeGauge_;
+	Counter &motionWakeups_;
+	Counter &detectionWakeups_;
+};
+
+#endif
@@ -19,6 +19,7 @@ EventLoop::EventLoop()
 
 	evthread_use_pthreads();
 	event_ = event_base_new();
+	timeout_ = nullptr;
 	instance_ = this;
 }
 
@@ -26,6 +27,10 @@ EventLoop::~EventLoop()
 {
 	instance_ = nullptr;
 
+	events_.clear();
+	if (timeout_)
+		event_free(timeout_);
+
 	event_base_free(event_);
 	libevent_global_shutdown();
 }
@@ -64,13 +69,13 @@ void EventLoop::timeoutTriggered(int fd, short event, void *arg)
 
 void EventLoop::timeout(unsigned int sec)
 {
-	struct event *ev;
 	struct timeval tv;
 
 	tv.tv_sec = sec;
 	tv.tv_usec = 0;
-	ev = evtimer_new(event_, &timeoutTriggered, this);
-	evtimer_add(ev, &tv);
+	if (!timeout_)
+		timeout_ = evtimer_new(event_, &timeoutTriggered, this);
+	evtimer_add(timeout_, &tv);
 }
 
 void EventLoop::callLater(const std::function<void()> &func)
@@ -83,6 +88,43 @@ void EventLoop::callLater(const std::function<void()> &func)
 	interrupt();
 }
 
+void EventLoop::addFdEvent(int fd, EventType type,
+			   const std::function<void()> &callback)
+{
+	short events = (type & Read ? EV_READ : 0)
+		     | (type & Write ? EV_WRITE : 0)
+		     | EV_PERSIST;
+
+	std::unique_ptr<Event> event = std::make_unique<Event>(callback);
+	event->event_ = event_new(event_, fd, events, &EventLoop::Event::dispatch,
+				  event.get());
+	if (!event->event_)
+		return;
+
+	event_add(event->event_, nullptr);
+	events_.push_back(std::move(event));
+}
+
+EventLoop::Event::Event(const std::function<void()> &callback)
+	: callback_(callback), event_(nullptr)
+{
+}
+
+EventLoop::Event::~Event()
+{
+	if (event_) {
+		event_del(event_);
+		event_free(event_);
+	}
+}
+
+void EventLoop::Event::dispatch([[maybe_unused]] int fd,
+				[[maybe_unused]] short events, void *arg)
+{
+	Event *event = static_cast<Event *>(arg);
+	event->callback_();
+}
+
 void EventLoop::dispatchCalls()
 {
 	std::unique_lock<std::mutex> locker(lock_);
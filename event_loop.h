@@ -10,28 +10,54 @@
 #include <atomic>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 
+struct event;
 struct event_base;
 
 class EventLoop
 {
 public:
+	enum EventType {
+		Read = 1,
+		Write = 2,
+	};
+
 	EventLoop();
 	~EventLoop();
 
 	void exit(int code = 0);
 	int exec();
 
+	/* (Re)arm the exit timer, replacing any earlier timeout. */
 	void timeout(unsigned int sec);
 	void callLater(const std::function<void()> &func);
 
+	/* Call handler on the loop thread whenever fd becomes ready. */
+	void addFdEvent(int fd, EventType type,
+			const std::function<void()> &handler);
+
+	struct event_base *base() { return event_; }
+
 private:
+	struct Event {
+		Event(const std::function<void()> &callback);
+		~Event();
+
+		static void dispatch(int fd, short events, void *arg);
+
+		std::function<void()> callback_;
+		struct event *event_;
+	};
+
 	static EventLoop *instance_;
 
 	static void timeoutTriggered(int fd, short event, void *arg);
 
 	struct event_base *event_;
+	struct event *timeout_;
+	std::list<std::unique_ptr<Event>> events_;
 	std::atomic<bool> exit_;
 	int exitCode_;
 
@@ -0,0 +1,195 @@
+/*
+ * event_query.cpp - Query the detection event store
+ *
+ * Usage:
+ *   event_query STORE [--from TIME] [--to TIME] [--class NAME[,NAME]]
+ *               [--source N] [--count]
+ *
+ * TIME is local time formatted as YYYYmmdd_HHMMSS, nanoseconds since the
+ * epoch, or -N followed by s, m, h or d for that long before now. Without
+ * --count every matching detection is printed, one per line; with it,
+ * the number of detections and the first and last sighting per class.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+
+#include "class_names.h"
+#include "event_store.h"
+
+static uint64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool parse_time(const std::string &text, uint64_t &timestampNs)
+{
+	struct tm tm = {};
+	const char *end = strptime(text.c_str(), "%Y%m%d_%H%M%S", &tm);
+	if (end && !*end) {
+		tm.tm_isdst = -1;
+		timestampNs = static_cast<uint64_t>(mktime(&tm)) * 1000000000ull;
+		return true;
+	}
+
+	if (text.size() > 2 && text[0] == '-') {
+		static const std::map<char, uint64_t> units = {
+			{ 's', 1ull }, { 'm', 60ull }, { 'h', 3600ull }, { 'd', 86400ull },
+		};
+		auto unit = units.find(text.back());
+		char *last;
+		uint64_t count = strtoull(text.c_str() + 1, &last, 10);
+		if (unit == units.end() || last != &text.back())
+			return false;
+
+		timestampNs = now_ns() - count * unit->second * 1000000000ull;
+		return true;
+	}
+
+	char *last;
+	timestampNs = strtoull(text.c_str(), &last, 10);
+	return !text.empty() && !*last;
+}
+
+static std::string format_time(uint64_t timestampNs)
+{
+	time_t seconds = timestampNs / 1000000000ull;
+	struct tm tm;
+	localtime_r(&seconds, &tm);
+
+	char text[48];
+	size_t length = strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(text + length, sizeof(text) - length, ".%03llu",
+		 static_cast<unsigned long long>(timestampNs / 1000000ull % 1000));
+	return text;
+}
+
+static void usage()
+{
+	std::cerr << "Usage: event_query STORE [options]" << std::endl
+		  << "      --from TIME          first time included (default: the beginning)" << std::endl
+		  << "      --to TIME            first time excluded (default: now)" << std::endl
+		  << "      --class NAME[,NAME]  only these classes" << std::endl
+		  << "      --source N           only detections of source N" << std::endl
+		  << "      --count              summarise per class instead of listing" << std::endl
+		  << "TIME is YYYYmmdd_HHMMSS, nanoseconds since the epoch, or -N[smhd] before now" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	enum { OptFrom = 256, OptTo, OptClass, OptSource, OptCount };
+	static const struct option longOptions[] = {
+		{ "from", required_argument, nullptr, OptFrom },
+		{ "to", required_argument, nullptr, OptTo },
+		{ "class", required_argument, nullptr, OptClass },
+		{ "source", required_argument, nullptr, OptSource },
+		{ "count", no_argument, nullptr, OptCount },
+		{ nullptr, 0, nullptr, 0 },
+	};
+
+	uint64_t fromNs = 0;
+	uint64_t toNs = now_ns();
+	std::vector<int> classes;
+	int source = -1;
+	bool count = false;
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", longOptions, nullptr)) != -1) {
+		switch (opt) {
+		case OptFrom:
+		case OptTo:
+			if (!parse_time(optarg, opt == OptFrom ? fromNs : toNs)) {
+				std::cerr << "Invalid time '" << optarg << "'" << std::endl;
+				return EXIT_FAILURE;
+			}
+			break;
+		case OptClass: {
+			std::stringstream ss(optarg);
+			std::string name;
+			while (std::getline(ss, name, ',')) {
+				int label = class_index(name);
+				if (label < 0) {
+					std::cerr << "Unknown class '" << name << "'" << std::endl;
+					return EXIT_FAILURE;
+				}
+				classes.push_back(label);
+			}
+			break;
+		}
+		case OptSource:
+			source = std::stoi(optarg);
+			break;
+		case OptCount:
+			count = true;
+			break;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+
+	EventStoreReader reader;
+	if (reader.open(argv[optind]))
+		return EXIT_FAILURE;
+
+	struct Summary {
+		uint64_t count = 0;
+		uint64_t firstNs = UINT64_MAX;
+		uint64_t lastNs = 0;
+	};
+	std::map<int, Summary> summaries;
+
+	EventStoreReader::Stats stats;
+	uint64_t matched = 0;
+	reader.query(fromNs, toNs, classes, [&](const EventRecord &record) {
+		if (source >= 0 && record.source != source)
+			return;
+
+		matched++;
+		if (count) {
+			Summary &summary = summaries[record.label];
+			summary.count++;
+			summary.firstNs = std::min(summary.firstNs, record.timestampNs);
+			summary.lastNs = std::max(summary.lastNs, record.timestampNs);
+			return;
+		}
+
+		printf("%s\tsource %u\tseq %u\t%s\t%.2f\t%.3f %.3f %.3f %.3f\n",
+		       format_time(record.timestampNs).c_str(), record.source,
+		       record.sequence, class_name(record.label), record.prob,
+		       record.x / 65535.0, record.y / 65535.0,
+		       record.width / 65535.0, record.height / 65535.0);
+	}, &stats);
+
+	for (const auto &entry : summaries)
+		printf("%-14s %8llu  %s  %s\n", class_name(entry.first),
+		       static_cast<unsigned long long>(entry.second.count),
+		       format_time(entry.second.firstNs).c_str(),
+		       format_time(entry.second.lastNs).c_str());
+
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	fprintf(stderr, "%llu detections from %llu of %llu blocks in %.2f ms\n",
+		static_cast<unsigned long long>(matched),
+		static_cast<unsigned long long>(stats.blocksRead),
+		static_cast<unsigned long long>(stats.blocks), elapsed.count());
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,315 @@
+/*
+ * event_recorder.cpp - Event-triggered JPEG recording with a pre-event ring
+ */
+
+#include "event_recorder.h"
+
+#include "metrics.h"
+#include "perf_counters.h"
+#include "retention.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+
+/* Sharpness at which a shot keeps three quarters of its confidence. */
+#define SHARPNESS_KNEE 100.0
+
+EventRecorder::EventRecorder(const std::string &prefix, size_t ringBytes,
+			     unsigned int maxFrames)
+	: prefix_(prefix), preRoll_(std::chrono::seconds(5)),
+	  postRoll_(std::chrono::seconds(5)), quality_(85), writer_(nullptr),
+	  source_(0), scratch_(nullptr),
+	  scratchSize_(0), ring_(ringBytes), head_(0),
+	  slots_(maxFrames ? maxFrames : 1), first_(0), count_(0),
+	  recording_(false), eventFrames_(0), shotCount_(0)
+{
+	tj_ = tjInitCompress();
+}
+
+EventRecorder::~EventRecorder()
+{
+	tjFree(scratch_);
+	tjDestroy(tj_);
+}
+
+void EventRecorder::setPreRoll(double seconds)
+{
+	preRoll_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(seconds));
+}
+
+void EventRecorder::setPostRoll(double seconds)
+{
+	postRoll_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(seconds));
+}
+
+void EventRecorder::setBestShots(unsigned int shots)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	shots_.resize(shots);
+	shotCount_ = 0;
+}
+
+const Object *EventRecorder::strongestTrigger(const std::vector<Object> &objects) const
+{
+	const Object *strongest = nullptr;
+	for (const Object &obj : objects) {
+		if (std::find(classes_.begin(), classes_.end(), obj.label) == classes_.end())
+			continue;
+		if (!strongest || obj.prob > strongest->prob)
+			strongest = &obj;
+	}
+	return strongest;
+}
+
+/*
+ * Compress into the scratch buffer, which is sized for the worst case of
+ * the current resolution and only reallocated when the resolution changes.
+ */
+int EventRecorder::compress(const cv::Mat &image, unsigned long &size)
+{
+	static Counter &encodes = metrics().counter("radaria_jpeg_encodes_total",
+		"JPEG images compressed by output", "output=\"event\"");
+	encodes.inc();
+
+	unsigned long bound = tjBufSize(image.cols, image.rows, TJSAMP_420);
+	if (bound > scratchSize_) {
+		tjFree(scratch_);
+		scratch_ = tjAlloc(bound);
+		scratchSize_ = scratch_ ? bound : 0;
+		if (!scratch_)
+			return -1;
+	}
+
+	size = scratchSize_;
+	PerfScope perf(PerfStage::Encode);
+	int ret = tjCompress2(tj_, image.data, image.cols, (int)image.step, image.rows,
+			      TJPF_BGR, &scratch_, &size, TJSAMP_420, quality_,
+			      TJFLAG_FASTDCT | TJFLAG_NOREALLOC);
+	if (ret < 0) {
+		std::cerr << "JPEG compression failed: " << tjGetErrorStr2(tj_) << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+void EventRecorder::evictOldest()
+{
+	first_ = (first_ + 1) % slots_.size();
+	count_--;
+}
+
+/*
+ * Append the compressed frame to the ring. Space is handed out sequentially
+ * and wraps to the start when the tail is too short. Live slots therefore
+ * form at most two runs in FIFO order, the older one at or past head_ and
+ * the newer one before it, each with ascending offsets. Skipping the tail
+ * evicts the older run entirely; after that the oldest slot is always the
+ * lowest one at or past the new offset, so evicting in FIFO order until it
+ * no longer overlaps frees the space.
+ */
+void EventRecorder::store(const Frame &frame, unsigned long size)
+{
+	if (size > ring_.size()) {
+		std::cerr << "Frame of " << size << " bytes exceeds the pre-event ring" << std::endl;
+		return;
+	}
+
+	size_t offset = head_;
+	if (offset + size > ring_.size()) {
+		while (count_ && slots_[first_].offset >= head_)
+			evictOldest();
+		offset = 0;
+	}
+
+	while (count_) {
+		const Slot &oldest = slots_[first_];
+		bool overlaps = oldest.offset < offset + size &&
+				offset < oldest.offset + oldest.size;
+		bool expired = frame.timestamp - oldest.timestamp > preRoll_;
+
+		if (!overlaps && !expired && count_ < slots_.size())
+			break;
+
+		evictOldest();
+	}
+
+	std::copy(scratch_, scratch_ + size, ring_.begin() + offset);
+	head_ = offset + size;
+
+	Slot &slot = slots_[(first_ + count_) % slots_.size()];
+	slot.offset = offset;
+	slot.size = size;
+	slot.timestamp = frame.timestamp;
+	slot.sequence = frame.sequence;
+	slot.wallclockNs = wallclock_ns();
+	count_++;
+}
+
+void EventRecorder::flushRing()
+{
+	while (count_) {
+		const Slot &slot = slots_[first_];
+		writeFrame(ring_.data() + slot.offset, slot.size, slot.sequence,
+			   slot.wallclockNs);
+		evictOldest();
+	}
+
+	head_ = 0;
+}
+
+void EventRecorder::writeFrame(const unsigned char *data, size_t size,
+			       uint64_t sequence, uint64_t wallclockNs)
+{
+	eventFrames_++;
+
+	if (writer_) {
+		writer_->append(data, size, wallclockNs, sequence, source_);
+		return;
+	}
+
+	char filename[256];
+	snprintf(filename, sizeof(filename), "%s_%06llu.jpg", eventName_.c_str(),
+		 static_cast<unsigned long long>(sequence));
+
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		std::cerr << "Failed to open " << filename << std::endl;
+		return;
+	}
+
+	if (fwrite(data, 1, size, file) != size)
+		std::cerr << "Failed to write " << filename << std::endl;
+	fclose(file);
+
+	static Counter &written = metrics().counter("radaria_jpeg_bytes_written_total",
+		"JPEG bytes written to disk by output", "output=\"event\"");
+	written.inc(size);
+
+	RetentionManager::track(filename, size);
+}
+
+void EventRecorder::startEvent()
+{
+	std::time_t now = std::time(nullptr);
+	char stamp[32];
+	std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&now));
+	eventName_ = prefix_ + "_" + stamp;
+	eventFrames_ = 0;
+	recording_ = true;
+
+	std::cout << "Event " << eventName_ << " started" << std::endl;
+
+	/* The first frame of an event is kept even if the scene looks still. */
+	dedup_.reset();
+	flushRing();
+}
+
+void EventRecorder::endEvent()
+{
+	recording_ = false;
+
+	std::sort(shots_.begin(), shots_.begin() + shotCount_,
+		  [](const Shot &a, const Shot &b) { return a.sequence < b.sequence; });
+	for (unsigned int i = 0; i < shotCount_; i++)
+		writeFrame(shots_[i].jpeg.data(), shots_[i].jpeg.size(),
+			   shots_[i].sequence, shots_[i].wallclockNs);
+	shotCount_ = 0;
+
+	std::cout << "Event " << eventName_ << " ended after "
+		  << eventFrames_ << " frames" << std::endl;
+}
+
+/*
+ * Confidence ranks the shots, sharpness of the trigger's box scales it
+ * down by at most half, so a blurred but certain detection still beats a
+ * sharp frame without one. Frames of the post-roll carrying no trigger
+ * score zero and only fill free slots.
+ */
+void EventRecorder::offerShot(const Frame &frame, const Object *trigger)
+{
+	static Counter &suppressed = metrics().counter("radaria_event_frames_suppressed_total",
+		"Event frames not saved", "reason=\"best_shot\"");
+
+	double score = 0;
+	if (trigger) {
+		double sharpness = frame_sharpness(frame.image, trigger->rect);
+		score = trigger->prob * (0.5 + 0.5 * sharpness / (sharpness + SHARPNESS_KNEE));
+	}
+
+	unsigned int index = shotCount_;
+	if (shotCount_ == shots_.size()) {
+		index = 0;
+		for (unsigned int i = 1; i < shotCount_; i++)
+			if (shots_[i].score < shots_[index].score)
+				index = i;
+
+		if (score <= shots_[index].score) {
+			suppressed.inc();
+			return;
+		}
+
+		/* The shot displaced will not be saved either. */
+		suppressed.inc();
+	}
+
+	unsigned long size;
+	if (compress(frame.image, size))
+		return;
+
+	Shot &shot = shots_[index];
+	shot.jpeg.assign(scratch_, scratch_ + size);
+	shot.score = score;
+	shot.sequence = frame.sequence;
+	shot.wallclockNs = wallclock_ns();
+	if (index == shotCount_)
+		shotCount_++;
+}
+
+void EventRecorder::addFrame(const Frame &frame, const std::vector<Object> &objects)
+{
+	static Counter &duplicates = metrics().counter("radaria_event_frames_suppressed_total",
+		"Event frames not saved", "reason=\"duplicate\"");
+
+	std::unique_lock<std::mutex> locker(lock_);
+
+	source_ = frame.source;
+
+	const Object *trigger = strongestTrigger(objects);
+	if (trigger) {
+		if (!recording_)
+			startEvent();
+		postRollEnd_ = frame.timestamp + postRoll_;
+	}
+
+	if (dedup_.duplicate(frame.image)) {
+		duplicates.inc();
+	} else if (!shots_.empty()) {
+		if (recording_)
+			offerShot(frame, trigger);
+	} else {
+		unsigned long size;
+		if (compress(frame.image, size))
+			return;
+
+		if (recording_)
+			writeFrame(scratch_, size, frame.sequence, wallclock_ns());
+		else
+			store(frame, size);
+	}
+
+	if (recording_ && frame.timestamp > postRollEnd_)
+		endEvent();
+}
+
+void EventRecorder::close()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	if (recording_)
+		endEvent();
+}
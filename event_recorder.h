@@ -0,0 +1,123 @@
+/*
+ * event_recorder.h - Event-triggered JPEG recording with a pre-event ring
+ */
+#ifndef EVENT_RECORDER_H
+#define EVENT_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <turbojpeg.h>
+
+#include "frame_signature.h"
+#include "frame_source.h"
+#include "mjpeg_container.h"
+#include "ncnn_inference.h"
+
+/*
+ * Every frame of one source is JPEG-compressed into a fixed-size in-memory
+ * ring covering the last preRoll seconds. When a trigger class is detected
+ * the ring is flushed to disk, followed by every frame until postRoll
+ * seconds after the last trigger. The ring, its slot table and the
+ * compression buffer are allocated once, so steady-state memory is bounded
+ * by ringBytes and nothing is allocated per frame.
+ *
+ * Frames that are near-duplicates of the last one kept are dropped before
+ * compression. In best-shot mode there is no pre-event ring: frames of an
+ * event are scored by the sharpness and confidence of the strongest
+ * trigger, only frames that would enter the best K are compressed, and
+ * the K survivors are written in capture order when the event ends.
+ */
+class EventRecorder
+{
+public:
+	EventRecorder(const std::string &prefix, size_t ringBytes,
+		      unsigned int maxFrames = 512);
+	~EventRecorder();
+
+	void setTriggerClasses(const std::vector<int> &classes) { classes_ = classes; }
+	void setPreRoll(double seconds);
+	void setPostRoll(double seconds);
+	/* May be changed while frames are being added. */
+	void setQuality(int quality) { quality_ = quality; }
+
+	/* Drop frames within `bits` of the last kept one, negative to keep all. */
+	void setDeduplication(int bits) { dedup_.setThreshold(bits); }
+
+	/* Keep only the best `shots` frames of each event, 0 to keep all. */
+	void setBestShots(unsigned int shots);
+
+	/* Append event frames to a container instead of one file each. */
+	void setWriter(MjpegWriter *writer) { writer_ = writer; }
+
+	/* Thread-safe, frames may arrive from several inference workers. */
+	void addFrame(const Frame &frame, const std::vector<Object> &objects);
+
+	/*
+	 * End the event in progress, writing out its best shots. Call once no
+	 * more frames arrive and before the writer is closed.
+	 */
+	void close();
+
+private:
+	struct Slot {
+		size_t offset;
+		size_t size;
+		std::chrono::steady_clock::time_point timestamp;
+		uint64_t sequence;
+		uint64_t wallclockNs;
+	};
+
+	struct Shot {
+		std::vector<unsigned char> jpeg;
+		double score;
+		uint64_t sequence;
+		uint64_t wallclockNs;
+	};
+
+	const Object *strongestTrigger(const std::vector<Object> &objects) const;
+	void startEvent();
+	void endEvent();
+	void offerShot(const Frame &frame, const Object *trigger);
+	int compress(const cv::Mat &image, unsigned long &size);
+	void store(const Frame &frame, unsigned long size);
+	void evictOldest();
+	void flushRing();
+	void writeFrame(const unsigned char *data, size_t size, uint64_t sequence,
+			uint64_t wallclockNs);
+
+	std::string prefix_;
+	std::vector<int> classes_;
+	std::chrono::steady_clock::duration preRoll_;
+	std::chrono::steady_clock::duration postRoll_;
+	std::atomic<int> quality_;
+	MjpegWriter *writer_;
+	unsigned int source_;
+
+	tjhandle tj_;
+	unsigned char *scratch_;
+	unsigned long scratchSize_;
+
+	std::vector<unsigned char> ring_;
+	size_t head_;
+	std::vector<Slot> slots_;
+	unsigned int first_;
+	unsigned int count_;
+
+	bool recording_;
+	std::chrono::steady_clock::time_point postRollEnd_;
+	std::string eventName_;
+	unsigned int eventFrames_;
+
+	NearDuplicateFilter dedup_;
+	std::vector<Shot> shots_;
+	unsigned int shotCount_;
+
+	std::mutex lock_;
+};
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * event_store.cpp - Append-only memory-mapped log of detections
+ */
+
+#include "event_store.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define EVENT_STORE_VERSION 1
+
+/* Files grow by this many blocks, and index entries, at a time. */
+#define DATA_GROW_BLOCKS 64
+#define INDEX_GROW_BLOCKS 4096
+
+/* Records queued beyond this are dropped rather than buffered. */
+#define MAX_PENDING 65536
+
+#define BLOCK_BYTES (EVENT_BLOCK_RECORDS * sizeof(EventRecord))
+
+static_assert(sizeof(EventRecord) == 32, "EventRecord must stay 32 bytes");
+static_assert(sizeof(EventStoreHeader) == 64, "EventStoreHeader must stay 64 bytes");
+
+static size_t index_bytes(uint64_t blocks)
+{
+	return sizeof(EventStoreHeader) + blocks * sizeof(EventBlock);
+}
+
+static uint16_t normalise(float value)
+{
+	return static_cast<uint16_t>(std::min(std::max(value, 0.f), 1.f) * 65535 + 0.5f);
+}
+
+EventStore::EventStore()
+	: dataFd_(-1), indexFd_(-1), data_(nullptr), dataLength_(0),
+	  index_(nullptr), indexLength_(0), running_(false), stored_(0), dropped_(0)
+{
+}
+
+EventStore::~EventStore()
+{
+	stop();
+
+	if (data_)
+		munmap(data_, dataLength_);
+	if (index_)
+		munmap(index_, indexLength_);
+	if (dataFd_ >= 0)
+		::close(dataFd_);
+	if (indexFd_ >= 0)
+		::close(indexFd_);
+}
+
+/*
+ * Extend the file to at least `needed` bytes and map all of it, moving
+ * the existing mapping if it has to grow.
+ */
+int EventStore::map(int fd, unsigned char *&base, size_t &length, size_t needed)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	size_t size = std::max<size_t>(st.st_size, needed);
+	if (size > static_cast<size_t>(st.st_size) && ftruncate(fd, size) < 0) {
+		std::cerr << "Failed to grow event store: " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	if (base && size == length)
+		return 0;
+
+	void *mapped = base ? mremap(base, length, size, MREMAP_MAYMOVE)
+			    : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		std::cerr << "Failed to map event store: " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	base = static_cast<unsigned char *>(mapped);
+	length = size;
+	return 0;
+}
+
+int EventStore::open(const std::string &path)
+{
+	dataFd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	indexFd_ = ::open((path + ".idx").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (dataFd_ < 0 || indexFd_ < 0) {
+		std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(indexFd_, &st) < 0)
+		return -1;
+	bool created = st.st_size == 0;
+
+	if (map(indexFd_, index_, indexLength_, index_bytes(INDEX_GROW_BLOCKS)))
+		return -1;
+
+	EventStoreHeader *h = header();
+	if (created) {
+		memcpy(h->magic, EVENT_STORE_MAGIC, sizeof(h->magic));
+		h->version = EVENT_STORE_VERSION;
+		h->recordSize = sizeof(EventRecord);
+		h->blockRecords = EVENT_BLOCK_RECORDS;
+		h->blocks = 0;
+	} else if (memcmp(h->magic, EVENT_STORE_MAGIC, sizeof(h->magic)) ||
+		   h->version != EVENT_STORE_VERSION ||
+		   h->recordSize != sizeof(EventRecord) ||
+		   h->blockRecords != EVENT_BLOCK_RECORDS ||
+		   index_bytes(h->blocks) > indexLength_) {
+		std::cerr << path << " is not a compatible event store" << std::endl;
+		return -1;
+	}
+
+	uint64_t blocks = std::max<uint64_t>(h->blocks, 1);
+	if (map(dataFd_, data_, dataLength_,
+		(blocks + DATA_GROW_BLOCKS - 1) / DATA_GROW_BLOCKS * DATA_GROW_BLOCKS * BLOCK_BYTES))
+		return -1;
+
+	std::cout << "Event store " << path << ": " << h->blocks << " blocks" << std::endl;
+	return 0;
+}
+
+void EventStore::start()
+{
+	if (!index_)
+		return;
+
+	pending_.reserve(MAX_PENDING);
+	running_ = true;
+	thread_ = std::thread(&EventStore::run, this);
+}
+
+void EventStore::stop()
+{
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		running_ = false;
+	}
+	cond_.notify_one();
+
+	if (thread_.joinable())
+		thread_.join();
+}
+
+void EventStore::append(uint64_t timestampNs, uint64_t sequence, unsigned int source,
+			const std::vector<EventDetection> &detections)
+{
+	if (detections.empty())
+		return;
+
+	std::unique_lock<std::mutex> locker(lock_);
+	if (!running_)
+		return;
+
+	for (const EventDetection &detection : detections) {
+		if (pending_.size() >= MAX_PENDING) {
+			dropped_.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		EventRecord record = {};
+		record.timestampNs = timestampNs;
+		record.sequence = static_cast<uint32_t>(sequence);
+		record.source = source;
+		record.label = detection.label;
+		record.prob = detection.prob;
+		record.x = normalise(detection.x);
+		record.y = normalise(detection.y);
+		record.width = normalise(detection.width);
+		record.height = normalise(detection.height);
+		pending_.push_back(record);
+	}
+	locker.unlock();
+
+	cond_.notify_one();
+}
+
+/* The block with room for the next record, starting a new one if needed. */
+EventBlock *EventStore::currentBlock()
+{
+	EventStoreHeader *h = header();
+	if (h->blocks && blocks()[h->blocks - 1].count < EVENT_BLOCK_RECORDS)
+		return &blocks()[h->blocks - 1];
+
+	uint64_t needed = h->blocks + 1;
+	if (index_bytes(needed) > indexLength_ &&
+	    map(indexFd_, index_, indexLength_, index_bytes(needed + INDEX_GROW_BLOCKS)))
+		return nullptr;
+	if (needed * BLOCK_BYTES > dataLength_ &&
+	    map(dataFd_, data_, dataLength_, (needed + DATA_GROW_BLOCKS) * BLOCK_BYTES))
+		return nullptr;
+
+	/* Mapping may have moved the header. */
+	h = header();
+	EventBlock *block = &blocks()[h->blocks];
+	memset(block, 0, sizeof(*block));
+	block->firstNs = UINT64_MAX;
+	h->blocks = needed;
+
+	return block;
+}
+
+void EventStore::write(const EventRecord &record)
+{
+	EventBlock *block = currentBlock();
+	if (!block)
+		return;
+
+	uint64_t index = (header()->blocks - 1) * EVENT_BLOCK_RECORDS + block->count;
+	records()[index] = record;
+
+	unsigned int label = std::min<unsigned int>(record.label, EVENT_STORE_CLASSES - 1);
+	block->firstNs = std::min(block->firstNs, record.timestampNs);
+	block->lastNs = std::max(block->lastNs, record.timestampNs);
+	block->classes[label / 64] |= 1ull << (label % 64);
+	block->count++;
+
+	stored_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EventStore::run()
+{
+	std::vector<EventRecord> batch;
+	batch.reserve(MAX_PENDING);
+
+	if (threadInit_)
+		threadInit_();
+
+	std::unique_lock<std::mutex> locker(lock_);
+	while (true) {
+		cond_.wait(locker, [this]() { return !running_ || !pending_.empty(); });
+		if (pending_.empty() && !running_)
+			break;
+
+		batch.swap(pending_);
+		locker.unlock();
+
+		for (const EventRecord &record : batch)
+			write(record);
+		batch.clear();
+
+		locker.lock();
+	}
+}
+
+EventStoreReader::EventStoreReader()
+	: data_(nullptr), dataLength_(0), index_(nullptr), indexLength_(0), blocks_(0)
+{
+}
+
+EventStoreReader::~EventStoreReader()
+{
+	close();
+}
+
+static const unsigned char *map_readonly(const std::string &path, size_t &length)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+		return nullptr;
+	}
+
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map " << path << std::endl;
+		return nullptr;
+	}
+
+	length = st.st_size;
+	return static_cast<const unsigned char *>(map);
+}
+
+int EventStoreReader::open(const std::string &path)
+{
+	close();
+
+	index_ = map_readonly(path + ".idx", indexLength_);
+	data_ = map_readonly(path, dataLength_);
+	if (!index_ || !data_) {
+		close();
+		return -1;
+	}
+
+	const EventStoreHeader *h = reinterpret_cast<const EventStoreHeader *>(index_);
+	if (indexLength_ < sizeof(*h) ||
+	    memcmp(h->magic, EVENT_STORE_MAGIC, sizeof(h->magic)) ||
+	    h->version != EVENT_STORE_VERSION || h->recordSize != sizeof(EventRecord) ||
+	    h->blockRecords != EVENT_BLOCK_RECORDS) {
+		std::cerr << path << " is not a compatible event store" << std::endl;
+		close();
+		return -1;
+	}
+
+	/* Only blocks fully covered by both mappings are visible. */
+	blocks_ = std::min<uint64_t>({ h->blocks,
+				       (indexLength_ - sizeof(*h)) / sizeof(EventBlock),
+				       dataLength_ / BLOCK_BYTES });
+	return 0;
+}
+
+void EventStoreReader::close()
+{
+	if (index_)
+		munmap(const_cast<unsigned char *>(index_), indexLength_);
+	if (data_)
+		munmap(const_cast<unsigned char *>(data_), dataLength_);
+
+	index_ = nullptr;
+	data_ = nullptr;
+	blocks_ = 0;
+}
+
+uint64_t EventStoreReader::query(uint64_t fromNs, uint64_t toNs, const std::vector<int> &classes,
+				 const std::function<void(const EventRecord &)> &fn,
+				 Stats *stats) const
+{
+	uint64_t mask[EVENT_STORE_CLASSES / 64] = {};
+	for (int label : classes) {
+		unsigned int bit = std::min<unsigned int>(label, EVENT_STORE_CLASSES - 1);
+		mask[bit / 64] |= 1ull << (bit % 64);
+	}
+
+	const EventBlock *blocks = reinterpret_cast<const EventBlock *>(index_ + sizeof(EventStoreHeader));
+	const EventRecord *records = reinterpret_cast<const EventRecord *>(data_);
+	uint64_t matched = 0;
+	uint64_t blocksRead = 0;
+
+	for (uint64_t b = 0; b < blocks_; b++) {
+		const EventBlock &block = blocks[b];
+		if (!block.count || block.lastNs < fromNs || block.firstNs >= toNs)
+			continue;
+
+		if (!classes.empty()) {
+			bool any = false;
+			for (unsigned int i = 0; i < EVENT_STORE_CLASSES / 64; i++)
+				any = any || (block.classes[i] & mask[i]);
+			if (!any)
+				continue;
+		}
+
+		blocksRead++;
+		const EventRecord *record = records + b * EVENT_BLOCK_RECORDS;
+		unsigned int count = std::min<uint32_t>(block.count, EVENT_BLOCK_RECORDS);
+		for (unsigned int i = 0; i < count; i++, record++) {
+			if (record->timestampNs < fromNs || record->timestampNs >= toNs)
+				continue;
+			unsigned int bit = std::min<unsigned int>(record->label, EVENT_STORE_CLASSES - 1);
+			if (!classes.empty() && !(mask[bit / 64] & (1ull << (bit % 64))))
+				continue;
+
+			matched++;
+			fn(*record);
+		}
+	}
+
+	if (stats) {
+		stats->blocks = blocks_;
+		stats->blocksRead = blocksRead;
+		stats->records = matched;
+	}
+
+	return matched;
+}
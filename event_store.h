@@ -0,0 +1,171 @@
+/*
+ * event_store.h - Append-only memory-mapped log of detections
+ *
+ * Detections are kept as fixed-size records in blocks of
+ * EVENT_BLOCK_RECORDS. The store is a pair of files:
+ *
+ *   PATH      EventRecord[EVENT_BLOCK_RECORDS] per block
+ *   PATH.idx  EventStoreHeader | EventBlock per block
+ *
+ * The index is the sparse time index: one entry per block with the time
+ * range and a bitmap of the classes it holds, so a query reads the
+ * compact index and then only the blocks that can match. A record is
+ * written before its block entry is updated, so a block never claims
+ * records it does not hold. All fields are little-endian.
+ */
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define EVENT_STORE_MAGIC "RDEVSTO1"
+#define EVENT_BLOCK_RECORDS 1024
+#define EVENT_STORE_CLASSES 128
+
+struct EventRecord
+{
+	uint64_t timestampNs;
+	uint32_t sequence;
+	uint16_t source;
+	uint16_t label;
+	float prob;
+	/* Box relative to the frame, in units of 1/65535. */
+	uint16_t x;
+	uint16_t y;
+	uint16_t width;
+	uint16_t height;
+	uint32_t reserved;
+};
+
+struct EventStoreHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t blockRecords;
+	uint32_t reserved0;
+	uint64_t blocks;
+	uint8_t reserved[32];
+};
+
+struct EventBlock
+{
+	/* Earliest and latest record, records may arrive slightly out of order. */
+	uint64_t firstNs;
+	uint64_t lastNs;
+	uint32_t count;
+	uint32_t reserved;
+	uint64_t classes[EVENT_STORE_CLASSES / 64];
+};
+
+/* One detection to store, its box relative to the frame size. */
+struct EventDetection
+{
+	int label;
+	float prob;
+	float x;
+	float y;
+	float width;
+	float height;
+};
+
+/*
+ * Writer side. append() only queues the records; a background thread
+ * copies them into the mapped files, growing them in large steps, so the
+ * inference workers never wait on the disk. When the thread falls too far
+ * behind, new records are dropped and counted.
+ */
+class EventStore
+{
+public:
+	EventStore();
+	~EventStore();
+
+	/* Open or create the store, resuming after its last record. */
+	int open(const std::string &path);
+
+	/* Run first on the writer thread, for instance to place it. */
+	void setThreadInit(const std::function<void()> &init) { threadInit_ = init; }
+
+	void start();
+	void stop();
+
+	/* Thread-safe, one record per detection. */
+	void append(uint64_t timestampNs, uint64_t sequence, unsigned int source,
+		    const std::vector<EventDetection> &detections);
+
+	uint64_t stored() const { return stored_.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+	int map(int fd, unsigned char *&base, size_t &length, size_t needed);
+	EventStoreHeader *header() { return reinterpret_cast<EventStoreHeader *>(index_); }
+	EventBlock *blocks() { return reinterpret_cast<EventBlock *>(index_ + sizeof(EventStoreHeader)); }
+	EventRecord *records() { return reinterpret_cast<EventRecord *>(data_); }
+	EventBlock *currentBlock();
+	void write(const EventRecord &record);
+	void run();
+
+	int dataFd_;
+	int indexFd_;
+	unsigned char *data_;
+	size_t dataLength_;
+	unsigned char *index_;
+	size_t indexLength_;
+
+	std::vector<EventRecord> pending_;
+	std::mutex lock_;
+	std::condition_variable cond_;
+	std::thread thread_;
+	std::function<void()> threadInit_;
+	bool running_;
+
+	std::atomic<uint64_t> stored_;
+	std::atomic<uint64_t> dropped_;
+};
+
+/*
+ * Read-only view of a store, which may still be written by a running
+ * capture. Blocks added after open() are not seen.
+ */
+class EventStoreReader
+{
+public:
+	struct Stats {
+		uint64_t blocks = 0;
+		uint64_t blocksRead = 0;
+		uint64_t records = 0;
+	};
+
+	EventStoreReader();
+	~EventStoreReader();
+
+	int open(const std::string &path);
+	void close();
+
+	/*
+	 * Call `fn` for every record with fromNs <= timestamp < toNs whose
+	 * class is in `classes`, all classes when empty. Returns the number
+	 * of matching records.
+	 */
+	uint64_t query(uint64_t fromNs, uint64_t toNs, const std::vector<int> &classes,
+		       const std::function<void(const EventRecord &)> &fn,
+		       Stats *stats = nullptr) const;
+
+private:
+	const unsigned char *data_;
+	size_t dataLength_;
+	const unsigned char *index_;
+	size_t indexLength_;
+	uint64_t blocks_;
+};
+
+#endif
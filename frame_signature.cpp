@@ -0,0 +1,107 @@
+/*
+ * frame_signature.cpp - Perceptual frame hashes and sharpness for saving decisions
+ */
+
+#include "frame_signature.h"
+
+#include <algorithm>
+
+#include <opencv4/opencv2/opencv.hpp>
+
+/* Intermediate grid, a multiple of the 9x8 hash grid. */
+#define DHASH_SAMPLE_W 72
+#define DHASH_SAMPLE_H 64
+
+/*
+ * Luma steps smaller than two levels count as flat, so that noise on a
+ * featureless scene such as a night sky does not flip bits at random.
+ */
+#define DHASH_MARGIN (2 * 256)
+
+#define SHARPNESS_WIDTH 256
+
+/*
+ * A bilinear resize to the sample grid only touches two rows and columns
+ * per output pixel, so even a full sensor frame is sampled in a few
+ * thousand reads. The area resize to 9x8 then averages 8x8 samples per
+ * cell. Both run on OpenCV's vectorised paths; the luma of 72 pixels and
+ * the comparisons are left.
+ */
+uint64_t frame_dhash(const cv::Mat &bgr)
+{
+	cv::Mat sample, grid;
+	cv::resize(bgr, sample, cv::Size(DHASH_SAMPLE_W, DHASH_SAMPLE_H), 0, 0,
+		   cv::INTER_LINEAR);
+	cv::resize(sample, grid, cv::Size(9, 8), 0, 0, cv::INTER_AREA);
+
+	uint64_t hash = 0;
+	for (int y = 0; y < 8; y++) {
+		const unsigned char *row = grid.ptr<unsigned char>(y);
+		int luma[9];
+		for (int x = 0; x < 9; x++) {
+			const unsigned char *p = row + 3 * x;
+			luma[x] = 29 * p[0] + 150 * p[1] + 77 * p[2];
+		}
+		for (int x = 0; x < 8; x++)
+			hash = (hash << 1) | (luma[x + 1] > luma[x] + DHASH_MARGIN);
+	}
+
+	return hash;
+}
+
+double frame_sharpness(const cv::Mat &bgr, const cv::Rect &roi)
+{
+	cv::Rect area = roi & cv::Rect(0, 0, bgr.cols, bgr.rows);
+	if (area.width < 3 || area.height < 3)
+		return 0;
+
+	cv::Mat view = bgr(area);
+	cv::Mat small = view;
+	if (area.width > SHARPNESS_WIDTH) {
+		int height = std::max(3, area.height * SHARPNESS_WIDTH / area.width);
+		cv::resize(view, small, cv::Size(SHARPNESS_WIDTH, height), 0, 0,
+			   cv::INTER_AREA);
+	}
+
+	cv::Mat gray, laplacian;
+	cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY);
+	cv::Laplacian(gray, laplacian, CV_16S);
+
+	cv::Scalar mean, stddev;
+	cv::meanStdDev(laplacian, mean, stddev);
+	return stddev[0] * stddev[0];
+}
+
+NearDuplicateFilter::NearDuplicateFilter(int threshold)
+	: threshold_(threshold), valid_(false), reference_(0)
+{
+}
+
+void NearDuplicateFilter::setThreshold(int threshold)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	threshold_ = threshold;
+	valid_ = false;
+}
+
+bool NearDuplicateFilter::duplicate(const cv::Mat &bgr)
+{
+	if (!enabled())
+		return false;
+
+	uint64_t hash = frame_dhash(bgr);
+
+	std::unique_lock<std::mutex> locker(lock_);
+	if (valid_ && dhash_distance(hash, reference_) <= threshold_.load())
+		return true;
+
+	reference_ = hash;
+	valid_ = true;
+	return false;
+}
+
+void NearDuplicateFilter::reset()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	valid_ = false;
+}
@@ -0,0 +1,59 @@
+/*
+ * frame_signature.h - Perceptual frame hashes and sharpness for saving decisions
+ */
+#ifndef FRAME_SIGNATURE_H
+#define FRAME_SIGNATURE_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include <opencv4/opencv2/core.hpp>
+
+/*
+ * 64-bit difference hash of a BGR image: the luma of a 9x8 downscale, one
+ * bit per horizontally adjacent pair telling whether brightness increases.
+ * Sensor noise and small exposure changes flip few bits, a person moving
+ * or entering the view flips many.
+ */
+uint64_t frame_dhash(const cv::Mat &bgr);
+
+static inline int dhash_distance(uint64_t a, uint64_t b)
+{
+	return __builtin_popcountll(a ^ b);
+}
+
+/*
+ * Variance of the Laplacian of the luma of `roi`, downscaled to at most
+ * 256 pixels across so that the measure does not depend on the box size.
+ * Higher is sharper; motion blur and defocus lower it.
+ */
+double frame_sharpness(const cv::Mat &bgr, const cv::Rect &roi);
+
+/*
+ * Compares each frame with the last one it let through. Frames within
+ * `threshold` bits of that reference are near-duplicates; anything else
+ * becomes the new reference, so a slow drift is still saved once it has
+ * added up. Thread-safe. A negative threshold disables the filter.
+ */
+class NearDuplicateFilter
+{
+public:
+	explicit NearDuplicateFilter(int threshold = -1);
+
+	void setThreshold(int threshold);
+	bool enabled() const { return threshold_ >= 0; }
+
+	bool duplicate(const cv::Mat &bgr);
+
+	/* Forget the reference, the next frame always passes. */
+	void reset();
+
+private:
+	std::atomic<int> threshold_;
+	bool valid_;
+	uint64_t reference_;
+	std::mutex lock_;
+};
+
+#endif
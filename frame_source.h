@@ -0,0 +1,80 @@
+/*
+ * frame_source.h - Capture abstraction shared by cameras and file replay
+ */
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <opencv4/opencv2/core.hpp>
+
+/*
+ * A captured frame. The image is a view onto memory owned by the source and
+ * stays valid until release() is called, after which the source may reuse
+ * the buffer for a later capture.
+ */
+struct Frame
+{
+	unsigned int source = 0;
+	uint64_t sequence = 0;
+	std::chrono::steady_clock::time_point timestamp;
+	cv::Mat image;
+	std::function<void()> release;
+
+	/*
+	 * File backing the image, for zero-copy sharing, -1 if there is none.
+	 * hold() keeps the buffer from the source past release() and returns
+	 * the function dropping that hold: the source reuses the buffer once
+	 * release() and every hold are done. Only called before release().
+	 */
+	int fd = -1;
+	size_t fdOffset = 0;
+	size_t fdLength = 0;
+	std::function<std::function<void()>()> hold;
+};
+
+class FrameSource
+{
+public:
+	virtual ~FrameSource() {}
+
+	virtual std::string name() const = 0;
+
+	/* Size of the delivered images, empty until configured or loaded. */
+	virtual cv::Size frameSize() const { return cv::Size(); }
+
+	virtual int start() = 0;
+	virtual void stop() = 0;
+
+	/*
+	 * Capture one frame per `duration`, or at the configured rate again
+	 * when it is zero. Takes effect within a few frames, may be called
+	 * from any thread. Returns -1 if the source has a fixed rate.
+	 */
+	virtual int setFrameDuration(std::chrono::microseconds duration)
+	{
+		(void)duration;
+		return -1;
+	}
+
+	/*
+	 * Invoked for every completed capture. The handler takes ownership of
+	 * the frame and must eventually call its release function.
+	 */
+	void setFrameHandler(const std::function<void(Frame &&)> &handler)
+	{
+		frameReady_ = handler;
+	}
+
+	unsigned int id() const { return id_; }
+	void setId(unsigned int id) { id_ = id; }
+
+protected:
+	std::function<void(Frame &&)> frameReady_;
+	unsigned int id_ = 0;
+};
+
+#endif
@@ -0,0 +1,357 @@
+/*
+ * golden.cpp - Golden output and latency regression check for the detector
+ *
+ * Usage:
+ *   golden record DIR
+ *   golden check DIR [SLACK]
+ *
+ * Run from the repository root. Fixed inputs go through the C++ pipeline:
+ * a seeded 640x640 tensor straight into the network, and every bundled
+ * photo through preprocessing, the network and decoding. "record" stores,
+ * per input, the raw out0 tensor, the final detections and the median
+ * latency in DIR. "check" compares against them and exits non-zero when
+ * out0 or the detections drift past the tolerances below, or when a
+ * median latency exceeds its budget by more than SLACK (default 0.15).
+ *
+ * The seeded tensor is generated as torch.rand() does after
+ * torch.manual_seed(0), so seeded.out0 may also be written by the Python
+ * reference: python3 model_ncnn.py DIR/seeded.out0, from code/. It is the
+ * only output with an independent reference; the photo outputs are what
+ * this pipeline produced when recorded, so they catch drift, not errors.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <opencv4/opencv2/opencv.hpp>
+
+#include "ncnn_inference.h"
+
+static const char *model_param = "code/yolo11n_ncnn_model/model.ncnn.param";
+static const char *model_bin = "code/yolo11n_ncnn_model/model.ncnn.bin";
+
+static const char *photos[] = {
+	"code/bus.jpg",
+	"20250219_164023.jpg",
+	"output.jpg",
+};
+
+/* out0 elements may differ by OUT0_ATOL plus OUT0_RTOL of the golden value. */
+#define OUT0_ATOL 0.02f
+#define OUT0_RTOL 0.01f
+
+/* A detection matches a golden one of the same class within these. */
+#define DETECTION_MIN_IOU 0.9f
+#define DETECTION_MAX_PROB_DELTA 0.05f
+
+#define LATENCY_RUNS 10
+#define DEFAULT_SLACK 0.15
+
+/*
+ * Stored in DIR/format. Bumped whenever preprocessing changes what the
+ * photos feed the network, so stale references are re-recorded rather
+ * than compared: 2 is the square letterbox of the fixed-shape model.
+ */
+#define GOLDEN_FORMAT 2
+
+struct GoldenResult
+{
+	std::vector<float> out0;
+	std::vector<Object> objects;
+	double medianMs = 0;
+};
+
+static void seeded_tensor(ncnn::Mat &in)
+{
+	/* torch's CPU generator is an MT19937, floats take the low 24 bits. */
+	std::mt19937 generator(0);
+
+	in.create(640, 640, 3);
+	for (int q = 0; q < in.c; q++) {
+		float *p = in.channel(q);
+		for (int i = 0; i < in.w * in.h; i++)
+			p[i] = (generator() & 0xffffff) * (1.f / (1 << 24));
+	}
+}
+
+static std::vector<float> flatten(const ncnn::Mat &out)
+{
+	std::vector<float> values;
+	values.reserve(out.w * out.h * out.c);
+	for (int q = 0; q < out.c; q++) {
+		const ncnn::Mat channel = out.channel(q);
+		for (int y = 0; y < out.h; y++) {
+			const float *row = channel.row(y);
+			values.insert(values.end(), row, row + out.w);
+		}
+	}
+	return values;
+}
+
+static double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+/*
+ * Run one input: the raw tensor is compared before any decoding, the
+ * detections after, and the latency covers what the capture path pays,
+ * which for photos includes preprocessing.
+ */
+static int run_input(Detector &detector, const std::string &name, GoldenResult &result)
+{
+	std::vector<double> latencies;
+
+	if (name == "seeded") {
+		ncnn::Mat in, out;
+		seeded_tensor(in);
+		for (int i = 0; i < LATENCY_RUNS; i++) {
+			auto start = std::chrono::steady_clock::now();
+			if (detector.forward(in, out))
+				return -1;
+			latencies.push_back(std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start).count());
+		}
+		result.out0 = flatten(out);
+	} else {
+		cv::Mat image = cv::imread(name, cv::IMREAD_COLOR);
+		if (image.empty()) {
+			std::cerr << "Failed to read " << name << std::endl;
+			return -1;
+		}
+
+		DetectorInput input;
+		ncnn::Mat out;
+		detector.preprocess(image, detector.target_size, input);
+		if (detector.forward(input.in, out))
+			return -1;
+		result.out0 = flatten(out);
+
+		for (int i = 0; i < LATENCY_RUNS; i++) {
+			auto start = std::chrono::steady_clock::now();
+			result.objects = detector.detect(image);
+			latencies.push_back(std::chrono::duration<double, std::milli>(
+				std::chrono::steady_clock::now() - start).count());
+		}
+	}
+
+	result.medianMs = median(latencies);
+	return 0;
+}
+
+static std::string base_name(const std::string &input)
+{
+	size_t slash = input.rfind('/');
+	return slash == std::string::npos ? input : input.substr(slash + 1);
+}
+
+static int write_result(const std::string &dir, const std::string &name,
+			const GoldenResult &result)
+{
+	std::string base = dir + "/" + base_name(name);
+
+	std::ofstream out0(base + ".out0", std::ios::binary);
+	out0.write(reinterpret_cast<const char *>(result.out0.data()),
+		   result.out0.size() * sizeof(float));
+
+	std::ofstream det(base + ".det");
+	for (const Object &obj : result.objects)
+		det << obj.label << " " << obj.prob << " " << obj.rect.x << " "
+		    << obj.rect.y << " " << obj.rect.width << " " << obj.rect.height << "\n";
+
+	if (!out0 || !det) {
+		std::cerr << "Failed to write " << base << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+static int read_result(const std::string &dir, const std::string &name,
+		       GoldenResult &result)
+{
+	std::string base = dir + "/" + base_name(name);
+
+	std::ifstream out0(base + ".out0", std::ios::binary | std::ios::ate);
+	if (!out0) {
+		std::cerr << "Missing " << base << ".out0" << std::endl;
+		return -1;
+	}
+	result.out0.resize(out0.tellg() / sizeof(float));
+	out0.seekg(0);
+	out0.read(reinterpret_cast<char *>(result.out0.data()),
+		  result.out0.size() * sizeof(float));
+
+	/* The seeded tensor is compared on out0 only. */
+	std::ifstream det(base + ".det");
+	Object obj;
+	while (det >> obj.label >> obj.prob >> obj.rect.x >> obj.rect.y
+		   >> obj.rect.width >> obj.rect.height)
+		result.objects.push_back(obj);
+
+	return 0;
+}
+
+static float iou(const cv::Rect_<float> &a, const cv::Rect_<float> &b)
+{
+	float inter = (a & b).area();
+	float uni = a.area() + b.area() - inter;
+	return uni > 0 ? inter / uni : 0;
+}
+
+static bool compare_out0(const std::vector<float> &golden, const std::vector<float> &actual)
+{
+	if (golden.size() != actual.size()) {
+		printf("  out0 has %zu values, golden %zu\n", actual.size(), golden.size());
+		return false;
+	}
+
+	size_t failures = 0;
+	float maxError = 0;
+	for (size_t i = 0; i < golden.size(); i++) {
+		float error = std::fabs(actual[i] - golden[i]);
+		maxError = std::max(maxError, error);
+		if (error > OUT0_ATOL + OUT0_RTOL * std::fabs(golden[i]))
+			failures++;
+	}
+
+	printf("  out0 max error %.5f, %zu of %zu values out of tolerance\n",
+	       maxError, failures, golden.size());
+	return failures == 0;
+}
+
+static bool compare_objects(const std::vector<Object> &golden, const std::vector<Object> &actual)
+{
+	std::vector<bool> used(actual.size(), false);
+	unsigned int matched = 0;
+
+	for (const Object &g : golden) {
+		for (unsigned int i = 0; i < actual.size(); i++) {
+			const Object &a = actual[i];
+			if (used[i] || a.label != g.label ||
+			    std::fabs(a.prob - g.prob) > DETECTION_MAX_PROB_DELTA ||
+			    iou(a.rect, g.rect) < DETECTION_MIN_IOU)
+				continue;
+
+			used[i] = true;
+			matched++;
+			break;
+		}
+	}
+
+	printf("  detections: %u of %zu golden matched, %zu found\n", matched,
+	       golden.size(), actual.size());
+	return matched == golden.size() && actual.size() == golden.size();
+}
+
+static std::map<std::string, double> read_budgets(const std::string &dir)
+{
+	std::map<std::string, double> budgets;
+	std::ifstream in(dir + "/budgets.txt");
+	std::string name;
+	double ms;
+	while (in >> name >> ms)
+		budgets[name] = ms;
+	return budgets;
+}
+
+static void usage()
+{
+	std::cerr << "Usage: golden record DIR" << std::endl
+		  << "       golden check DIR [SLACK]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	std::string command = argv[1];
+	std::string dir = argv[2];
+	double slack = argc > 3 ? atof(argv[3]) : DEFAULT_SLACK;
+	if (command != "record" && command != "check") {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	Detector detector;
+	if (detector.load(model_param, model_bin))
+		return EXIT_FAILURE;
+
+	std::vector<std::string> inputs = { "seeded" };
+	inputs.insert(inputs.end(), std::begin(photos), std::end(photos));
+
+	/* The first inference grows the allocator pools, keep it out of budgets. */
+	GoldenResult warmup;
+	if (run_input(detector, inputs[0], warmup))
+		return EXIT_FAILURE;
+
+	if (command == "record") {
+		std::ofstream format(dir + "/format");
+		format << GOLDEN_FORMAT << "\n";
+		if (!format) {
+			std::cerr << "Failed to write " << dir << "/format" << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		std::ofstream budgets(dir + "/budgets.txt");
+		for (const std::string &input : inputs) {
+			GoldenResult result;
+			if (run_input(detector, input, result) ||
+			    write_result(dir, input, result))
+				return EXIT_FAILURE;
+
+			budgets << base_name(input) << " " << result.medianMs << "\n";
+			printf("%-22s %zu out0 values, %zu detections, %.1f ms\n",
+			       base_name(input).c_str(), result.out0.size(),
+			       result.objects.size(), result.medianMs);
+		}
+		return budgets ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	int format = 0;
+	std::ifstream(dir + "/format") >> format;
+	if (format != GOLDEN_FORMAT) {
+		std::cerr << dir << " was recorded with an older preprocessing, "
+			  << "run golden record again" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::map<std::string, double> budgets = read_budgets(dir);
+	bool passed = true;
+
+	for (const std::string &input : inputs) {
+		GoldenResult golden, actual;
+		if (read_result(dir, input, golden) || run_input(detector, input, actual))
+			return EXIT_FAILURE;
+
+		printf("%s\n", base_name(input).c_str());
+		bool ok = compare_out0(golden.out0, actual.out0);
+		if (input != "seeded")
+			ok = compare_objects(golden.objects, actual.objects) && ok;
+
+		auto budget = budgets.find(base_name(input));
+		if (budget != budgets.end()) {
+			double limit = budget->second * (1 + slack);
+			printf("  latency %.1f ms, budget %.1f ms + %.0f%%\n", actual.medianMs,
+			       budget->second, slack * 100);
+			ok = actual.medianMs <= limit && ok;
+		}
+
+		printf("  %s\n", ok ? "PASS" : "FAIL");
+		passed = passed && ok;
+	}
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
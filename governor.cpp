@@ -0,0 +1,213 @@
+/*
+ * governor.cpp - Thermal- and latency-aware inference governor
+ */
+
+#include "governor.h"
+
+#include <cstdio>
+#include <iostream>
+
+#include <event2/event.h>
+
+/* Periods to wait after a change, and calm periods needed to step up. */
+#define GOVERNOR_HOLD_PERIODS 3
+#define GOVERNOR_CALM_PERIODS 5
+
+/* Stepping up is only allowed with this much latency headroom. */
+#define GOVERNOR_HEADROOM 0.6
+
+/* Temperatures must fall this far below the hot limit to step up. */
+#define GOVERNOR_HYSTERESIS 5.0
+
+/* Percentile of the window latency compared against the target. */
+#define GOVERNOR_PERCENTILE 0.9
+
+static std::vector<double> latency_bounds()
+{
+	std::vector<double> bounds;
+	for (double ms = 5; ms <= 5000; ms *= 1.25)
+		bounds.push_back(ms / 1000);
+	return bounds;
+}
+
+Governor::Governor(EventLoop &loop, std::chrono::milliseconds latencyTarget)
+	: loop_(loop), current_(0),
+	  thermalPath_("/sys/class/thermal/thermal_zone0/temp"),
+	  hot_(75.0), critical_(80.0),
+	  target_(std::chrono::duration<double>(latencyTarget).count()),
+	  period_(1000), timer_(nullptr), hold_(0), calm_(0),
+	  latency_(latency_bounds()),
+	  levelGauge_(metrics().gauge("radaria_governor_level",
+				      "Current governor level, 0 is full quality")),
+	  temperatureGauge_(metrics().gauge("radaria_governor_temperature_celsius",
+					    "SoC temperature seen by the governor"))
+{
+	/*
+	 * The Pi 4 starts soft throttling at 80 C. Lowering the frame rate
+	 * cuts load the most while keeping full accuracy on the frames that
+	 * are inferred, so the interval grows first; ncnn threads and encoder
+	 * quality follow.
+	 */
+	levels_ = {
+		{ 0, std::chrono::milliseconds(0), 0, 90 },
+		{ 1, std::chrono::milliseconds(50), 0, 85 },
+		{ 2, std::chrono::milliseconds(100), 3, 80 },
+		{ 3, std::chrono::milliseconds(200), 2, 75 },
+		{ 4, std::chrono::milliseconds(500), 2, 70 },
+		{ 5, std::chrono::milliseconds(1000), 1, 60 },
+	};
+
+	lastBuckets_.resize(latency_.bounds().size() + 1);
+}
+
+Governor::~Governor()
+{
+	stop();
+}
+
+void Governor::setTemperatureLimits(double hot, double critical)
+{
+	hot_ = hot;
+	critical_ = critical;
+}
+
+int Governor::start()
+{
+	timer_ = event_new(loop_.base(), -1, EV_PERSIST, &Governor::timerCallback, this);
+	if (!timer_)
+		return -1;
+
+	struct timeval tv;
+	tv.tv_sec = period_.count() / 1000;
+	tv.tv_usec = (period_.count() % 1000) * 1000;
+	event_add(timer_, &tv);
+
+	apply(0, "start", readTemperature(), 0);
+	return 0;
+}
+
+void Governor::stop()
+{
+	if (!timer_)
+		return;
+
+	event_free(timer_);
+	timer_ = nullptr;
+}
+
+void Governor::timerCallback([[maybe_unused]] int fd,
+			     [[maybe_unused]] short events, void *arg)
+{
+	static_cast<Governor *>(arg)->update();
+}
+
+void Governor::observe(std::chrono::steady_clock::duration latency)
+{
+	latency_.observe(std::chrono::duration<double>(latency).count());
+}
+
+double Governor::readTemperature() const
+{
+	FILE *file = fopen(thermalPath_.c_str(), "r");
+	if (!file)
+		return -1;
+
+	long millidegrees;
+	int ret = fscanf(file, "%ld", &millidegrees);
+	fclose(file);
+
+	return ret == 1 ? millidegrees / 1000.0 : -1;
+}
+
+/*
+ * Percentile of the latencies observed since the previous call, from the
+ * difference of the cumulative bucket counts. Returns -1 without samples.
+ */
+double Governor::windowLatency()
+{
+	const std::vector<double> &bounds = latency_.bounds();
+	std::vector<uint64_t> window(lastBuckets_.size());
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < lastBuckets_.size(); i++) {
+		uint64_t count = latency_.bucket(i);
+		window[i] = count - lastBuckets_[i];
+		lastBuckets_[i] = count;
+		total += window[i];
+	}
+
+	if (!total)
+		return -1;
+
+	uint64_t rank = static_cast<uint64_t>(total * GOVERNOR_PERCENTILE);
+	uint64_t seen = 0;
+	for (size_t i = 0; i < bounds.size(); i++) {
+		seen += window[i];
+		if (seen > rank)
+			return bounds[i];
+	}
+
+	return bounds.back() * 2;
+}
+
+void Governor::update()
+{
+	const unsigned int last = levels_.size() - 1;
+	double temperature = readTemperature();
+	double latency = windowLatency();
+
+	temperatureGauge_.set(temperature);
+
+	if (temperature >= critical_) {
+		calm_ = 0;
+		if (current_ != last)
+			apply(last, "critical temperature", temperature, latency);
+		return;
+	}
+
+	if (hold_) {
+		hold_--;
+		return;
+	}
+
+	bool hot = temperature >= hot_;
+	bool slow = target_ > 0 && latency > target_;
+
+	if (hot || slow) {
+		calm_ = 0;
+		if (current_ < last)
+			apply(current_ + 1, hot ? "hot" : "over latency target",
+			      temperature, latency);
+		return;
+	}
+
+	bool cool = temperature < hot_ - GOVERNOR_HYSTERESIS;
+	bool fast = target_ <= 0 || latency < target_ * GOVERNOR_HEADROOM;
+
+	if (!cool || !fast || current_ == 0) {
+		calm_ = 0;
+		return;
+	}
+
+	if (++calm_ >= GOVERNOR_CALM_PERIODS) {
+		calm_ = 0;
+		apply(current_ - 1, "recovered", temperature, latency);
+	}
+}
+
+void Governor::apply(unsigned int index, const char *reason, double temperature,
+		     double latency)
+{
+	current_ = index;
+	hold_ = GOVERNOR_HOLD_PERIODS;
+	levelGauge_.set(index);
+
+	const GovernorLevel &level = levels_[index];
+	std::cout << "Governor level " << index << " (" << reason << ", "
+		  << temperature << " C, " << latency * 1000 << " ms): interval "
+		  << level.frameInterval.count() << " ms, threads " << level.threads << ", quality " << level.quality
+		  << std::endl;
+
+	if (handler_)
+		handler_(level);
+}
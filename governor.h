@@ -0,0 +1,101 @@
+/*
+ * governor.h - Thermal- and latency-aware inference governor
+ */
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "metrics.h"
+
+struct event;
+
+/*
+ * One operating point of the pipeline, from the full-quality level 0 to
+ * the cheapest. A frame interval of zero infers every frame, a thread
+ * count of zero keeps the ncnn default. The input size is left alone:
+ * the model only runs at the shape it was exported with.
+ */
+struct GovernorLevel
+{
+	unsigned int index;
+	std::chrono::milliseconds frameInterval;
+	int threads;
+	int quality;
+};
+
+/*
+ * Holds a latency target without running the SoC into thermal throttling.
+ * Once per period the governor reads the SoC temperature and the latency
+ * measured since the last period, then moves one level down the ladder
+ * when either is over budget, or one level up after several calm periods.
+ * A change is held for a few periods so its effect shows up in the
+ * measurements before the next decision. At the critical temperature it
+ * goes straight to the cheapest level.
+ *
+ * The control loop runs on the EventLoop thread. observe() is lock-free and
+ * may be called from any inference worker.
+ */
+class Governor
+{
+public:
+	typedef std::function<void(const GovernorLevel &)> LevelHandler;
+
+	Governor(EventLoop &loop, std::chrono::milliseconds latencyTarget);
+	~Governor();
+
+	/* Temperature file in millidegrees Celsius, as found in sysfs. */
+	void setThermalPath(const std::string &path) { thermalPath_ = path; }
+	void setTemperatureLimits(double hot, double critical);
+	void setPeriod(std::chrono::milliseconds period) { period_ = period; }
+	void setLevelHandler(const LevelHandler &handler) { handler_ = handler; }
+
+	/* Apply level 0 and start the control loop. */
+	int start();
+	void stop();
+
+	/* Record the capture-to-output latency of one frame. */
+	void observe(std::chrono::steady_clock::duration latency);
+
+	const GovernorLevel &level() const { return levels_[current_]; }
+	const std::vector<GovernorLevel> &levels() const { return levels_; }
+
+	/* One control step, exposed so a simulated clock can drive it. */
+	void update();
+
+private:
+	static void timerCallback(int fd, short events, void *arg);
+
+	double readTemperature() const;
+	double windowLatency();
+	void apply(unsigned int index, const char *reason, double temperature,
+		   double latency);
+
+	EventLoop &loop_;
+	std::vector<GovernorLevel> levels_;
+	unsigned int current_;
+	LevelHandler handler_;
+
+	std::string thermalPath_;
+	double hot_;
+	double critical_;
+	double target_;
+	std::chrono::milliseconds period_;
+	struct event *timer_;
+
+	unsigned int hold_;
+	unsigned int calm_;
+
+	Histogram latency_;
+	std::vector<uint64_t> lastBuckets_;
+
+	Gauge &levelGauge_;
+	Gauge &temperatureGauge_;
+};
+
+#endif
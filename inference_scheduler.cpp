@@ -0,0 +1,276 @@
+/*
+ * inference_scheduler.cpp - Shared inference pool fed by several frame sources
+ */
+
+#include "inference_scheduler.h"
+
+#include <iomanip>
+
+#include "thread_placement.h"
+
+InferenceScheduler::InferenceScheduler(Detector &detector, unsigned int workers)
+	: detector_(detector), numWorkers_(workers ? workers : 1), cascade_(nullptr),
+	  interval_(std::chrono::steady_clock::duration::zero()), running_(false)
+{
+}
+
+InferenceScheduler::~InferenceScheduler()
+{
+	stop();
+}
+
+unsigned int InferenceScheduler::addSource(const std::string &name,
+					   unsigned int weight,
+					   unsigned int depth)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	SourceQueue queue;
+	queue.name = name;
+	queue.weight = weight ? weight : 1;
+	queue.depth = depth ? depth : 1;
+	queue.current = 0;
+	queue.captured = 0;
+	queue.skipped = 0;
+	queue.dropped = 0;
+	queue.inferred = 0;
+	queue.latencySum = 0;
+	queue.latencyMax = 0;
+
+	MetricsRegistry &registry = metrics();
+	std::string labels = "source=\"" + std::to_string(sources_.size()) + "\"";
+	queue.capturedTotal = &registry.counter("radaria_frames_captured_total",
+		"Frames delivered by the source", labels);
+	queue.skippedTotal = &registry.counter("radaria_frames_skipped_total",
+		"Frames released unprocessed by the frame interval", labels);
+	queue.droppedTotal = &registry.counter("radaria_frames_dropped_total",
+		"Frames evicted from a full source queue", labels);
+	queue.inferredTotal = &registry.counter("radaria_frames_inferred_total",
+		"Frames run through the detector", labels);
+	queue.excludedTotal = &registry.counter("radaria_detections_excluded_total",
+		"Detections dropped by regions of interest and exclusion zones", labels);
+	queue.queueDepth = &registry.gauge("radaria_queue_depth",
+		"Frames waiting for a worker", labels);
+	queue.queueSeconds = &registry.histogram("radaria_stage_seconds",
+		"Time spent per pipeline stage", labels + ",stage=\"queue\"");
+	queue.detectSeconds = &registry.histogram("radaria_stage_seconds",
+		"Time spent per pipeline stage", labels + ",stage=\"detect\"");
+	queue.classifySeconds = &registry.histogram("radaria_stage_seconds",
+		"Time spent per pipeline stage", labels + ",stage=\"classify\"");
+	queue.outputSeconds = &registry.histogram("radaria_stage_seconds",
+		"Time spent per pipeline stage", labels + ",stage=\"output\"");
+	queue.totalSeconds = &registry.histogram("radaria_stage_seconds",
+		"Time spent per pipeline stage", labels + ",stage=\"total\"");
+
+	sources_.push_back(std::move(queue));
+	return sources_.size() - 1;
+}
+
+void InferenceScheduler::setFrameInterval(std::chrono::steady_clock::duration interval)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	interval_ = interval;
+}
+
+void InferenceScheduler::setRegions(unsigned int source,
+				    std::shared_ptr<const RegionFilter> regions)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	if (source < sources_.size())
+		sources_[source].regions = regions && !regions->empty() ? regions : nullptr;
+}
+
+void InferenceScheduler::start()
+{
+	running_ = true;
+
+	/* Restarts after a reconfiguration keep counting from the first start. */
+	if (startTime_ == std::chrono::steady_clock::time_point())
+		startTime_ = std::chrono::steady_clock::now();
+
+	for (unsigned int i = 0; i < numWorkers_; i++)
+		workers_.emplace_back(&InferenceScheduler::run, this);
+}
+
+void InferenceScheduler::stop()
+{
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		if (!running_)
+			return;
+		running_ = false;
+	}
+
+	cond_.notify_all();
+	for (std::thread &worker : workers_)
+		worker.join();
+	workers_.clear();
+
+	/* Give back every frame that never made it to a worker. */
+	for (SourceQueue &queue : sources_) {
+		for (Frame &frame : queue.frames)
+			frame.release();
+		queue.frames.clear();
+	}
+}
+
+void InferenceScheduler::submit(Frame &&frame)
+{
+	Frame evicted;
+
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		if (!running_ || frame.source >= sources_.size()) {
+			locker.unlock();
+			frame.release();
+			return;
+		}
+
+		SourceQueue &queue = sources_[frame.source];
+		queue.captured++;
+		queue.capturedTotal->inc();
+
+		if (frame.timestamp - queue.lastAccepted < interval_) {
+			queue.skipped++;
+			queue.skippedTotal->inc();
+			locker.unlock();
+			frame.release();
+			return;
+		}
+		queue.lastAccepted = frame.timestamp;
+
+		if (queue.frames.size() >= queue.depth) {
+			evicted = std::move(queue.frames.front());
+			queue.frames.pop_front();
+			queue.dropped++;
+			queue.droppedTotal->inc();
+		}
+
+		queue.frames.push_back(std::move(frame));
+		queue.queueDepth->set(queue.frames.size());
+	}
+
+	cond_.notify_one();
+
+	if (evicted.release)
+		evicted.release();
+}
+
+/*
+ * Smooth weighted round-robin over the sources that have frames waiting:
+ * every candidate gains its weight, the richest one is served and pays back
+ * the total weight of the candidates. Must be called with lock_ held.
+ */
+bool InferenceScheduler::pickFrame(Frame &frame,
+				   std::shared_ptr<const RegionFilter> &regions)
+{
+	SourceQueue *best = nullptr;
+	int total = 0;
+
+	for (SourceQueue &queue : sources_) {
+		if (queue.frames.empty())
+			continue;
+
+		queue.current += queue.weight;
+		total += queue.weight;
+		if (!best || queue.current > best->current)
+			best = &queue;
+	}
+
+	if (!best)
+		return false;
+
+	best->current -= total;
+	frame = std::move(best->frames.front());
+	best->frames.pop_front();
+	best->queueDepth->set(best->frames.size());
+	regions = best->regions;
+	return true;
+}
+
+void InferenceScheduler::run()
+{
+	place_current_thread(ThreadRole::Inference);
+	Detector::bind_thread(thread_placement().inference);
+
+	while (true) {
+		Frame frame;
+		std::shared_ptr<const RegionFilter> regions;
+
+		{
+			std::unique_lock<std::mutex> locker(lock_);
+			cond_.wait(locker, [this, &frame, &regions]() {
+				return !running_ || pickFrame(frame, regions);
+			});
+
+			if (!frame.release)
+				return;
+		}
+
+		using Seconds = std::chrono::duration<double>;
+		std::chrono::steady_clock::time_point picked = std::chrono::steady_clock::now();
+
+		std::vector<Object> objects;
+		unsigned int excluded = 0;
+		if (regions) {
+			cv::Rect crop = regions->crop(frame.image.size());
+			objects = detector_.detect(frame.image(crop));
+			excluded = regions->apply(frame.image.size(), crop, objects);
+		} else {
+			objects = detector_.detect(frame.image);
+		}
+		std::chrono::steady_clock::time_point detected = std::chrono::steady_clock::now();
+
+		if (cascade_)
+			cascade_->process(frame, objects);
+		std::chrono::steady_clock::time_point classified = std::chrono::steady_clock::now();
+
+		if (handler_)
+			handler_(frame, objects);
+
+		std::chrono::steady_clock::time_point done = std::chrono::steady_clock::now();
+		std::chrono::duration<double, std::milli> latency = done - frame.timestamp;
+
+		{
+			std::unique_lock<std::mutex> locker(lock_);
+			SourceQueue &queue = sources_[frame.source];
+			queue.inferredTotal->inc();
+			queue.excludedTotal->inc(excluded);
+			queue.queueSeconds->observe(Seconds(picked - frame.timestamp).count());
+			queue.detectSeconds->observe(Seconds(detected - picked).count());
+			if (cascade_)
+				queue.classifySeconds->observe(Seconds(classified - detected).count());
+			queue.outputSeconds->observe(Seconds(done - classified).count());
+			queue.totalSeconds->observe(Seconds(done - frame.timestamp).count());
+			queue.inferred++;
+			queue.latencySum += latency.count();
+			queue.latencyMax = std::max(queue.latencyMax, latency.count());
+		}
+
+		frame.release();
+	}
+}
+
+void InferenceScheduler::printStats(std::ostream &out) const
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - startTime_;
+	double seconds = std::max(elapsed.count(), 1e-3);
+
+	for (unsigned int i = 0; i < sources_.size(); i++) {
+		const SourceQueue &queue = sources_[i];
+		double mean = queue.inferred ? queue.latencySum / queue.inferred : 0;
+
+		out << "[" << i << "] " << queue.name << std::endl
+		    << std::fixed << std::setprecision(2)
+		    << "\tcaptured " << queue.captured
+		    << " skipped " << queue.skipped
+		    << " dropped " << queue.dropped
+		    << " inferred " << queue.inferred
+		    << " (" << queue.inferred / seconds << " fps)" << std::endl
+		    << "\tlatency mean " << mean << " ms max "
+		    << queue.latencyMax << " ms" << std::endl;
+	}
+}
@@ -0,0 +1,120 @@
+/*
+ * inference_scheduler.h - Shared inference pool fed by several frame sources
+ */
+#ifndef INFERENCE_SCHEDULER_H
+#define INFERENCE_SCHEDULER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "classifier.h"
+#include "frame_source.h"
+#include "metrics.h"
+#include "ncnn_inference.h"
+#include "region_filter.h"
+
+/*
+ * Frames from every source are queued per source and handed to a fixed pool
+ * of worker threads sharing one Detector. Workers pick the next source with
+ * smooth weighted round-robin, so a source with weight 2 gets twice the
+ * inference slots of a source with weight 1 when both have frames waiting,
+ * and a busy source cannot starve an idle one. Each source queue is bounded;
+ * when it is full the oldest frame is released and counted as dropped.
+ */
+class InferenceScheduler
+{
+public:
+	typedef std::function<void(const Frame &, const std::vector<Object> &)> ResultHandler;
+
+	InferenceScheduler(Detector &detector, unsigned int workers);
+	~InferenceScheduler();
+
+	/* Register a source and return the index to use as Frame::source. */
+	unsigned int addSource(const std::string &name, unsigned int weight = 1,
+			       unsigned int depth = 2);
+
+	void setResultHandler(const ResultHandler &handler) { handler_ = handler; }
+
+	/*
+	 * Infer at most one frame per interval from each source, releasing the
+	 * frames in between as skipped. Zero infers every frame.
+	 */
+	void setFrameInterval(std::chrono::steady_clock::duration interval);
+
+	/*
+	 * Restrict detection on a source to its regions of interest. May be
+	 * called while running, frames already picked keep the old regions.
+	 */
+	void setRegions(unsigned int source, std::shared_ptr<const RegionFilter> regions);
+
+	/*
+	 * Run a second-stage classifier on the detections of every frame
+	 * before the result handler sees them. Set before start().
+	 */
+	void setCascade(ClassifierCascade *cascade) { cascade_ = cascade; }
+
+	void start();
+	void stop();
+
+	/* Thread-safe, called from the source's delivery thread. */
+	void submit(Frame &&frame);
+
+	void printStats(std::ostream &out) const;
+
+private:
+	struct SourceQueue {
+		std::string name;
+		unsigned int weight;
+		unsigned int depth;
+		int current;
+		std::deque<Frame> frames;
+		std::chrono::steady_clock::time_point lastAccepted;
+		std::shared_ptr<const RegionFilter> regions;
+
+		uint64_t captured;
+		uint64_t skipped;
+		uint64_t dropped;
+		uint64_t inferred;
+		double latencySum;
+		double latencyMax;
+
+		/* Exported through the metrics registry, labelled by source. */
+		Counter *capturedTotal;
+		Counter *skippedTotal;
+		Counter *droppedTotal;
+		Counter *inferredTotal;
+		Counter *excludedTotal;
+		Gauge *queueDepth;
+		Histogram *queueSeconds;
+		Histogram *detectSeconds;
+		Histogram *classifySeconds;
+		Histogram *outputSeconds;
+		Histogram *totalSeconds;
+	};
+
+	bool pickFrame(Frame &frame, std::shared_ptr<const RegionFilter> &regions);
+	void run();
+
+	Detector &detector_;
+	unsigned int numWorkers_;
+	ResultHandler handler_;
+	ClassifierCascade *cascade_;
+	std::chrono::steady_clock::duration interval_;
+
+	std::vector<SourceQueue> sources_;
+	mutable std::mutex lock_;
+	std::condition_variable cond_;
+	bool running_;
+	std::vector<std::thread> workers_;
+
+	std::chrono::steady_clock::time_point startTime_;
+};
+
+#endif
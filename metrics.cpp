@@ -0,0 +1,270 @@
+/*
+ * metrics.cpp - Lock-free runtime metrics in Prometheus text format
+ */
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "event_loop.h"
+
+Histogram::Histogram(const std::vector<double> &bounds)
+	: bounds_(bounds), buckets_(new std::atomic<uint64_t>[bounds.size() + 1]),
+	  count_(0), sum_(0)
+{
+	std::sort(bounds_.begin(), bounds_.end());
+	for (size_t i = 0; i <= bounds_.size(); i++)
+		buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+void Histogram::observe(double value)
+{
+	size_t i = 0;
+	while (i < bounds_.size() && value > bounds_[i])
+		i++;
+
+	buckets_[i].fetch_add(1, std::memory_order_relaxed);
+	count_.fetch_add(1, std::memory_order_relaxed);
+
+	double sum = sum_.load(std::memory_order_relaxed);
+	while (!sum_.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+		;
+}
+
+std::vector<double> MetricsRegistry::latencyBuckets()
+{
+	return { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+		 0.25, 0.5, 1.0, 2.5 };
+}
+
+MetricsRegistry::Family &MetricsRegistry::family(const std::string &name,
+						 const std::string &help,
+						 Type type)
+{
+	for (Family &family : families_)
+		if (family.name == name)
+			return family;
+
+	families_.push_back({ name, help, type, {}, nullptr });
+	return families_.back();
+}
+
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help,
+				  const std::string &labels)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	Family &f = family(name, help, TypeCounter);
+	for (Series &series : f.series)
+		if (series.labels == labels)
+			return *static_cast<Counter *>(series.metric);
+
+	counters_.emplace_back();
+	f.series.push_back({ labels, &counters_.back() });
+	return counters_.back();
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name, const std::string &help,
+			      const std::string &labels)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	Family &f = family(name, help, TypeGauge);
+	for (Series &series : f.series)
+		if (series.labels == labels)
+			return *static_cast<Gauge *>(series.metric);
+
+	gauges_.emplace_back();
+	f.series.push_back({ labels, &gauges_.back() });
+	return gauges_.back();
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help,
+				      const std::string &labels,
+				      const std::vector<double> &bounds)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	Family &f = family(name, help, TypeHistogram);
+	for (Series &series : f.series)
+		if (series.labels == labels)
+			return *static_cast<Histogram *>(series.metric);
+
+	histograms_.emplace_back(bounds);
+	f.series.push_back({ labels, &histograms_.back() });
+	return histograms_.back();
+}
+
+void MetricsRegistry::callback(const std::string &name, const std::string &help,
+			       const std::function<double()> &read)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	family(name, help, TypeCallback).read = read;
+}
+
+void MetricsRegistry::counterCallback(const std::string &name, const std::string &help,
+				      const std::function<double()> &read)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	family(name, help, TypeCounterCallback).read = read;
+}
+
+static std::string series_name(const std::string &name, const std::string &labels,
+			       const std::string &extra = "")
+{
+	std::string all = labels;
+	if (!extra.empty())
+		all += (all.empty() ? "" : ",") + extra;
+	return all.empty() ? name : name + "{" + all + "}";
+}
+
+std::string MetricsRegistry::render() const
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	std::ostringstream out;
+
+	for (const Family &f : families_) {
+		static const char *types[] = { "counter", "gauge", "histogram", "gauge", "counter" };
+
+		out << "# HELP " << f.name << " " << f.help << "\n"
+		    << "# TYPE " << f.name << " " << types[f.type] << "\n";
+
+		if (f.type == TypeCallback || f.type == TypeCounterCallback) {
+			out << f.name << " " << f.read() << "\n";
+			continue;
+		}
+
+		for (const Series &series : f.series) {
+			switch (f.type) {
+			case TypeCounter:
+				out << series_name(f.name, series.labels) << " "
+				    << static_cast<const Counter *>(series.metric)->value() << "\n";
+				break;
+			case TypeGauge:
+				out << series_name(f.name, series.labels) << " "
+				    << static_cast<const Gauge *>(series.metric)->value() << "\n";
+				break;
+			case TypeHistogram: {
+				const Histogram *h = static_cast<const Histogram *>(series.metric);
+				uint64_t cumulative = 0;
+				for (size_t i = 0; i < h->bounds().size(); i++) {
+					cumulative += h->bucket(i);
+					std::ostringstream le;
+					le << "le=\"" << h->bounds()[i] << "\"";
+					out << series_name(f.name + "_bucket", series.labels, le.str())
+					    << " " << cumulative << "\n";
+				}
+				cumulative += h->bucket(h->bounds().size());
+				out << series_name(f.name + "_bucket", series.labels, "le=\"+Inf\"")
+				    << " " << cumulative << "\n"
+				    << series_name(f.name + "_sum", series.labels) << " " << h->sum() << "\n"
+				    << series_name(f.name + "_count", series.labels) << " " << h->count() << "\n";
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	return out.str();
+}
+
+MetricsRegistry &metrics()
+{
+	static MetricsRegistry registry;
+	return registry;
+}
+
+static double read_rss_bytes()
+{
+	long pages = 0, resident = 0;
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file)
+		return 0;
+	if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+		resident = 0;
+	fclose(file);
+	return static_cast<double>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+static double read_cpu_seconds()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static double read_cpu_temperature()
+{
+	long millidegrees = 0;
+	FILE *file = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
+	if (!file)
+		return 0;
+	if (fscanf(file, "%ld", &millidegrees) != 1)
+		millidegrees = 0;
+	fclose(file);
+	return millidegrees / 1000.0;
+}
+
+void register_process_metrics(MetricsRegistry &registry)
+{
+	registry.callback("radaria_resident_memory_bytes",
+			  "Resident set size of the process", &read_rss_bytes);
+	registry.counterCallback("radaria_cpu_seconds_total",
+				 "User and system CPU time consumed by the process",
+				 &read_cpu_seconds);
+	registry.callback("radaria_cpu_temperature_celsius",
+			  "SoC temperature from thermal_zone0", &read_cpu_temperature);
+}
+
+MetricsServer::MetricsServer(EventLoop &loop, MetricsRegistry &registry)
+	: loop_(loop), registry_(registry), http_(nullptr)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+	if (http_)
+		evhttp_free(http_);
+}
+
+int MetricsServer::listen(const std::string &address, uint16_t port)
+{
+	http_ = evhttp_new(loop_.base());
+	if (!http_)
+		return -1;
+
+	evhttp_set_allowed_methods(http_, EVHTTP_REQ_GET);
+	evhttp_set_cb(http_, "/metrics", [](struct evhttp_request *req, void *arg) {
+		MetricsRegistry *registry = static_cast<MetricsRegistry *>(arg);
+		std::string text = registry->render();
+
+		struct evbuffer *body = evbuffer_new();
+		evbuffer_add(body, text.data(), text.size());
+		evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+				  "text/plain; version=0.0.4");
+		evhttp_send_reply(req, HTTP_OK, "OK", body);
+		evbuffer_free(body);
+	}, &registry_);
+
+	if (evhttp_bind_socket(http_, address.c_str(), port) < 0) {
+		std::cerr << "Failed to listen for metrics on " << address << ":"
+			  << port << std::endl;
+		return -1;
+	}
+
+	std::cout << "Metrics on http://" << address << ":" << port << "/metrics" << std::endl;
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * metrics.h - Lock-free runtime metrics in Prometheus text format
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct evhttp;
+class EventLoop;
+
+/*
+ * Metric objects are created once through the registry and then updated
+ * from any thread with relaxed atomics only: no locks and no allocation on
+ * the hot path. Their addresses stay valid for the life of the registry.
+ */
+class Counter
+{
+public:
+	Counter() : value_(0) {}
+
+	void inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> value_;
+};
+
+class Gauge
+{
+public:
+	Gauge() : value_(0) {}
+
+	void set(double value) { value_.store(value, std::memory_order_relaxed); }
+	double value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<double> value_;
+};
+
+class Histogram
+{
+public:
+	explicit Histogram(const std::vector<double> &bounds);
+
+	void observe(double value);
+
+	const std::vector<double> &bounds() const { return bounds_; }
+	uint64_t bucket(size_t i) const { return buckets_[i].load(std::memory_order_relaxed); }
+	uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+	double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+private:
+	std::vector<double> bounds_;
+	std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+	std::atomic<uint64_t> count_;
+	std::atomic<double> sum_;
+};
+
+class MetricsRegistry
+{
+public:
+	/*
+	 * Look up or create a metric. `labels` is the Prometheus label set
+	 * without braces, e.g. "source=\"0\"". Registration takes a lock and
+	 * belongs at start-up, keep the returned reference for updates.
+	 */
+	Counter &counter(const std::string &name, const std::string &help,
+			 const std::string &labels = "");
+	Gauge &gauge(const std::string &name, const std::string &help,
+		     const std::string &labels = "");
+	Histogram &histogram(const std::string &name, const std::string &help,
+			     const std::string &labels = "",
+			     const std::vector<double> &bounds = latencyBuckets());
+
+	/* Gauge computed when scraped, for values such as RSS. */
+	void callback(const std::string &name, const std::string &help,
+		      const std::function<double()> &read);
+	/* Counter computed when scraped, for monotonic totals such as CPU time. */
+	void counterCallback(const std::string &name, const std::string &help,
+			     const std::function<double()> &read);
+
+	std::string render() const;
+
+	static std::vector<double> latencyBuckets();
+
+private:
+	enum Type { TypeCounter, TypeGauge, TypeHistogram, TypeCallback, TypeCounterCallback };
+
+	struct Series {
+		std::string labels;
+		void *metric;
+	};
+
+	struct Family {
+		std::string name;
+		std::string help;
+		Type type;
+		std::vector<Series> series;
+		std::function<double()> read;
+	};
+
+	Family &family(const std::string &name, const std::string &help, Type type);
+
+	std::deque<Family> families_;
+	std::deque<Counter> counters_;
+	std::deque<Gauge> gauges_;
+	std::deque<Histogram> histograms_;
+	mutable std::mutex lock_;
+};
+
+MetricsRegistry &metrics();
+
+/* Register process RSS, CPU time and SoC temperature metrics. */
+void register_process_metrics(MetricsRegistry &registry);
+
+/*
+ * Serves GET /metrics from the registry on the EventLoop thread.
+ */
+class MetricsServer
+{
+public:
+	MetricsServer(EventLoop &loop, MetricsRegistry &registry);
+	~MetricsServer();
+
+	int listen(const std::string &address, uint16_t port);
+
+private:
+	EventLoop &loop_;
+	MetricsRegistry &registry_;
+	struct evhttp *http_;
+};
+
+#endif
@@ -0,0 +1,323 @@
+/*
+ * mjpeg_container.cpp - Append-only segmented container for JPEG frames
+ */
+
+#include "mjpeg_container.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static const uint64_t kNsPerSec = 1000000000ull;
+
+static uint64_t align8(uint64_t value)
+{
+	return (value + 7) & ~7ull;
+}
+
+/*
+ * Write every iovec at `offset`, resuming after short writes. Writes are
+ * positional so that a failed record leaves nothing the next one does not
+ * overwrite, and the segment never holds data the index does not describe.
+ */
+static int write_all(int fd, struct iovec *iov, int count, uint64_t offset)
+{
+	while (count) {
+		ssize_t ret = pwritev(fd, iov, count, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+
+		offset += ret;
+		while (count && static_cast<size_t>(ret) >= iov->iov_len) {
+			ret -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count) {
+			iov->iov_base = static_cast<char *>(iov->iov_base) + ret;
+			iov->iov_len -= ret;
+		}
+	}
+
+	return 0;
+}
+
+uint64_t wallclock_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+MjpegWriter::MjpegWriter(const std::string &prefix, uint64_t maxBytes,
+			 unsigned int maxSeconds)
+	: prefix_(prefix), maxBytes_(maxBytes), maxNs_(maxSeconds * kNsPerSec),
+	  fd_(-1), offset_(0), openedNs_(0)
+{
+}
+
+MjpegWriter::~MjpegWriter()
+{
+	close();
+}
+
+int MjpegWriter::openSegment(uint64_t timestampNs)
+{
+	std::time_t seconds = timestampNs / kNsPerSec;
+	char stamp[32];
+	std::strftime(stamp, sizeof(stamp), "%Y%m%d_%H%M%S", std::localtime(&seconds));
+	path_ = prefix_ + "_" + stamp + ".mjpc";
+
+	/* Segments rotated within the same second get a numeric suffix. */
+	fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	for (unsigned int n = 1; fd_ < 0 && errno == EEXIST; n++) {
+		path_ = prefix_ + "_" + stamp + "_" + std::to_string(n) + ".mjpc";
+		fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+	}
+	if (fd_ < 0) {
+		std::cerr << "Failed to create " << path_ << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	/*
+	 * Reserve the whole segment up front so the filesystem can lay it out
+	 * contiguously. KEEP_SIZE leaves the file size at what was actually
+	 * written, which keeps unclosed segments scannable.
+	 */
+	if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, maxBytes_) < 0 && errno != EOPNOTSUPP)
+		std::cerr << "fallocate failed on " << path_ << ": " << strerror(errno) << std::endl;
+
+	SegmentHeader header = {};
+	memcpy(header.magic, MJPEG_SEGMENT_MAGIC, sizeof(header.magic));
+	header.version = 1;
+	header.headerSize = sizeof(header);
+	header.createdNs = timestampNs;
+
+	struct iovec iov = { &header, sizeof(header) };
+	if (write_all(fd_, &iov, 1, 0)) {
+		std::cerr << "Failed to write " << path_ << std::endl;
+		::close(fd_);
+		fd_ = -1;
+		return -1;
+	}
+
+	offset_ = sizeof(header);
+	openedNs_ = timestampNs;
+	index_.clear();
+
+	return 0;
+}
+
+void MjpegWriter::closeSegment()
+{
+	if (fd_ < 0)
+		return;
+
+	/* Frames from several workers and event flushes arrive out of order. */
+	std::stable_sort(index_.begin(), index_.end(),
+			 [](const IndexEntry &a, const IndexEntry &b) {
+				 return a.timestampNs < b.timestampNs;
+			 });
+
+	SegmentFooter footer = {};
+	memcpy(footer.magic, MJPEG_FOOTER_MAGIC, sizeof(footer.magic));
+	footer.indexOffset = offset_;
+	footer.count = index_.size();
+
+	struct iovec iov[2] = {
+		{ index_.data(), index_.size() * sizeof(IndexEntry) },
+		{ &footer, sizeof(footer) },
+	};
+	uint64_t expected = iov[0].iov_len + iov[1].iov_len;
+	if (write_all(fd_, iov, 2, offset_))
+		std::cerr << "Failed to write index of " << path_ << ": "
+			  << strerror(errno) << std::endl;
+
+	/* Give back the preallocated blocks past the end of the data. */
+	if (ftruncate(fd_, offset_ + expected) < 0)
+		std::cerr << "Failed to truncate " << path_ << std::endl;
+
+	::close(fd_);
+	fd_ = -1;
+
+	if (segmentHandler_)
+		segmentHandler_(path_, offset_ + expected);
+}
+
+int MjpegWriter::append(const unsigned char *jpeg, size_t size,
+			uint64_t timestampNs, uint64_t sequence,
+			unsigned int source)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	uint64_t recordSize = align8(sizeof(RecordHeader) + size);
+	uint64_t tailSize = (index_.size() + 1) * sizeof(IndexEntry) + sizeof(SegmentFooter);
+
+	/* Timestamps are unsigned, a frame older than the segment must not wrap. */
+	if (fd_ >= 0 && !index_.empty() &&
+	    (offset_ + recordSize + tailSize > maxBytes_ ||
+	     (timestampNs > openedNs_ && timestampNs - openedNs_ >= maxNs_)))
+		closeSegment();
+
+	if (fd_ < 0 && openSegment(timestampNs))
+		return -1;
+
+	RecordHeader record = {};
+	record.magic = MJPEG_RECORD_MAGIC;
+	record.size = size;
+	record.timestampNs = timestampNs;
+	record.sequence = sequence;
+	record.source = source;
+
+	static const unsigned char padding[8] = {};
+	struct iovec iov[3] = {
+		{ &record, sizeof(record) },
+		{ const_cast<unsigned char *>(jpeg), size },
+		{ const_cast<unsigned char *>(padding), recordSize - sizeof(record) - size },
+	};
+	/* On failure offset_ stays put, the next record overwrites this one. */
+	if (write_all(fd_, iov, 3, offset_)) {
+		std::cerr << "Failed to append to " << path_ << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	index_.push_back({ timestampNs, offset_ + sizeof(record),
+			   static_cast<uint32_t>(size), source, sequence });
+	offset_ += recordSize;
+
+	if (appendHandler_)
+		appendHandler_(size);
+
+	return 0;
+}
+
+void MjpegWriter::close()
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	closeSegment();
+}
+
+MjpegReader::MjpegReader()
+	: base_(nullptr), length_(0)
+{
+}
+
+MjpegReader::~MjpegReader()
+{
+	close();
+}
+
+int MjpegReader::open(const std::string &path)
+{
+	close();
+
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(SegmentHeader))) {
+		std::cerr << path << " is not a segment" << std::endl;
+		::close(fd);
+		return -1;
+	}
+
+	void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (map == MAP_FAILED) {
+		std::cerr << "Failed to map " << path << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	base_ = static_cast<const unsigned char *>(map);
+	length_ = st.st_size;
+
+	const SegmentHeader *header = reinterpret_cast<const SegmentHeader *>(base_);
+	if (memcmp(header->magic, MJPEG_SEGMENT_MAGIC, sizeof(header->magic))) {
+		std::cerr << path << " is not a segment" << std::endl;
+		close();
+		return -1;
+	}
+
+	if (loadIndex())
+		scanRecords();
+
+	/*
+	 * A closed segment carries a sorted index. Only a rebuilt one, or one
+	 * written before the index was sorted on close, still needs sorting.
+	 */
+	auto earlier = [](const IndexEntry &a, const IndexEntry &b) {
+		return a.timestampNs < b.timestampNs;
+	};
+	if (!std::is_sorted(index_.begin(), index_.end(), earlier))
+		std::stable_sort(index_.begin(), index_.end(), earlier);
+
+	return 0;
+}
+
+void MjpegReader::close()
+{
+	if (base_)
+		munmap(const_cast<unsigned char *>(base_), length_);
+	base_ = nullptr;
+	length_ = 0;
+	index_.clear();
+}
+
+int MjpegReader::loadIndex()
+{
+	if (length_ < sizeof(SegmentHeader) + sizeof(SegmentFooter))
+		return -1;
+
+	const SegmentFooter *footer = reinterpret_cast<const SegmentFooter *>(
+		base_ + length_ - sizeof(SegmentFooter));
+	if (memcmp(footer->magic, MJPEG_FOOTER_MAGIC, sizeof(footer->magic)))
+		return -1;
+
+	uint64_t indexBytes = footer->count * sizeof(IndexEntry);
+	if (footer->indexOffset + indexBytes + sizeof(SegmentFooter) != length_)
+		return -1;
+
+	const IndexEntry *entries = reinterpret_cast<const IndexEntry *>(
+		base_ + footer->indexOffset);
+	index_.assign(entries, entries + footer->count);
+
+	return 0;
+}
+
+/* Rebuild the index of a segment that was never closed. */
+void MjpegReader::scanRecords()
+{
+	uint64_t offset = sizeof(SegmentHeader);
+
+	while (offset + sizeof(RecordHeader) <= length_) {
+		const RecordHeader *record = reinterpret_cast<const RecordHeader *>(base_ + offset);
+		if (record->magic != MJPEG_RECORD_MAGIC ||
+		    offset + sizeof(RecordHeader) + record->size > length_)
+			break;
+
+		index_.push_back({ record->timestampNs, offset + sizeof(RecordHeader),
+				   record->size, record->source, record->sequence });
+		offset += align8(sizeof(RecordHeader) + record->size);
+	}
+}
+
+size_t MjpegReader::seek(uint64_t timestampNs) const
+{
+	auto it = std::lower_bound(index_.begin(), index_.end(), timestampNs,
+				   [](const IndexEntry &entry, uint64_t ts) {
+					   return entry.timestampNs < ts;
+				   });
+	return it - index_.begin();
+}
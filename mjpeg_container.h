@@ -0,0 +1,143 @@
+/*
+ * mjpeg_container.h - Append-only segmented container for JPEG frames
+ *
+ * A segment file holds a header, a sequence of frame records and, once the
+ * segment is closed, an index of every record followed by a footer:
+ *
+ *   SegmentHeader | (RecordHeader JPEG pad)* | IndexEntry* | SegmentFooter
+ *
+ * Records are padded to 8 bytes. A segment left without footer, for
+ * instance after a power cut, is still readable by scanning its records.
+ * All fields are little-endian.
+ */
+#ifndef MJPEG_CONTAINER_H
+#define MJPEG_CONTAINER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define MJPEG_SEGMENT_MAGIC "RDMJPEG1"
+#define MJPEG_FOOTER_MAGIC "RDMJIDX1"
+#define MJPEG_RECORD_MAGIC 0x304d5246 /* "FRM0" */
+
+struct SegmentHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t headerSize;
+	uint64_t createdNs;
+	uint8_t reserved[40];
+};
+
+struct RecordHeader
+{
+	uint32_t magic;
+	uint32_t size;
+	uint64_t timestampNs;
+	uint64_t sequence;
+	uint32_t source;
+	uint32_t reserved;
+};
+
+struct IndexEntry
+{
+	uint64_t timestampNs;
+	uint64_t offset;
+	uint32_t size;
+	uint32_t source;
+	uint64_t sequence;
+};
+
+struct SegmentFooter
+{
+	char magic[8];
+	uint64_t indexOffset;
+	uint64_t count;
+};
+
+/*
+ * Writes frames into segment files named <prefix>_<YYYYmmdd_HHMMSS>.mjpc.
+ * Each segment is preallocated with fallocate() and rotated once it would
+ * exceed maxBytes or has been open for maxSeconds. Frames older than the
+ * segment, such as a pre-event ring being flushed, never rotate it.
+ * append() is thread-safe.
+ */
+class MjpegWriter
+{
+public:
+	/* Handlers run under the writer lock and must not call back into it. */
+	typedef std::function<void(size_t size)> AppendHandler;
+	typedef std::function<void(const std::string &path, uint64_t size)> SegmentHandler;
+
+	MjpegWriter(const std::string &prefix, uint64_t maxBytes = 256ull << 20,
+		    unsigned int maxSeconds = 600);
+	~MjpegWriter();
+
+	/* Told the JPEG bytes of every appended frame, for accounting. */
+	void setAppendHandler(const AppendHandler &handler) { appendHandler_ = handler; }
+	/* Told the path and final size of every closed segment. */
+	void setSegmentHandler(const SegmentHandler &handler) { segmentHandler_ = handler; }
+
+	int append(const unsigned char *jpeg, size_t size, uint64_t timestampNs,
+		   uint64_t sequence, unsigned int source = 0);
+	void close();
+
+	const std::string &segmentPath() const { return path_; }
+
+private:
+	int openSegment(uint64_t timestampNs);
+	void closeSegment();
+
+	std::string prefix_;
+	uint64_t maxBytes_;
+	uint64_t maxNs_;
+
+	int fd_;
+	std::string path_;
+	uint64_t offset_;
+	uint64_t openedNs_;
+	std::vector<IndexEntry> index_;
+
+	AppendHandler appendHandler_;
+	SegmentHandler segmentHandler_;
+
+	std::mutex lock_;
+};
+
+/*
+ * Memory-maps a segment and exposes its frames by position or timestamp.
+ * The writer stores the index sorted by timestamp, so seek() is a binary
+ * search. Only the index rebuilt from an unclosed segment is sorted here.
+ */
+class MjpegReader
+{
+public:
+	MjpegReader();
+	~MjpegReader();
+
+	int open(const std::string &path);
+	void close();
+
+	size_t count() const { return index_.size(); }
+	const IndexEntry &entry(size_t i) const { return index_[i]; }
+	const unsigned char *frame(size_t i) const { return base_ + index_[i].offset; }
+
+	/* Index of the first frame at or after timestampNs, count() if none. */
+	size_t seek(uint64_t timestampNs) const;
+
+private:
+	int loadIndex();
+	void scanRecords();
+
+	const unsigned char *base_;
+	size_t length_;
+	std::vector<IndexEntry> index_;
+};
+
+uint64_t wallclock_ns();
+
+#endif
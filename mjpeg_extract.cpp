@@ -0,0 +1,115 @@
+/*
+ * mjpeg_extract.cpp - Inspect and extract frames from container segments
+ *
+ * Usage:
+ *   mjpeg_extract SEGMENT list
+ *   mjpeg_extract SEGMENT extract DIR
+ *   mjpeg_extract SEGMENT at TIME OUT.jpg
+ *
+ * TIME is either nanoseconds since the epoch or local time formatted as
+ * YYYYmmdd_HHMMSS. "at" writes the first frame at or after TIME.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include "mjpeg_container.h"
+
+static int write_frame(const MjpegReader &reader, size_t i, const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file) {
+		std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	const IndexEntry &entry = reader.entry(i);
+	size_t written = fwrite(reader.frame(i), 1, entry.size, file);
+	fclose(file);
+
+	return written == entry.size ? 0 : -1;
+}
+
+static bool parse_time(const std::string &text, uint64_t &timestampNs)
+{
+	struct tm tm = {};
+	const char *end = strptime(text.c_str(), "%Y%m%d_%H%M%S", &tm);
+	if (end && !*end) {
+		tm.tm_isdst = -1;
+		timestampNs = static_cast<uint64_t>(mktime(&tm)) * 1000000000ull;
+		return true;
+	}
+
+	char *last;
+	timestampNs = strtoull(text.c_str(), &last, 10);
+	return !text.empty() && !*last;
+}
+
+static void usage()
+{
+	std::cerr << "Usage: mjpeg_extract SEGMENT list" << std::endl
+		  << "       mjpeg_extract SEGMENT extract DIR" << std::endl
+		  << "       mjpeg_extract SEGMENT at TIME OUT.jpg" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	MjpegReader reader;
+	if (reader.open(argv[1]))
+		return EXIT_FAILURE;
+
+	std::string command = argv[2];
+
+	if (command == "list") {
+		for (size_t i = 0; i < reader.count(); i++) {
+			const IndexEntry &entry = reader.entry(i);
+			printf("%zu\t%llu\tsource %u\tseq %llu\t%u bytes\n", i,
+			       static_cast<unsigned long long>(entry.timestampNs),
+			       entry.source,
+			       static_cast<unsigned long long>(entry.sequence),
+			       entry.size);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	if (command == "extract" && argc == 4) {
+		for (size_t i = 0; i < reader.count(); i++) {
+			const IndexEntry &entry = reader.entry(i);
+			char name[64];
+			snprintf(name, sizeof(name), "/%llu_%u.jpg",
+				 static_cast<unsigned long long>(entry.timestampNs),
+				 entry.source);
+			if (write_frame(reader, i, argv[3] + std::string(name)))
+				return EXIT_FAILURE;
+		}
+		std::cout << "Extracted " << reader.count() << " frames" << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	if (command == "at" && argc == 5) {
+		uint64_t timestampNs;
+		if (!parse_time(argv[3], timestampNs)) {
+			usage();
+			return EXIT_FAILURE;
+		}
+
+		size_t i = reader.seek(timestampNs);
+		if (i == reader.count()) {
+			std::cerr << "No frame at or after " << argv[3] << std::endl;
+			return EXIT_FAILURE;
+		}
+
+		return write_frame(reader, i, argv[4]) ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+
+	usage();
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,276 @@
+/*
+ * model_bundle.cpp - Single-file binary model bundle for the detector
+ */
+
+#include "model_bundle.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Defined by model_embed.S when the bundle is linked in. */
+extern "C" {
+extern const unsigned char radaria_model_bundle[] __attribute__((weak));
+extern const unsigned char radaria_model_bundle_end[] __attribute__((weak));
+}
+
+static uint64_t align_up(uint64_t value)
+{
+	return (value + MODEL_BUNDLE_ALIGN - 1) / MODEL_BUNDLE_ALIGN * MODEL_BUNDLE_ALIGN;
+}
+
+/*
+ * FNV-1a over 64-bit words, then the remaining bytes. Not cryptographic,
+ * it catches truncated or corrupted files at memory bandwidth.
+ */
+uint64_t model_bundle_checksum(const unsigned char *data, size_t size, uint64_t hash)
+{
+	const uint64_t prime = 0x100000001b3ULL;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ data[i]) * prime;
+
+	return hash;
+}
+
+ModelBundle::ModelBundle(const unsigned char *data, size_t size, bool mapped,
+			 const std::string &source)
+	: data_(data), size_(size), mapped_(mapped), source_(source)
+{
+}
+
+ModelBundle::~ModelBundle()
+{
+	if (mapped_)
+		munmap(const_cast<unsigned char *>(data_), size_);
+}
+
+int ModelBundle::verify() const
+{
+	if (size_ < sizeof(ModelBundleHeader)) {
+		std::cerr << source_ << ": too short for a model bundle" << std::endl;
+		return -1;
+	}
+
+	const ModelBundleHeader &h = header();
+	if (h.magic != MODEL_BUNDLE_MAGIC || h.version != MODEL_BUNDLE_VERSION) {
+		std::cerr << source_ << ": not a version " << MODEL_BUNDLE_VERSION
+			  << " model bundle" << std::endl;
+		return -1;
+	}
+
+	if (h.paramOffset % MODEL_BUNDLE_ALIGN || h.weightsOffset % MODEL_BUNDLE_ALIGN ||
+	    h.paramOffset + h.paramSize > size_ || h.weightsOffset + h.weightsSize > size_) {
+		std::cerr << source_ << ": corrupt section table" << std::endl;
+		return -1;
+	}
+
+	uint64_t checksum = model_bundle_checksum(param(), paramSize());
+	checksum = model_bundle_checksum(weights(), weightsSize(), checksum);
+	if (checksum != h.checksum) {
+		std::cerr << source_ << ": checksum mismatch" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+std::shared_ptr<const ModelBundle> ModelBundle::open(const std::string &path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		std::cerr << "Failed to open " << path << ": " << strerror(errno) << std::endl;
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		std::cerr << "Failed to map " << path << ": " << strerror(errno) << std::endl;
+		return nullptr;
+	}
+
+	std::shared_ptr<const ModelBundle> bundle(
+		new ModelBundle(static_cast<const unsigned char *>(data), st.st_size,
+				true, path));
+	if (bundle->verify())
+		return nullptr;
+
+	return bundle;
+}
+
+std::shared_ptr<const ModelBundle> ModelBundle::embedded()
+{
+	if (!radaria_model_bundle || !radaria_model_bundle_end)
+		return nullptr;
+
+	/* The linked-in data never changes, verify it once. */
+	static std::shared_ptr<const ModelBundle> bundle = []() {
+		std::shared_ptr<const ModelBundle> embedded(
+			new ModelBundle(radaria_model_bundle,
+					radaria_model_bundle_end - radaria_model_bundle,
+					false, "embedded model"));
+		return embedded->verify() ? nullptr : embedded;
+	}();
+
+	return bundle;
+}
+
+static bool read_file(const std::string &path, std::vector<char> &data)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cerr << "Failed to open " << path << std::endl;
+		return false;
+	}
+
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+/*
+ * ncnn numbers blobs in the order the layers of the text param produce
+ * them, which is the numbering the binary param refers to.
+ */
+static int blob_indices(const std::string &paramPath, std::map<std::string, int> &blobs)
+{
+	std::ifstream in(paramPath);
+	int magic, layerCount, blobCount;
+	if (!(in >> magic >> layerCount >> blobCount) || magic != 7767517) {
+		std::cerr << paramPath << ": not an ncnn text param" << std::endl;
+		return -1;
+	}
+
+	std::string line;
+	std::getline(in, line);
+	for (int i = 0; i < layerCount && std::getline(in, line); i++) {
+		std::istringstream fields(line);
+		std::string type, name, blob;
+		int bottoms, tops;
+		if (!(fields >> type >> name >> bottoms >> tops)) {
+			std::cerr << paramPath << ": malformed layer line" << std::endl;
+			return -1;
+		}
+
+		for (int b = 0; b < bottoms; b++)
+			fields >> blob;
+		for (int t = 0; t < tops && fields >> blob; t++)
+			blobs.emplace(blob, blobs.size());
+	}
+
+	return 0;
+}
+
+int param_input_size(const std::string &paramPath)
+{
+	std::ifstream in(paramPath);
+	int magic, layerCount, blobCount;
+	if (!(in >> magic >> layerCount >> blobCount) || magic != 7767517)
+		return -1;
+
+	std::string line;
+	std::getline(in, line);
+	for (int i = 0; i < layerCount && std::getline(in, line); i++) {
+		std::istringstream fields(line);
+		std::string type, name, field;
+		int bottoms, tops;
+		if (!(fields >> type >> name >> bottoms >> tops) || type != "MemoryData")
+			continue;
+
+		/* Anchor points are a 2 x N table, after the top blob names. */
+		for (int b = 0; b < bottoms + tops; b++)
+			fields >> field;
+		int width = 0, height = 0;
+		while (fields >> field) {
+			if (!field.compare(0, 2, "0="))
+				width = std::stoi(field.substr(2));
+			else if (!field.compare(0, 2, "1="))
+				height = std::stoi(field.substr(2));
+		}
+		if (height != 2 || width <= 0 || width % 21)
+			continue;
+
+		int cells = std::lround(std::sqrt(width / 21));
+		if (cells * cells * 21 == width)
+			return cells * 32;
+	}
+
+	return -1;
+}
+
+int write_model_bundle(const std::string &paramPath, const std::string &paramBinPath,
+		       const std::string &weightsPath, const std::string &outPath,
+		       const std::string &input, const std::string &output)
+{
+	std::map<std::string, int> blobs;
+	if (blob_indices(paramPath, blobs))
+		return -1;
+
+	if (!blobs.count(input) || !blobs.count(output)) {
+		std::cerr << paramPath << ": no blob named " << input << " or "
+			  << output << std::endl;
+		return -1;
+	}
+
+	int inputSize = param_input_size(paramPath);
+	if (inputSize < 0) {
+		std::cerr << paramPath << ": no anchor table to read the input size from"
+			  << std::endl;
+		return -1;
+	}
+
+	std::vector<char> param, weights;
+	if (!read_file(paramBinPath, param) || !read_file(weightsPath, weights))
+		return -1;
+
+	ModelBundleHeader header = {};
+	header.magic = MODEL_BUNDLE_MAGIC;
+	header.version = MODEL_BUNDLE_VERSION;
+	header.inputIndex = blobs[input];
+	header.outputIndex = blobs[output];
+	header.inputSize = inputSize;
+	header.paramOffset = align_up(sizeof(header));
+	header.paramSize = param.size();
+	header.weightsOffset = align_up(header.paramOffset + param.size());
+	header.weightsSize = weights.size();
+	header.checksum = model_bundle_checksum(
+		reinterpret_cast<const unsigned char *>(param.data()), param.size());
+	header.checksum = model_bundle_checksum(
+		reinterpret_cast<const unsigned char *>(weights.data()), weights.size(),
+		header.checksum);
+
+	std::vector<char> bundle(header.weightsOffset + weights.size());
+	memcpy(bundle.data(), &header, sizeof(header));
+	memcpy(bundle.data() + header.paramOffset, param.data(), param.size());
+	memcpy(bundle.data() + header.weightsOffset, weights.data(), weights.size());
+
+	std::ofstream out(outPath, std::ios::binary);
+	out.write(bundle.data(), bundle.size());
+	if (!out) {
+		std::cerr << "Failed to write " << outPath << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * model_bundle.h - Single-file binary model bundle for the detector
+ */
+#ifndef MODEL_BUNDLE_H
+#define MODEL_BUNDLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#define MODEL_BUNDLE_MAGIC 0x314c444f4d524452ULL /* "RDRMODL1" */
+#define MODEL_BUNDLE_VERSION 2
+
+/* Sections start on this boundary, ncnn needs at least 4 bytes. */
+#define MODEL_BUNDLE_ALIGN 64
+
+/*
+ * Layout: this header, then the ncnn binary param produced by ncnn2mem,
+ * then the raw weights, each section aligned. Binary params carry no blob
+ * names, so the packer records the indices of the input and output blobs,
+ * along with the input size the model was exported for. The checksum
+ * covers both sections.
+ */
+struct ModelBundleHeader
+{
+	uint64_t magic;
+	uint32_t version;
+	int32_t inputIndex;
+	int32_t outputIndex;
+	int32_t inputSize;
+	uint64_t paramOffset;
+	uint64_t paramSize;
+	uint64_t weightsOffset;
+	uint64_t weightsSize;
+	uint64_t checksum;
+};
+
+/*
+ * A verified bundle, either mapped read-only from a file or linked into
+ * the executable. ncnn references the weights in place, so the bundle must
+ * outlive every network loaded from it.
+ */
+class ModelBundle
+{
+public:
+	~ModelBundle();
+
+	static std::shared_ptr<const ModelBundle> open(const std::string &path);
+
+	/* The bundle linked in at build time, nullptr if there is none. */
+	static std::shared_ptr<const ModelBundle> embedded();
+
+	const unsigned char *param() const { return data_ + header().paramOffset; }
+	const unsigned char *weights() const { return data_ + header().weightsOffset; }
+	size_t paramSize() const { return header().paramSize; }
+	size_t weightsSize() const { return header().weightsSize; }
+
+	int inputIndex() const { return header().inputIndex; }
+	int outputIndex() const { return header().outputIndex; }
+	int inputSize() const { return header().inputSize; }
+
+	const std::string &source() const { return source_; }
+
+private:
+	ModelBundle(const unsigned char *data, size_t size, bool mapped,
+		    const std::string &source);
+
+	const ModelBundleHeader &header() const
+	{
+		return *reinterpret_cast<const ModelBundleHeader *>(data_);
+	}
+
+	int verify() const;
+
+	const unsigned char *data_;
+	size_t size_;
+	bool mapped_;
+	std::string source_;
+};
+
+uint64_t model_bundle_checksum(const unsigned char *data, size_t size,
+			       uint64_t hash = 0xcbf29ce484222325ULL);
+
+/*
+ * Side of the square input a YOLO text param was exported for, found from
+ * its anchor points: strides 8, 16 and 32 over an input of side s give
+ * 21 * s^2 / 1024 anchors. Returns -1 if the param has no such table.
+ */
+int param_input_size(const std::string &paramPath);
+
+/*
+ * Pack a bundle from the text param (read for blob indices only), the
+ * binary param written by ncnn2mem and the weights.
+ */
+int write_model_bundle(const std::string &paramPath, const std::string &paramBinPath,
+		       const std::string &weightsPath, const std::string &outPath,
+		       const std::string &input = "in0", const std::string &output = "out0");
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * model_pack.cpp - Build and check binary model bundles
+ *
+ * Usage:
+ *   model_pack pack PARAM PARAM_BIN WEIGHTS OUT [INPUT OUTPUT]
+ *   model_pack verify BUNDLE
+ *
+ * PARAM is the text .param, PARAM_BIN the binary param written for it by
+ * ncnn2mem and WEIGHTS the .bin. INPUT and OUTPUT name the blobs the
+ * detector feeds and extracts, in0 and out0 by default.
+ */
+
+#include <iostream>
+#include <string>
+
+#include "model_bundle.h"
+
+static void usage()
+{
+	std::cerr << "Usage: model_pack pack PARAM PARAM_BIN WEIGHTS OUT [INPUT OUTPUT]" << std::endl
+		  << "       model_pack verify BUNDLE" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	std::string command = argv[1];
+
+	if (command == "pack" && (argc == 6 || argc == 8)) {
+		std::string input = argc == 8 ? argv[6] : "in0";
+		std::string output = argc == 8 ? argv[7] : "out0";
+		if (write_model_bundle(argv[2], argv[3], argv[4], argv[5], input, output))
+			return EXIT_FAILURE;
+	} else if (command != "verify" || argc != 3) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	std::string path = command == "pack" ? argv[5] : argv[2];
+	std::shared_ptr<const ModelBundle> bundle = ModelBundle::open(path);
+	if (!bundle)
+		return EXIT_FAILURE;
+
+	std::cout << path << ": param " << bundle->paramSize() << " bytes, weights "
+		  << bundle->weightsSize() << " bytes, input blob " << bundle->inputIndex()
+		  << ", output blob " << bundle->outputIndex() << ", input size "
+		  << bundle->inputSize() << std::endl;
+
+	return EXIT_SUCCESS;
+}
@@ -1,209 +1,503 @@
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <vector>
 #include <string>
+#include "cpu.h" // NCNN
 #include "net.h" // NCNN
 #include "ncnn_inference.h"
+#include "perf_counters.h"
 
-// Simple image loading (replace with OpenCV or similar if available)
-// This is a placeholder, and might not work directly.
-//  It's better to use a library like OpenCV.
-
-// Placeholder image loading function (replace with a proper implementation)
-//Image loadImage(const std::string& path) {
-//    Image img;
-    // Replace this with actual image loading using a library like OpenCV
-//    std::cerr << "Image loading not implemented. Please use OpenCV or another image library." << std::endl;
-//    exit(1);
-//    return img;
-//}
 #define MAX_STRIDE 32
+#define MAX_INPUT_SIZE 1280
 
-static float softmax(
-	const float* src,
-	float* dst,
-	int length
+/*
+ * out0 of the exported yolo11n head is already decoded: a (4 + num_class) x
+ * num_anchors matrix whose first four rows are cx, cy, w, h in letterboxed
+ * input pixels and whose remaining rows are sigmoid class scores.
+ */
+static void generate_proposals(
+	const ncnn::Mat& feat_blob,
+	const float prob_threshold,
+	std::vector<Object>& objects
 )
 {
-	float alpha = -FLT_MAX;
-	for (int c = 0; c < length; c++)
+	const int num_anchors = feat_blob.w;
+	const int num_class = feat_blob.h - 4;
+
+	const float* cx = feat_blob.row(0);
+	const float* cy = feat_blob.row(1);
+	const float* bw = feat_blob.row(2);
+	const float* bh = feat_blob.row(3);
+
+	for (int i = 0; i < num_anchors; i++)
 	{
-		float score = src[c];
-		if (score > alpha)
+		int class_index = 0;
+		float class_score = -FLT_MAX;
+		for (int c = 0; c < num_class; c++)
 		{
-			alpha = score;
+			float score = feat_blob.row(4 + c)[i];
+			if (score > class_score)
+			{
+				class_index = c;
+				class_score = score;
+			}
 		}
-	}
 
-	float denominator = 0;
-	float dis_sum = 0;
-	for (int i = 0; i < length; ++i)
-	{
-		dst[i] = expf(src[i] - alpha);
-		denominator += dst[i];
-	}
-	for (int i = 0; i < length; ++i)
-	{
-		dst[i] /= denominator;
-		dis_sum += i * dst[i];
+		if (class_score < prob_threshold)
+			continue;
+
+		Object obj;
+		obj.rect.x = cx[i] - bw[i] * 0.5f;
+		obj.rect.y = cy[i] - bh[i] * 0.5f;
+		obj.rect.width = bw[i];
+		obj.rect.height = bh[i];
+		obj.label = class_index;
+		obj.prob = class_score;
+		objects.push_back(obj);
 	}
-	return dis_sum;
 }
 
-static void generate_proposals(
-	const ncnn::Mat& feat_blob,
-	const float prob_threshold,
-	std::vector<Object>& objects
-)
+static float intersection_area(const Object& a, const Object& b)
 {
-    const int stride = 32; //8, 16 or 32
-	const int reg_max = 16;
-	float dst[16];
-	const int num_w = feat_blob.w;
-	const int num_grid_y = feat_blob.c;
-	const int num_grid_x = feat_blob.h;
+	float x0 = std::max(a.rect.x, b.rect.x);
+	float y0 = std::max(a.rect.y, b.rect.y);
+	float x1 = std::min(a.rect.x + a.rect.width, b.rect.x + b.rect.width);
+	float y1 = std::min(a.rect.y + a.rect.height, b.rect.y + b.rect.height);
+	if (x1 <= x0 || y1 <= y0)
+		return 0.f;
+	return (x1 - x0) * (y1 - y0);
+}
 
-	const int num_class = num_w - 4 * reg_max;
+static void nms_sorted_bboxes(
+	std::vector<Object>& objects,
+	const float nms_threshold
+)
+{
+	std::sort(objects.begin(), objects.end(),
+		  [](const Object& a, const Object& b) { return a.prob > b.prob; });
 
-	for (int i = 0; i < num_grid_y; i++)
+	std::vector<Object> picked;
+	for (const Object& obj : objects)
 	{
-		for (int j = 0; j < num_grid_x; j++)
+		bool keep = true;
+		for (const Object& kept : picked)
 		{
+			if (kept.label != obj.label)
+				continue;
 
-			const float* matat = feat_blob.channel(i).row(j);
-
-			int class_index = 0;
-			float class_score = -FLT_MAX;
-			for (int c = 0; c < num_class; c++)
-			{
-				float score = matat[4 * reg_max + c];
-				if (score > class_score)
-				{
-					class_index = c;
-					class_score = score;
-				}
-			}
-
-			if (class_score >= prob_threshold)
+			float inter = intersection_area(obj, kept);
+			float uni = obj.rect.area() + kept.rect.area() - inter;
+			if (uni > 0 && inter / uni > nms_threshold)
 			{
-
-				float x0 = j + 0.5f - softmax(matat, dst, 16);
-				float y0 = i + 0.5f - softmax(matat + 16, dst, 16);
-				float x1 = j + 0.5f + softmax(matat + 2 * 16, dst, 16);
-				float y1 = i + 0.5f + softmax(matat + 3 * 16, dst, 16);
-
-				x0 *= stride;
-				y0 *= stride;
-				x1 *= stride;
-				y1 *= stride;
-
-				Object obj;
-				obj.rect.x = x0;
-				obj.rect.y = y0;
-				obj.rect.width = x1 - x0;
-				obj.rect.height = y1 - y0;
-				obj.label = class_index;
-				obj.prob = class_score;
-				objects.push_back(obj);
-
+				keep = false;
+				break;
 			}
 		}
+		if (keep)
+			picked.push_back(obj);
 	}
-}
-
-void perform_inference(const cv::Mat& bgr) {
-    // Load NCNN model
-    ncnn::Net net;
-    net.opt.use_vulkan_compute = true;
-
-    if (net.load_param("code/yolo11n_ncnn_model/model.ncnn.param") != 0) {
-        std::cerr << "Failed to load param" << std::endl;
-        return;
-    }
-    if (net.load_model("code/yolo11n_ncnn_model/model.ncnn.bin") != 0) {
-        std::cerr << "Failed to load model" << std::endl;
-        return;
-    }
 
-    const int target_size = 640;
-	const float prob_threshold = 0.25f;
-	const float nms_threshold = 0.45f;
+	objects.swap(picked);
+}
 
-    int img_w = bgr.cols;
-	int img_h = bgr.rows;
+bool valid_input_size(int size)
+{
+	return size >= MAX_STRIDE && size <= MAX_INPUT_SIZE && size % MAX_STRIDE == 0;
+}
 
-	// letterbox pad to multiple of MAX_STRIDE
-	int w = img_w;
-	int h = img_h;
-	float scale = 1.f;
+static void scaled_size(int size, int img_w, int img_h, int &w, int &h, float &scale)
+{
+	w = img_w;
+	h = img_h;
 	if (w > h)
 	{
-		scale = (float)target_size / w;
-		w = target_size;
+		scale = (float)size / w;
+		w = size;
 		h = h * scale;
 	}
 	else
 	{
-		scale = (float)target_size / h;
-		h = target_size;
+		scale = (float)size / h;
+		h = size;
 		w = w * scale;
 	}
+}
 
-	ncnn::Mat in = ncnn::Mat::from_pixels_resize(bgr.data, ncnn::Mat::PIXEL_BGR2RGB, img_w, img_h, w, h);
+/*
+ * The model is a fixed-shape export, so every image is padded to the full
+ * square whatever its aspect ratio. The input size must be the exported
+ * one, see Detector::input_size().
+ */
+cv::Size letterbox_shape(int size, int img_w, int img_h)
+{
+	(void)img_w;
+	(void)img_h;
+	return cv::Size(size, size);
+}
 
-    // pad to target_size rectangle
+Detector::Detector()
+	: loaded_(false), input_index_(-1), output_index_(-1), input_size_(0),
+	  helperRunning_(false)
+{
+}
+
+Detector::~Detector()
+{
+	{
+		std::unique_lock<std::mutex> locker(helperLock_);
+		helperRunning_ = false;
+	}
+	helperCond_.notify_all();
+	if (helper_.joinable())
+		helper_.join();
+
+	net_.clear();
+}
+
+/*
+ * Also called after a failed load, which can leave the network with a
+ * param but no weights, so the network is cleared even when not loaded.
+ */
+void Detector::unload()
+{
+	loaded_ = false;
+	net_.clear();
+	blob_allocator_.clear();
+	workspace_allocator_.clear();
+	bundle_.reset();
+	input_index_ = -1;
+	output_index_ = -1;
+	input_size_ = 0;
+
+	std::unique_lock<std::mutex> locker(preparedLock_);
+	prepared_.clear();
+}
+
+int Detector::load(const std::string &param_path, const std::string &bin_path)
+{
+	unload();
+
+	net_.opt.use_vulkan_compute = true;
+
+	if (net_.load_param(param_path.c_str()) != 0) {
+		std::cerr << "Failed to load param" << std::endl;
+		unload();
+		return -1;
+	}
+	if (net_.load_model(bin_path.c_str()) != 0) {
+		std::cerr << "Failed to load model" << std::endl;
+		unload();
+		return -1;
+	}
+
+	input_size_ = param_input_size(param_path);
+	if (input_size_ < 0) {
+		std::cerr << "Failed to read the input size from " << param_path << std::endl;
+		unload();
+		return -1;
+	}
+
+	loaded_ = true;
+	return 0;
+}
+
+int Detector::load(std::shared_ptr<const ModelBundle> bundle)
+{
+	unload();
+
+	if (!bundle)
+		return -1;
+
+	net_.opt.use_vulkan_compute = true;
+
+	/* Both loaders return the number of bytes consumed. */
+	if (net_.load_param(bundle->param()) != (int)bundle->paramSize()) {
+		std::cerr << "Failed to load param from " << bundle->source() << std::endl;
+		unload();
+		return -1;
+	}
+	if (net_.load_model(bundle->weights()) <= 0) {
+		std::cerr << "Failed to load model from " << bundle->source() << std::endl;
+		unload();
+		return -1;
+	}
+
+	bundle_ = bundle;
+	input_index_ = bundle->inputIndex();
+	output_index_ = bundle->outputIndex();
+	input_size_ = bundle->inputSize();
+	loaded_ = true;
+	return 0;
+}
+
+void Detector::preprocess(const cv::Mat &bgr, int size, DetectorInput &input)
+{
+	PerfScope perf(PerfStage::Preprocess);
+
+	int img_w = bgr.cols;
+	int img_h = bgr.rows;
+
+	// letterbox pad to a size x size square
+	int w, h;
+	float scale;
+	scaled_size(size, img_w, img_h, w, h, scale);
+
+	ncnn::Mat in = ncnn::Mat::from_pixels_resize(bgr.data, ncnn::Mat::PIXEL_BGR2RGB,
+						     img_w, img_h, (int)bgr.step, w, h,
+						     &blob_allocator_);
+
+	// pad to target_size square
 	// ultralytics/yolo/data/dataloaders/v5augmentations.py letterbox
-	int wpad = (w + MAX_STRIDE - 1) / MAX_STRIDE * MAX_STRIDE - w;
-	int hpad = (h + MAX_STRIDE - 1) / MAX_STRIDE * MAX_STRIDE - h;
+	int wpad = size - w;
+	int hpad = size - h;
 
 	int top = hpad / 2;
 	int bottom = hpad - hpad / 2;
 	int left = wpad / 2;
 	int right = wpad - wpad / 2;
 
-	ncnn::Mat in_pad;
+	ncnn::Option opt = net_.opt;
+	opt.blob_allocator = &blob_allocator_;
 	ncnn::copy_make_border(in,
-		in_pad,
+		input.in,
 		top,
 		bottom,
 		left,
 		right,
 		ncnn::BORDER_CONSTANT,
-		114.f);
-
-    // Normalization values
-    const float norm_vals[3] = { 1 / 255.f, 1 / 255.f, 1 / 255.f };
-	in_pad.substract_mean_normalize(0, norm_vals);
-
-    ncnn::Extractor ex = net.create_extractor();
-    
-    ex.input("in0", in_pad);
-
-    ncnn::Mat out;
-
-    ex.extract("out0", out);
-    
-    std::vector<Object> objects;
-    
-    generate_proposals(out, prob_threshold, objects);
-
-    static const char* class_names[] = {
-		"person", "bicycle", "car", "motorcycle", "airplane", "bus", "train", "truck", "boat", "traffic light",
-		"fire hydrant", "stop sign", "parking meter", "bench", "bird", "cat", "dog", "horse", "sheep", "cow",
-		"elephant", "bear", "zebra", "giraffe", "backpack", "umbrella", "handbag", "tie", "suitcase", "frisbee",
-		"skis", "snowboard", "sports ball", "kite", "baseball bat", "baseball glove", "skateboard", "surfboard",
-		"tennis racket", "bottle", "wine glass", "cup", "fork", "knife", "spoon", "bowl", "banana", "apple",
-		"sandwich", "orange", "broccoli", "carrot", "hot dog", "pizza", "donut", "cake", "chair", "couch",
-		"potted plant", "bed", "dining table", "toilet", "tv", "laptop", "mouse", "remote", "keyboard", "cell phone",
-		"microwave", "oven", "toaster", "sink", "refrigerator", "book", "clock", "vase", "scissors", "teddy bear",
-		"hair drier", "toothbrush"
-	};
-    for (size_t i = 0; i < objects.size(); i++)
+		114.f,
+		opt);
+
+	const float norm_vals[3] = { 1 / 255.f, 1 / 255.f, 1 / 255.f };
+	input.in.substract_mean_normalize(0, norm_vals);
+
+	input.img_w = img_w;
+	input.img_h = img_h;
+	input.scale = scale;
+	input.left = left;
+	input.top = top;
+}
+
+int Detector::forward(const ncnn::Mat &in, ncnn::Mat &out)
+{
+	PerfScope perf(PerfStage::Forward);
+
+	ncnn::Extractor ex = net_.create_extractor();
+	ex.set_blob_allocator(&blob_allocator_);
+	ex.set_workspace_allocator(&workspace_allocator_);
+
+	const int threads = num_threads;
+	if (threads > 0)
+		ex.set_num_threads(threads);
+
+	if (input_index_ >= 0) {
+		ex.input(input_index_, in);
+		return ex.extract(output_index_, out);
+	}
+
+	ex.input("in0", in);
+	return ex.extract("out0", out);
+}
+
+int Detector::infer(const DetectorInput &input, std::vector<Object> &objects)
+{
+	objects.clear();
+
+	ncnn::Mat out;
+	int ret = forward(input.in, out);
+	if (ret != 0 || out.empty()) {
+		std::cerr << "Inference failed on " << input.in.w << "x" << input.in.h
+			  << " input: " << ret << std::endl;
+		return -1;
+	}
+
+	{
+		PerfScope perf(PerfStage::Proposals);
+		generate_proposals(out, prob_threshold, objects);
+		nms_sorted_bboxes(objects, nms_threshold);
+	}
+
+	// map letterboxed coordinates back onto the source image
+	for (Object &obj : objects)
+	{
+		float x0 = (obj.rect.x - input.left) / input.scale;
+		float y0 = (obj.rect.y - input.top) / input.scale;
+		float x1 = (obj.rect.x + obj.rect.width - input.left) / input.scale;
+		float y1 = (obj.rect.y + obj.rect.height - input.top) / input.scale;
+
+		x0 = std::max(std::min(x0, (float)(input.img_w - 1)), 0.f);
+		y0 = std::max(std::min(y0, (float)(input.img_h - 1)), 0.f);
+		x1 = std::max(std::min(x1, (float)(input.img_w - 1)), 0.f);
+		y1 = std::max(std::min(y1, (float)(input.img_h - 1)), 0.f);
+
+		obj.rect.x = x0;
+		obj.rect.y = y0;
+		obj.rect.width = x1 - x0;
+		obj.rect.height = y1 - y0;
+	}
+
+	return 0;
+}
+
+std::vector<Object> Detector::detect(const cv::Mat &bgr)
+{
+	std::vector<Object> objects;
+	if (!loaded_)
+		return objects;
+
+	DetectorInput input;
+	preprocess(bgr, target_size, input);
+	infer(input, objects);
+
+	return objects;
+}
+
+std::future<void> Detector::submitHelper(std::function<void()> task)
+{
+	std::packaged_task<void()> packaged(std::move(task));
+	std::future<void> done = packaged.get_future();
+
+	{
+		std::unique_lock<std::mutex> locker(helperLock_);
+		if (!helperRunning_) {
+			helperRunning_ = true;
+			helper_ = std::thread(&Detector::runHelper, this);
+		}
+		helperTasks_.push_back(std::move(packaged));
+	}
+	helperCond_.notify_one();
+
+	return done;
+}
+
+void Detector::runHelper()
+{
+	std::unique_lock<std::mutex> locker(helperLock_);
+	while (true) {
+		helperCond_.wait(locker, [this]() { return !helperRunning_ || !helperTasks_.empty(); });
+		if (helperTasks_.empty())
+			break;
+
+		std::packaged_task<void()> task = std::move(helperTasks_.front());
+		helperTasks_.pop_front();
+
+		locker.unlock();
+		task();
+		locker.lock();
+	}
+}
+
+std::vector<std::vector<Object>> Detector::detect_batch(const std::vector<cv::Mat> &images)
+{
+	std::vector<std::vector<Object>> results(images.size());
+	if (!loaded_ || images.empty())
+		return results;
+
+	/*
+	 * Two input slots: one being inferred, one being filled by the
+	 * helper thread for the next item.
+	 */
+	DetectorInput staged[2];
+	const int size = target_size;
+
+	std::future<void> pending = submitHelper(
+		[this, &images, &staged, size]() { preprocess(images[0], size, staged[0]); });
+
+	for (size_t k = 0; k < images.size(); k++) {
+		pending.get();
+
+		if (k + 1 < images.size())
+			pending = submitHelper([this, &images, &staged, k, size]() {
+				preprocess(images[k + 1], size, staged[(k + 1) % 2]);
+			});
+
+		infer(staged[k % 2], results[k]);
+	}
+
+	return results;
+}
+
+double Detector::prepare(int size, int img_w, int img_h)
+{
+	if (!loaded_ || size != input_size_ || img_w <= 0 || img_h <= 0)
+		return -1;
+
+	cv::Size shape = letterbox_shape(size, img_w, img_h);
+
+	/*
+	 * A blank image already at the scaled size letterboxes to the same
+	 * network input shape without resizing a full sensor frame.
+	 */
+	int w, h;
+	float scale;
+	scaled_size(size, img_w, img_h, w, h, scale);
+	cv::Mat blank(h, w, CV_8UC3, cv::Scalar(114, 114, 114));
+
+	auto start = std::chrono::steady_clock::now();
+
+	DetectorInput input;
+	std::vector<Object> objects;
+	preprocess(blank, size, input);
+	if (infer(input, objects))
+		return -1;
+
+	std::chrono::duration<double, std::milli> elapsed =
+		std::chrono::steady_clock::now() - start;
+
+	std::unique_lock<std::mutex> locker(preparedLock_);
+	prepared_.insert({ shape.width, shape.height });
+
+	return elapsed.count();
+}
+
+bool Detector::prepared(int size, int img_w, int img_h) const
+{
+	cv::Size shape = letterbox_shape(size, img_w, img_h);
+
+	std::unique_lock<std::mutex> locker(preparedLock_);
+	return prepared_.count({ shape.width, shape.height }) != 0;
+}
+
+void Detector::bind_thread(const std::vector<int> &cpus)
+{
+	if (cpus.empty())
+		return;
+
+	ncnn::CpuSet mask;
+	mask.disable_all();
+	for (int cpu : cpus)
+		mask.enable(cpu);
+
+	/*
+	 * Powersave 0 selects all cores, so that the explicit mask is not
+	 * narrowed further to the big or little cluster.
+	 */
+	ncnn::set_cpu_powersave(0);
+	ncnn::set_cpu_thread_affinity(mask);
+}
+
+void print_objects(const std::vector<Object> &objects)
+{
+	for (const Object& obj : objects)
 	{
-		const Object& obj = objects[i];
-        //TODO: avoid accessing class_names[obj.label] without checking size to avoid out of bound errors
-        char text[256];
-		sprintf(text, "%s %.1f%%", class_names[obj.label], obj.prob * 100);
-		fprintf(stderr, "%s = %.5f at %.2f %.2f %.2f x %.2f\n", class_names[obj.label], obj.prob,
+		fprintf(stderr, "%s = %.5f at %.2f %.2f %.2f x %.2f\n", class_name(obj.label), obj.prob,
 			obj.rect.x, obj.rect.y, obj.rect.width, obj.rect.height);
-    }
+	}
+}
+
+void perform_inference(const cv::Mat& bgr, int target_size) {
+	static Detector detector;
+
+	if (valid_input_size(target_size))
+		detector.target_size = target_size;
+
+	if (!detector.loaded() &&
+	    detector.load("code/yolo11n_ncnn_model/model.ncnn.param",
+			  "code/yolo11n_ncnn_model/model.ncnn.bin") != 0)
+		return;
+
+	print_objects(detector.detect(bgr));
 }
@@ -1,25 +1,161 @@
 #ifndef NCNN_INFERENCE_H
 #define NCNN_INFERENCE_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 #include <opencv4/opencv2/opencv.hpp>
 
-// Placeholder image structure (replace with a proper definition if using OpenCV or similar)
-//struct Image {
-//    std::vector<unsigned char> pixels;
-//    int width;
-//    int height;
-//};
-// We don't need the Image struct anymore as we are passing the raw buffer
+#include "net.h" // NCNN
+
+#include "class_names.h"
+#include "model_bundle.h"
 
 struct Object
 {
 	cv::Rect_<float> rect;
 	int label;
 	float prob;
+	/* Filled in by the classifier cascade, -1 when not run. */
+	int track = -1;
+	int attribute = -1;
+	float attributeProb = 0.f;
+};
+
+/*
+ * Letterboxed network input for one image, together with the transform
+ * needed to map detections back onto the source image.
+ */
+struct DetectorInput
+{
+	ncnn::Mat in;
+	int img_w = 0;
+	int img_h = 0;
+	float scale = 1.f;
+	int left = 0;
+	int top = 0;
+};
+
+/*
+ * YOLO11 detector. The model is loaded once and every call reuses the same
+ * network and pool allocators. detect() and detect_batch() only read the
+ * network, so one Detector can be shared between threads.
+ */
+class Detector
+{
+public:
+	Detector();
+	~Detector();
+
+	/*
+	 * Load or replace the model, from a text param and weights or from a
+	 * binary bundle whose weights are referenced in place. Not safe while
+	 * detecting.
+	 */
+	int load(const std::string &param_path, const std::string &bin_path);
+	int load(std::shared_ptr<const ModelBundle> bundle);
+	bool loaded() const { return loaded_; }
+
+	/* Side of the square input the loaded model was exported for. */
+	int input_size() const { return input_size_; }
+
+	std::vector<Object> detect(const cv::Mat &bgr);
+
+	/*
+	 * Run every image through the network back to back. Letterboxing of
+	 * item k+1 runs on a helper thread, started with the first batch and
+	 * kept for the life of the Detector, while item k is being inferred.
+	 * The result vector has one entry per input image, in input order.
+	 */
+	std::vector<std::vector<Object>> detect_batch(const std::vector<cv::Mat> &images);
+
+	/*
+	 * Run one blank inference at the letterboxed shape used for img_w x
+	 * img_h images at input size `size`, so that the first real frame at
+	 * that shape does not pay for growing the allocator pools. Returns
+	 * the warm-up time in milliseconds, or -1 if the size is not the one
+	 * the model was exported for or the network rejects the input.
+	 */
+	double prepare(int size, int img_w, int img_h);
+	bool prepared(int size, int img_w, int img_h) const;
+
+	/*
+	 * Confine the ncnn OpenMP threads serving the calling thread to the
+	 * given cores, using every core type. Called once by each thread that
+	 * detects, an empty list keeps the ncnn default placement.
+	 */
+	static void bind_thread(const std::vector<int> &cpus);
+
+	/*
+	 * Letterbox an image into network input at input size `size`. Part of
+	 * detect(), public so the stage can be timed on its own.
+	 */
+	void preprocess(const cv::Mat &bgr, int size, DetectorInput &input);
+
+	/*
+	 * Run the network on a prepared input, returning the raw out0 tensor
+	 * before proposal decoding and NMS. Returns 0 on success.
+	 */
+	int forward(const ncnn::Mat &in, ncnn::Mat &out);
+
+	/*
+	 * Input size, thresholds and ncnn thread count may be changed while
+	 * other threads are detecting, each call picks up the values current
+	 * when it starts. A thread count of zero keeps the network default.
+	 */
+	std::atomic<int> target_size{640};
+	std::atomic<int> num_threads{0};
+	std::atomic<float> prob_threshold{0.25f};
+	std::atomic<float> nms_threshold{0.45f};
+
+private:
+	int infer(const DetectorInput &input, std::vector<Object> &objects);
+	void unload();
+
+	std::future<void> submitHelper(std::function<void()> task);
+	void runHelper();
+
+	ncnn::Net net_;
+	ncnn::PoolAllocator blob_allocator_;
+	ncnn::PoolAllocator workspace_allocator_;
+	bool loaded_;
+
+	/* Bundle backing the weights, and its blob indices, -1 for names. */
+	std::shared_ptr<const ModelBundle> bundle_;
+	int input_index_;
+	int output_index_;
+	int input_size_;
+
+	std::set<std::pair<int, int>> prepared_;
+	mutable std::mutex preparedLock_;
+
+	/* Preprocessing helper of detect_batch(), shared by all callers. */
+	std::thread helper_;
+	std::deque<std::packaged_task<void()>> helperTasks_;
+	std::mutex helperLock_;
+	std::condition_variable helperCond_;
+	bool helperRunning_;
 };
 
-void perform_inference(const cv::Mat& bgr);
+/*
+ * Input sizes are the side of the square letterboxed network input and
+ * must be a multiple of the network stride. The image is scaled so that
+ * its longest side fits and the rest of the square is padded.
+ */
+bool valid_input_size(int size);
+cv::Size letterbox_shape(int size, int img_w, int img_h);
+
+void print_objects(const std::vector<Object> &objects);
+
+void perform_inference(const cv::Mat& bgr, int target_size = 640);
 
 #endif
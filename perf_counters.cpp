@@ -0,0 +1,245 @@
+/*
+ * perf_counters.cpp - Hardware performance counters per pipeline stage
+ */
+
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+std::atomic<bool> perf_counters_active(false);
+
+static const struct {
+	const char *name;
+	uint64_t config;
+} perf_events[PerfEventCount] = {
+	{ "cycles", PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_COUNT_HW_INSTRUCTIONS },
+	{ "cache-references", PERF_COUNT_HW_CACHE_REFERENCES },
+	{ "cache-misses", PERF_COUNT_HW_CACHE_MISSES },
+	{ "branches", PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+	{ "branch-misses", PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static const char *stage_names[] = {
+	"preprocess",
+	"forward",
+	"proposals",
+	"classify",
+	"encode",
+};
+
+static_assert(sizeof(stage_names) / sizeof(stage_names[0]) ==
+	      static_cast<size_t>(PerfStage::Count), "a name for every stage");
+
+/* Totals per stage, the events scaled for multiplexing. */
+struct StageTotals
+{
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> events[PerfEventCount];
+};
+
+static StageTotals totals[static_cast<size_t>(PerfStage::Count)];
+
+/* Events the PMU provides, by the first thread to open a group. */
+static std::atomic<bool> event_supported[PerfEventCount];
+
+/*
+ * The counter group of one thread. The leader counts cycles; the other
+ * events are read with it in one read(), in the order they were opened.
+ */
+struct CounterGroup
+{
+	CounterGroup()
+		: opened(false), count(0)
+	{
+		for (int &fd : fds)
+			fd = -1;
+	}
+
+	~CounterGroup()
+	{
+		for (int fd : fds)
+			if (fd >= 0)
+				close(fd);
+	}
+
+	int open();
+
+	bool opened;
+	int fds[PerfEventCount];
+	/* Position in the group read of each event, -1 if not counted. */
+	int slot[PerfEventCount];
+	int count;
+};
+
+static int perf_event_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+int CounterGroup::open()
+{
+	opened = true;
+
+	for (int e = 0; e < PerfEventCount; e++) {
+		slot[e] = -1;
+		fds[e] = perf_event_open(perf_events[e].config, fds[PerfCycles]);
+		if (fds[e] < 0) {
+			if (e == PerfCycles)
+				return -1;
+			continue;
+		}
+		slot[e] = count++;
+	}
+
+	return 0;
+}
+
+static CounterGroup &thread_group()
+{
+	thread_local CounterGroup group;
+	if (!group.opened)
+		group.open();
+	return group;
+}
+
+/* Fill values with time enabled, time running, then each event. */
+static bool read_group(CounterGroup &group, uint64_t *values)
+{
+	uint64_t buffer[3 + PerfEventCount];
+	ssize_t length = (3 + group.count) * sizeof(uint64_t);
+	if (read(group.fds[PerfCycles], buffer, length) != length)
+		return false;
+
+	values[0] = buffer[1];
+	values[1] = buffer[2];
+	for (int e = 0; e < PerfEventCount; e++)
+		values[2 + e] = group.slot[e] >= 0 ? buffer[3 + group.slot[e]] : 0;
+	return true;
+}
+
+int perf_counters_enable()
+{
+	CounterGroup &group = thread_group();
+	if (group.fds[PerfCycles] < 0) {
+		int error = errno;
+		int paranoid = -1;
+		std::ifstream("/proc/sys/kernel/perf_event_paranoid") >> paranoid;
+		std::cerr << "Performance counters unavailable: " << strerror(error)
+			  << " (perf_event_paranoid " << paranoid << ")" << std::endl;
+		return -1;
+	}
+
+	std::string missing;
+	for (int e = 0; e < PerfEventCount; e++) {
+		event_supported[e] = group.slot[e] >= 0;
+		if (group.slot[e] < 0)
+			missing += std::string(" ") + perf_events[e].name;
+	}
+	if (!missing.empty())
+		std::cerr << "Performance counters not supported:" << missing << std::endl;
+
+	perf_counters_active = true;
+	return 0;
+}
+
+void perf_counters_reset()
+{
+	for (StageTotals &stage : totals) {
+		stage.calls = 0;
+		for (std::atomic<uint64_t> &event : stage.events)
+			event = 0;
+	}
+}
+
+bool PerfScope::begin()
+{
+	CounterGroup &group = thread_group();
+	return group.fds[PerfCycles] >= 0 && read_group(group, start_);
+}
+
+void PerfScope::end()
+{
+	uint64_t now[PerfEventCount + 2];
+	if (!read_group(thread_group(), now))
+		return;
+
+	/* Scale for the time the group was multiplexed off the PMU. */
+	uint64_t enabled = now[0] - start_[0];
+	uint64_t running = now[1] - start_[1];
+	double scale = running ? static_cast<double>(enabled) / running : 1;
+
+	StageTotals &stage = totals[static_cast<size_t>(stage_)];
+	stage.calls.fetch_add(1, std::memory_order_relaxed);
+	for (int e = 0; e < PerfEventCount; e++)
+		stage.events[e].fetch_add((now[2 + e] - start_[2 + e]) * scale,
+					  std::memory_order_relaxed);
+}
+
+static void print_ratio(std::ostream &out, bool available, double numerator,
+			double denominator, double factor)
+{
+	char text[16];
+	if (available && denominator > 0)
+		snprintf(text, sizeof(text), "%9.2f", factor * numerator / denominator);
+	else
+		snprintf(text, sizeof(text), "%9s", "n/a");
+	out << text;
+}
+
+void perf_counters_report(std::ostream &out)
+{
+	if (!perf_counters_active)
+		return;
+
+	out << "stage           calls   Mcycles   Minstr       IPC  cache miss%  miss/kinstr  branch miss%"
+	    << std::endl;
+
+	for (size_t s = 0; s < static_cast<size_t>(PerfStage::Count); s++) {
+		const StageTotals &stage = totals[s];
+		if (!stage.calls)
+			continue;
+
+		double events[PerfEventCount];
+		for (int e = 0; e < PerfEventCount; e++)
+			events[e] = stage.events[e];
+
+		char text[64];
+		snprintf(text, sizeof(text), "%-12s %8llu %9.1f %8.1f ", stage_names[s],
+			 static_cast<unsigned long long>(stage.calls.load()),
+			 events[PerfCycles] / 1e6, events[PerfInstructions] / 1e6);
+		out << text;
+
+		bool instructions = event_supported[PerfInstructions];
+		print_ratio(out, instructions, events[PerfInstructions], events[PerfCycles], 1);
+		out << "    ";
+		print_ratio(out, event_supported[PerfCacheReferences] && event_supported[PerfCacheMisses],
+			    events[PerfCacheMisses], events[PerfCacheReferences], 100);
+		out << "    ";
+		print_ratio(out, instructions && event_supported[PerfCacheMisses],
+			    events[PerfCacheMisses], events[PerfInstructions], 1000);
+		out << "     ";
+		print_ratio(out, event_supported[PerfBranches] && event_supported[PerfBranchMisses],
+			    events[PerfBranchMisses], events[PerfBranches], 100);
+		out << std::endl;
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ * perf_counters.h - Hardware performance counters per pipeline stage
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+enum class PerfStage {
+	Preprocess,
+	Forward,
+	Proposals,
+	Classify,
+	Encode,
+	Count,
+};
+
+enum PerfEvent {
+	PerfCycles,
+	PerfInstructions,
+	PerfCacheReferences,
+	PerfCacheMisses,
+	PerfBranches,
+	PerfBranchMisses,
+	PerfEventCount,
+};
+
+extern std::atomic<bool> perf_counters_active;
+
+/*
+ * Start counting, off by default. Every thread entering a PerfScope opens
+ * its own counter group through perf_event_open(), user space only, so a
+ * perf_event_paranoid of 2 is enough. Returns -1, and stays off, where the
+ * kernel or container gives no counters. Events the PMU lacks are left
+ * out of the report rather than failing the rest.
+ */
+int perf_counters_enable();
+void perf_counters_reset();
+
+/*
+ * Per stage: calls, cycles, instructions, IPC, cache and branch miss rates
+ * and cache misses per thousand instructions. Counts cover the thread
+ * running the stage only, not ncnn's OpenMP helpers; run inference with a
+ * single ncnn thread for a complete picture of the forward pass.
+ */
+void perf_counters_report(std::ostream &out);
+
+/*
+ * Counts the events of the calling thread from construction to
+ * destruction into `stage`. When counting is off, costs one relaxed load.
+ */
+class PerfScope
+{
+public:
+	explicit PerfScope(PerfStage stage)
+		: stage_(stage),
+		  active_(perf_counters_active.load(std::memory_order_relaxed) && begin())
+	{
+	}
+
+	~PerfScope()
+	{
+		if (active_)
+			end();
+	}
+
+private:
+	bool begin();
+	void end();
+
+	PerfStage stage_;
+	bool active_;
+	uint64_t start_[PerfEventCount + 2];
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * preview_server.cpp - MJPEG-over-HTTP preview for on-site debugging
+ */
+
+#include "preview_server.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <arpa/inet.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+#include <event2/listener.h>
+#include <netinet/in.h>
+
+#include "save_jpeg.h"
+
+#define PREVIEW_BOUNDARY "radariaframe"
+
+static const char stream_header[] =
+	"HTTP/1.0 200 OK\r\n"
+	"Cache-Control: no-cache\r\n"
+	"Connection: close\r\n"
+	"Content-Type: multipart/x-mixed-replace; boundary=" PREVIEW_BOUNDARY "\r\n"
+	"\r\n";
+
+static const char not_found[] =
+	"HTTP/1.0 404 Not Found\r\n"
+	"Connection: close\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+PreviewServer::PreviewServer(EventLoop &loop)
+	: loop_(loop), listener_(nullptr), streaming_(0), width_(640),
+	  quality_(70), overlay_(true), interval_(std::chrono::milliseconds(200)),
+	  encoded_(0), sent_(0), dropped_(0)
+{
+}
+
+PreviewServer::~PreviewServer()
+{
+	for (std::unique_ptr<Client> &client : clients_)
+		bufferevent_free(client->bev);
+	clients_.clear();
+
+	if (listener_)
+		evconnlistener_free(listener_);
+}
+
+void PreviewServer::setMaxFps(double fps)
+{
+	interval_ = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(fps > 0 ? 1.0 / fps : 0));
+}
+
+int PreviewServer::listen(const std::string &address, uint16_t port)
+{
+	struct sockaddr_in sin = {};
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(port);
+	if (inet_pton(AF_INET, address.c_str(), &sin.sin_addr) != 1) {
+		std::cerr << "Invalid preview address " << address << std::endl;
+		return -1;
+	}
+
+	listener_ = evconnlistener_new_bind(loop_.base(), &PreviewServer::acceptCallback,
+					    this, LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE,
+					    -1, reinterpret_cast<struct sockaddr *>(&sin),
+					    sizeof(sin));
+	if (!listener_) {
+		std::cerr << "Failed to listen on " << address << ":" << port
+			  << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	std::cout << "Preview on http://" << address << ":" << this->port() << "/" << std::endl;
+	return 0;
+}
+
+uint16_t PreviewServer::port() const
+{
+	struct sockaddr_in sin = {};
+	socklen_t len = sizeof(sin);
+	if (!listener_ ||
+	    getsockname(evconnlistener_get_fd(listener_),
+			reinterpret_cast<struct sockaddr *>(&sin), &len) < 0)
+		return 0;
+	return ntohs(sin.sin_port);
+}
+
+void PreviewServer::acceptCallback(struct evconnlistener *listener,
+				   evutil_socket_t fd, struct sockaddr *addr,
+				   int len, void *arg)
+{
+	PreviewServer *self = static_cast<PreviewServer *>(arg);
+
+	struct bufferevent *bev = bufferevent_socket_new(self->loop_.base(), fd,
+							 BEV_OPT_CLOSE_ON_FREE);
+	if (!bev) {
+		evutil_closesocket(fd);
+		return;
+	}
+
+	self->clients_.push_back(std::make_unique<Client>());
+	Client *client = self->clients_.back().get();
+	client->server = self;
+	client->bev = bev;
+	client->streaming = false;
+
+	bufferevent_setcb(bev, &PreviewServer::readCallback, nullptr,
+			  &PreviewServer::eventCallback, client);
+	bufferevent_enable(bev, EV_READ | EV_WRITE);
+}
+
+/*
+ * Wait for the end of the request headers, then answer GET / with the
+ * stream. Anything sent after that is ignored.
+ */
+void PreviewServer::readCallback(struct bufferevent *bev, void *arg)
+{
+	Client *client = static_cast<Client *>(arg);
+	struct evbuffer *input = bufferevent_get_input(bev);
+
+	if (client->streaming) {
+		evbuffer_drain(input, evbuffer_get_length(input));
+		return;
+	}
+
+	struct evbuffer_ptr end = evbuffer_search(input, "\r\n\r\n", 4, nullptr);
+	if (end.pos < 0)
+		return;
+
+	size_t length;
+	char *line = evbuffer_readln(input, &length, EVBUFFER_EOL_CRLF);
+	bool stream = line && (!strncmp(line, "GET / ", 6) ||
+			       !strncmp(line, "GET /stream ", 12));
+	free(line);
+	evbuffer_drain(input, evbuffer_get_length(input));
+
+	if (!stream) {
+		bufferevent_write(bev, not_found, sizeof(not_found) - 1);
+		bufferevent_disable(bev, EV_READ);
+		bufferevent_setcb(bev, nullptr, [](struct bufferevent *bev, void *arg) {
+			Client *client = static_cast<Client *>(arg);
+			client->server->removeClient(client);
+		}, &PreviewServer::eventCallback, client);
+		return;
+	}
+
+	bufferevent_write(bev, stream_header, sizeof(stream_header) - 1);
+	client->streaming = true;
+	client->server->streaming_++;
+}
+
+void PreviewServer::eventCallback(struct bufferevent *bev, short events, void *arg)
+{
+	Client *client = static_cast<Client *>(arg);
+
+	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+		client->server->removeClient(client);
+}
+
+void PreviewServer::removeClient(Client *client)
+{
+	if (client->streaming)
+		streaming_--;
+
+	bufferevent_free(client->bev);
+	clients_.remove_if([client](const std::unique_ptr<Client> &c) {
+		return c.get() == client;
+	});
+}
+
+void PreviewServer::submit(const Frame &frame, const std::vector<Object> &objects)
+{
+	if (!streaming_)
+		return;
+
+	/* Another worker is already encoding, this frame is not needed. */
+	std::unique_lock<std::mutex> locker(encodeLock_, std::try_to_lock);
+	if (!locker.owns_lock())
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	if (now - lastEncode_ < interval_)
+		return;
+	lastEncode_ = now;
+
+	const cv::Mat &image = frame.image;
+	int width = std::min(width_, image.cols);
+	int height = image.rows * width / image.cols;
+	float scale = (float)width / image.cols;
+
+	cv::Mat preview;
+	cv::resize(image, preview, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+
+	if (overlay_) {
+		for (const Object &obj : objects) {
+			cv::Rect box(obj.rect.x * scale, obj.rect.y * scale,
+				     obj.rect.width * scale, obj.rect.height * scale);
+			cv::rectangle(preview, box, cv::Scalar(0, 255, 0), 2);
+			cv::putText(preview, class_name(obj.label),
+				    cv::Point(box.x, std::max(box.y - 4, 10)),
+				    cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(0, 255, 0));
+		}
+	}
+
+	auto jpeg = std::make_shared<std::vector<unsigned char>>();
+	if (!encode_jpeg(preview, quality_, *jpeg))
+		return;
+	encoded_++;
+
+	Buffer buffer = jpeg;
+	loop_.callLater([this, buffer]() { broadcast(buffer); });
+}
+
+static void release_buffer(const void *, size_t, void *arg)
+{
+	delete static_cast<std::shared_ptr<const std::vector<unsigned char>> *>(arg);
+}
+
+void PreviewServer::broadcast(const Buffer &jpeg)
+{
+	char header[128];
+	int headerLength = snprintf(header, sizeof(header),
+				    "--" PREVIEW_BOUNDARY "\r\n"
+				    "Content-Type: image/jpeg\r\n"
+				    "Content-Length: %zu\r\n\r\n", jpeg->size());
+
+	for (std::unique_ptr<Client> &client : clients_) {
+		if (!client->streaming)
+			continue;
+
+		struct evbuffer *output = bufferevent_get_output(client->bev);
+		if (evbuffer_get_length(output)) {
+			dropped_++;
+			continue;
+		}
+
+		evbuffer_add(output, header, headerLength);
+		evbuffer_add_reference(output, jpeg->data(), jpeg->size(),
+				       &release_buffer, new Buffer(jpeg));
+		evbuffer_add(output, "\r\n", 2);
+		sent_++;
+	}
+}
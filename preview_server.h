@@ -0,0 +1,90 @@
+/*
+ * preview_server.h - MJPEG-over-HTTP preview for on-site debugging
+ */
+#ifndef PREVIEW_SERVER_H
+#define PREVIEW_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <event2/util.h>
+
+#include "event_loop.h"
+#include "frame_source.h"
+#include "ncnn_inference.h"
+
+struct bufferevent;
+struct evconnlistener;
+
+/*
+ * Serves a multipart/x-mixed-replace JPEG stream on a local port. Each
+ * preview frame is downscaled, optionally annotated with the detections and
+ * encoded once on the submitting thread; the encoded buffer is then shared
+ * by reference with every client's output buffer. A client that has not
+ * finished sending the previous frame skips the new one, so slow clients
+ * never hold up capture or the other clients.
+ *
+ * Sockets are handled on the EventLoop thread.
+ */
+class PreviewServer
+{
+public:
+	PreviewServer(EventLoop &loop);
+	~PreviewServer();
+
+	int listen(const std::string &address, uint16_t port);
+	uint16_t port() const;
+
+	void setWidth(int width) { width_ = width; }
+	void setQuality(int quality) { quality_ = quality; }
+	void setOverlay(bool overlay) { overlay_ = overlay; }
+	void setMaxFps(double fps);
+
+	/* Thread-safe. Cheap when no client is connected or throttled. */
+	void submit(const Frame &frame, const std::vector<Object> &objects);
+
+	uint64_t encoded() const { return encoded_; }
+	uint64_t sent() const { return sent_; }
+	uint64_t dropped() const { return dropped_; }
+
+private:
+	typedef std::shared_ptr<const std::vector<unsigned char>> Buffer;
+
+	struct Client {
+		PreviewServer *server;
+		struct bufferevent *bev;
+		bool streaming;
+	};
+
+	static void acceptCallback(struct evconnlistener *listener, evutil_socket_t fd,
+				   struct sockaddr *addr, int len, void *arg);
+	static void readCallback(struct bufferevent *bev, void *arg);
+	static void eventCallback(struct bufferevent *bev, short events, void *arg);
+
+	void broadcast(const Buffer &jpeg);
+	void removeClient(Client *client);
+
+	EventLoop &loop_;
+	struct evconnlistener *listener_;
+	std::list<std::unique_ptr<Client>> clients_;
+	std::atomic<unsigned int> streaming_;
+
+	int width_;
+	std::atomic<int> quality_;
+	bool overlay_;
+	std::chrono::steady_clock::duration interval_;
+	std::chrono::steady_clock::time_point lastEncode_;
+	std::mutex encodeLock_;
+
+	std::atomic<uint64_t> encoded_;
+	std::atomic<uint64_t> sent_;
+	std::atomic<uint64_t> dropped_;
+};
+
+#endif
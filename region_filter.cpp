@@ -0,0 +1,117 @@
+/*
+ * region_filter.cpp - Regions of interest and exclusion zones per source
+ */
+
+#include "region_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include <opencv4/opencv2/opencv.hpp>
+
+/* Resolution of the rasterised mask, in cells per axis. */
+#define REGION_MASK_SIZE 512
+
+/* Crops are aligned so that chroma subsampled views stay valid. */
+#define REGION_CROP_ALIGN 2
+
+RegionFilter::RegionFilter(const std::vector<Polygon> &include,
+			   const std::vector<Polygon> &exclude)
+	: include_(include), exclude_(exclude), bounds_(0, 0, 1, 1)
+{
+	auto rasterise = [](const std::vector<Polygon> &polygons) {
+		std::vector<std::vector<cv::Point>> points;
+		for (const Polygon &polygon : polygons) {
+			std::vector<cv::Point> scaled;
+			for (const cv::Point2f &p : polygon)
+				scaled.emplace_back(cvRound(p.x * REGION_MASK_SIZE),
+						    cvRound(p.y * REGION_MASK_SIZE));
+			points.push_back(scaled);
+		}
+		return points;
+	};
+
+	mask_ = cv::Mat(REGION_MASK_SIZE, REGION_MASK_SIZE, CV_8UC1,
+			cv::Scalar(include_.empty() ? 255 : 0));
+	if (!include_.empty())
+		cv::fillPoly(mask_, rasterise(include_), cv::Scalar(255));
+	if (!exclude_.empty())
+		cv::fillPoly(mask_, rasterise(exclude_), cv::Scalar(0));
+
+	if (include_.empty())
+		return;
+
+	float x0 = 1, y0 = 1, x1 = 0, y1 = 0;
+	for (const Polygon &polygon : include_) {
+		for (const cv::Point2f &p : polygon) {
+			x0 = std::min(x0, p.x);
+			y0 = std::min(y0, p.y);
+			x1 = std::max(x1, p.x);
+			y1 = std::max(y1, p.y);
+		}
+	}
+
+	x0 = std::max(x0, 0.f);
+	y0 = std::max(y0, 0.f);
+	x1 = std::min(x1, 1.f);
+	y1 = std::min(y1, 1.f);
+	if (x1 > x0 && y1 > y0)
+		bounds_ = cv::Rect2f(x0, y0, x1 - x0, y1 - y0);
+}
+
+cv::Rect RegionFilter::crop(const cv::Size &size) const
+{
+	int x0 = static_cast<int>(bounds_.x * size.width) / REGION_CROP_ALIGN * REGION_CROP_ALIGN;
+	int y0 = static_cast<int>(bounds_.y * size.height) / REGION_CROP_ALIGN * REGION_CROP_ALIGN;
+	int x1 = std::min(size.width,
+			  static_cast<int>(std::ceil((bounds_.x + bounds_.width) * size.width)));
+	int y1 = std::min(size.height,
+			  static_cast<int>(std::ceil((bounds_.y + bounds_.height) * size.height)));
+
+	return cv::Rect(x0, y0, std::max(x1 - x0, 1), std::max(y1 - y0, 1));
+}
+
+unsigned int RegionFilter::apply(const cv::Size &size, const cv::Rect &crop,
+				 std::vector<Object> &objects) const
+{
+	const float sx = static_cast<float>(REGION_MASK_SIZE) / size.width;
+	const float sy = static_cast<float>(REGION_MASK_SIZE) / size.height;
+	size_t kept = 0;
+
+	for (Object &obj : objects) {
+		obj.rect.x += crop.x;
+		obj.rect.y += crop.y;
+
+		int cx = static_cast<int>((obj.rect.x + obj.rect.width * 0.5f) * sx);
+		int cy = static_cast<int>((obj.rect.y + obj.rect.height * 0.5f) * sy);
+		cx = std::min(std::max(cx, 0), REGION_MASK_SIZE - 1);
+		cy = std::min(std::max(cy, 0), REGION_MASK_SIZE - 1);
+
+		if (mask_.at<unsigned char>(cy, cx))
+			objects[kept++] = obj;
+	}
+
+	unsigned int dropped = objects.size() - kept;
+	objects.resize(kept);
+	return dropped;
+}
+
+bool RegionFilter::parsePolygon(const std::string &text, Polygon &polygon)
+{
+	std::istringstream in(text);
+	std::string point;
+
+	polygon.clear();
+	while (in >> point) {
+		float x, y;
+		char comma;
+		std::istringstream coords(point);
+		if (!(coords >> x >> comma >> y) || comma != ',' ||
+		    x < 0 || x > 1 || y < 0 || y > 1)
+			return false;
+		polygon.emplace_back(x, y);
+	}
+
+	return polygon.size() >= 3;
+}
@@ -0,0 +1,56 @@
+/*
+ * region_filter.h - Regions of interest and exclusion zones per source
+ */
+#ifndef REGION_FILTER_H
+#define REGION_FILTER_H
+
+#include <string>
+#include <vector>
+
+#include <opencv4/opencv2/core.hpp>
+
+#include "ncnn_inference.h"
+
+/*
+ * Polygons are given in normalised image coordinates, 0 to 1 on both axes,
+ * so one configuration applies to any stream resolution.
+ *
+ * The detector only sees the bounding rectangle of the regions of interest,
+ * cropped out of the frame without copying, so its input pixels are spent
+ * on the part of the scene that matters. Detections are then kept only if
+ * their centre lies inside a region of interest and outside every
+ * exclusion zone. That test is a single lookup into a mask rasterised once
+ * at construction.
+ */
+class RegionFilter
+{
+public:
+	typedef std::vector<cv::Point2f> Polygon;
+
+	RegionFilter(const std::vector<Polygon> &include,
+		     const std::vector<Polygon> &exclude);
+
+	/* Area of a width x height frame handed to the detector. */
+	cv::Rect crop(const cv::Size &size) const;
+
+	/*
+	 * Move detections made on the crop back into frame coordinates and
+	 * drop those centred outside the allowed area. Returns the number of
+	 * detections dropped.
+	 */
+	unsigned int apply(const cv::Size &size, const cv::Rect &crop,
+			   std::vector<Object> &objects) const;
+
+	bool empty() const { return include_.empty() && exclude_.empty(); }
+
+	/* Parse "x,y x,y x,y ...", returns false on malformed input. */
+	static bool parsePolygon(const std::string &text, Polygon &polygon);
+
+private:
+	std::vector<Polygon> include_;
+	std::vector<Polygon> exclude_;
+	cv::Rect2f bounds_;
+	cv::Mat mask_;
+};
+
+#endif
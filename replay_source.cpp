@@ -0,0 +1,120 @@
+/*
+ * replay_source.cpp - FrameSource replaying still images from disk
+ */
+
+#include "replay_source.h"
+
+#include <iostream>
+
+#include <opencv4/opencv2/opencv.hpp>
+
+#include "thread_placement.h"
+
+ReplaySource::ReplaySource(const std::vector<std::string> &paths, double fps,
+			   unsigned int depth)
+	: paths_(paths), fps_(fps), depth_(depth), frameDuration_(0), running_(false),
+	  inFlight_(0), dropped_(0)
+{
+}
+
+ReplaySource::~ReplaySource()
+{
+	stop();
+}
+
+std::string ReplaySource::name() const
+{
+	std::string name = "Replay";
+	for (const std::string &path : paths_)
+		name += " " + path;
+	return name;
+}
+
+cv::Size ReplaySource::frameSize() const
+{
+	return images_.empty() ? cv::Size() : images_[0].size();
+}
+
+int ReplaySource::load()
+{
+	for (const std::string &path : paths_) {
+		cv::Mat decoded = cv::imread(path, cv::IMREAD_COLOR);
+		if (decoded.empty()) {
+			std::cerr << "Failed to read replay image " << path << std::endl;
+			return -1;
+		}
+
+		images_.push_back(decoded);
+	}
+
+	if (images_.empty()) {
+		std::cerr << "No images to replay" << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+int ReplaySource::start()
+{
+	if (images_.empty())
+		return -1;
+
+	running_ = true;
+	thread_ = std::thread(&ReplaySource::run, this);
+	return 0;
+}
+
+void ReplaySource::stop()
+{
+	running_ = false;
+	if (thread_.joinable())
+		thread_.join();
+}
+
+int ReplaySource::setFrameDuration(std::chrono::microseconds duration)
+{
+	frameDuration_ = std::chrono::nanoseconds(duration).count();
+	return 0;
+}
+
+/*
+ * Like a sensor, a new frame duration applies from the frame after the
+ * one being waited for.
+ */
+void ReplaySource::run()
+{
+	const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(1.0 / fps_));
+	auto next = std::chrono::steady_clock::now();
+	uint64_t sequence = 0;
+
+	place_current_thread(ThreadRole::Capture);
+
+	while (running_) {
+		std::this_thread::sleep_until(next);
+
+		int64_t duration = frameDuration_;
+		next += duration ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+					   std::chrono::nanoseconds(duration))
+				 : interval;
+
+		if (inFlight_ >= depth_ || !frameReady_) {
+			dropped_++;
+			sequence++;
+			continue;
+		}
+
+		inFlight_++;
+
+		Frame frame;
+		frame.source = id_;
+		frame.sequence = sequence;
+		frame.timestamp = std::chrono::steady_clock::now();
+		frame.image = images_[sequence % images_.size()];
+		frame.release = [this]() { inFlight_--; };
+
+		sequence++;
+		frameReady_(std::move(frame));
+	}
+}
@@ -0,0 +1,54 @@
+/*
+ * replay_source.h - FrameSource replaying still images from disk
+ */
+#ifndef REPLAY_SOURCE_H
+#define REPLAY_SOURCE_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_source.h"
+
+/*
+ * Stand-in for a camera when no sensor is attached. The images are decoded
+ * once at load time and delivered in a loop at a fixed frame rate. Like a
+ * camera with a fixed request ring, at most `depth` frames can be in flight;
+ * captures that find every slot busy are dropped.
+ */
+class ReplaySource : public FrameSource
+{
+public:
+	ReplaySource(const std::vector<std::string> &paths, double fps,
+		     unsigned int depth = 4);
+	~ReplaySource();
+
+	std::string name() const override;
+	cv::Size frameSize() const override;
+
+	int load();
+
+	int start() override;
+	void stop() override;
+	int setFrameDuration(std::chrono::microseconds duration) override;
+
+	uint64_t dropped() const { return dropped_; }
+
+private:
+	void run();
+
+	std::vector<std::string> paths_;
+	std::vector<cv::Mat> images_;
+	double fps_;
+	unsigned int depth_;
+	/* Frame period in nanoseconds, zero for the rate given at creation. */
+	std::atomic<int64_t> frameDuration_;
+
+	std::thread thread_;
+	std::atomic<bool> running_;
+	std::atomic<unsigned int> inFlight_;
+	std::atomic<uint64_t> dropped_;
+};
+
+#endif
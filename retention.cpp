@@ -0,0 +1,243 @@
+/*
+ * retention.cpp - Byte and file quota for captured media
+ */
+
+#include "retention.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "thread_placement.h"
+
+/* Files are unlinked in batches of at most this many per wakeup. */
+#define RETENTION_BATCH 64
+
+struct linux_dirent64
+{
+	ino64_t d_ino;
+	off64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+std::atomic<RetentionManager *> RetentionManager::instance_(nullptr);
+
+static bool ends_with(const char *name, const char *suffix)
+{
+	size_t len = strlen(name);
+	size_t slen = strlen(suffix);
+	return len > slen && !strcmp(name + len - slen, suffix);
+}
+
+static bool is_stamp(const char *s)
+{
+	for (int i = 0; i < 15; i++) {
+		if (i == 8 ? s[i] != '_' : (s[i] < '0' || s[i] > '9'))
+			return false;
+	}
+	return true;
+}
+
+RetentionManager::RetentionManager(const std::string &dir,
+				   const std::vector<std::string> &prefixes,
+				   uint64_t maxBytes, uint64_t maxFiles)
+	: dir_(dir), prefixes_(prefixes), dirfd_(-1), maxBytes_(maxBytes),
+	  maxFiles_(maxFiles), bytes_(0), running_(false)
+{
+}
+
+/*
+ * The stamp in `name` if one of our writers could have produced it, else
+ * null. Frames, crops and event frames always carry more after the stamp,
+ * segments may not, so a bare "<stamp>.jpg" from elsewhere is left alone.
+ */
+const char *RetentionManager::ownedStamp(const char *name) const
+{
+	if (!ends_with(name, ".jpg") && !ends_with(name, ".mjpc"))
+		return nullptr;
+
+	for (const std::string &prefix : prefixes_) {
+		if (strncmp(name, prefix.c_str(), prefix.size()))
+			continue;
+
+		const char *stamp = name + prefix.size();
+		if (strlen(stamp) > 15 && is_stamp(stamp) &&
+		    (stamp[15] == '_' || !strcmp(stamp + 15, ".mjpc")))
+			return stamp;
+	}
+
+	return nullptr;
+}
+
+RetentionManager::~RetentionManager()
+{
+	stop();
+	if (dirfd_ >= 0)
+		close(dirfd_);
+}
+
+int RetentionManager::scan()
+{
+	if (dirfd_ < 0)
+		dirfd_ = open(dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dirfd_ < 0) {
+		std::cerr << "Failed to open " << dir_ << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	struct Scanned {
+		std::string key;
+		Entry entry;
+	};
+	std::vector<Scanned> entries;
+	alignas(8) char buffer[32768];
+
+	lseek(dirfd_, 0, SEEK_SET);
+	while (true) {
+		long nread = syscall(SYS_getdents64, dirfd_, buffer, sizeof(buffer));
+		if (nread < 0) {
+			std::cerr << "getdents64 failed on " << dir_ << ": " << strerror(errno) << std::endl;
+			return -1;
+		}
+		if (nread == 0)
+			break;
+
+		for (long pos = 0; pos < nread; ) {
+			const linux_dirent64 *d = reinterpret_cast<const linux_dirent64 *>(buffer + pos);
+			pos += d->d_reclen;
+
+			const char *stamp = ownedStamp(d->d_name);
+			if ((d->d_type != DT_REG && d->d_type != DT_UNKNOWN) || !stamp)
+				continue;
+
+			struct stat st;
+			if (fstatat(dirfd_, d->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+			    !S_ISREG(st.st_mode))
+				continue;
+
+			entries.push_back({ stamp,
+					    { d->d_name, static_cast<uint64_t>(st.st_size) } });
+		}
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const Scanned &a, const Scanned &b) {
+		return a.key < b.key;
+	});
+
+	std::unique_lock<std::mutex> locker(lock_);
+	index_.clear();
+	bytes_ = 0;
+	for (Scanned &scanned : entries) {
+		bytes_ += scanned.entry.size;
+		index_.push_back(std::move(scanned.entry));
+	}
+
+	std::cout << "Retention: " << index_.size() << " files, "
+		  << (bytes_ >> 20) << " MiB in " << dir_ << std::endl;
+
+	enforce();
+	return 0;
+}
+
+void RetentionManager::start()
+{
+	running_ = true;
+	instance_ = this;
+	thread_ = std::thread(&RetentionManager::run, this);
+
+	cond_.notify_one();
+}
+
+void RetentionManager::stop()
+{
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		if (!running_)
+			return;
+		running_ = false;
+		instance_ = nullptr;
+	}
+
+	cond_.notify_one();
+	thread_.join();
+}
+
+void RetentionManager::track(const std::string &name, uint64_t size)
+{
+	RetentionManager *manager = instance_.load();
+	if (manager)
+		manager->add(name, size);
+}
+
+void RetentionManager::add(const std::string &name, uint64_t size)
+{
+	bool evicted;
+
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		/* A writer may have loaded the instance just before stop(). */
+		if (!running_)
+			return;
+
+		index_.push_back({ name, size });
+		bytes_ += size;
+		enforce();
+		evicted = !doomed_.empty();
+	}
+
+	if (evicted)
+		cond_.notify_one();
+}
+
+/*
+ * Pop the oldest files until both quotas hold. The actual unlink happens on
+ * the background thread. Must be called with lock_ held.
+ */
+void RetentionManager::enforce()
+{
+	while (!index_.empty() &&
+	       ((maxBytes_ && bytes_ > maxBytes_) ||
+		(maxFiles_ && index_.size() > maxFiles_))) {
+		Entry &oldest = index_.front();
+		bytes_ -= oldest.size;
+		doomed_.push_back(std::move(oldest.name));
+		index_.pop_front();
+	}
+}
+
+void RetentionManager::run()
+{
+	std::vector<std::string> batch;
+	batch.reserve(RETENTION_BATCH);
+
+	place_current_thread(ThreadRole::Io);
+
+	std::unique_lock<std::mutex> locker(lock_);
+	while (true) {
+		cond_.wait(locker, [this]() { return !running_ || !doomed_.empty(); });
+
+		/* Finish pending deletions before honouring stop(). */
+		if (doomed_.empty())
+			return;
+
+		size_t count = std::min<size_t>(doomed_.size(), RETENTION_BATCH);
+		batch.assign(std::make_move_iterator(doomed_.begin()),
+			     std::make_move_iterator(doomed_.begin() + count));
+		doomed_.erase(doomed_.begin(), doomed_.begin() + count);
+
+		locker.unlock();
+		for (const std::string &name : batch)
+			if (unlinkat(dirfd_, name.c_str(), 0) < 0 && errno != ENOENT)
+				std::cerr << "Failed to delete " << name << ": " << strerror(errno) << std::endl;
+		batch.clear();
+		locker.lock();
+	}
+}
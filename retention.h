@@ -0,0 +1,80 @@
+/*
+ * retention.h - Byte and file quota for captured media
+ */
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Keeps an in-memory index of the media files in one directory, oldest
+ * first. Writers report every new file through track(); when the byte or
+ * file quota is exceeded the oldest entries are popped from the index in
+ * O(1) each and handed in batches to a background thread that unlinks
+ * them, so the directory is never rescanned after start-up.
+ *
+ * The directory may hold files this program did not write, so the scan
+ * only takes the names its writers produce: one of `prefixes`, such as ""
+ * for frames and crops or "event_src0_" for events, then a
+ * YYYYmmdd_HHMMSS stamp followed by '_' or ".mjpc", ending in .jpg or
+ * .mjpc. Files are ordered by that stamp. Sizes are file sizes in bytes,
+ * as reported by the writers.
+ */
+class RetentionManager
+{
+public:
+	RetentionManager(const std::string &dir, const std::vector<std::string> &prefixes,
+			 uint64_t maxBytes, uint64_t maxFiles);
+	~RetentionManager();
+
+	/* Rebuild the index with a single getdents64 pass over the directory. */
+	int scan();
+
+	void start();
+	void stop();
+
+	/* Record a newly written file. No-op when no manager is running. */
+	static void track(const std::string &name, uint64_t size);
+
+	uint64_t bytes() const { return bytes_; }
+	uint64_t files() const { return index_.size(); }
+
+private:
+	struct Entry {
+		std::string name;
+		uint64_t size;
+	};
+
+	/* Read by every writer thread, set and cleared by start() and stop(). */
+	static std::atomic<RetentionManager *> instance_;
+
+	void add(const std::string &name, uint64_t size);
+	void enforce();
+	void run();
+
+	const char *ownedStamp(const char *name) const;
+
+	std::string dir_;
+	std::vector<std::string> prefixes_;
+	int dirfd_;
+	uint64_t maxBytes_;
+	uint64_t maxFiles_;
+
+	std::deque<Entry> index_;
+	uint64_t bytes_;
+
+	std::vector<std::string> doomed_;
+	std::mutex lock_;
+	std::condition_variable cond_;
+	bool running_;
+	std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,219 @@
+/*
+ * runtime_config.cpp - Hot-reloadable runtime configuration
+ */
+
+#include "runtime_config.h"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "ncnn_inference.h"
+
+static std::string trim(const std::string &text)
+{
+	size_t first = text.find_first_not_of(" \t\r");
+	if (first == std::string::npos)
+		return "";
+	size_t last = text.find_last_not_of(" \t\r");
+	return text.substr(first, last - first + 1);
+}
+
+bool RuntimeConfig::sameStream(const RuntimeConfig &other) const
+{
+	return width == other.width && height == other.height;
+}
+
+bool RuntimeConfig::sameModel(const RuntimeConfig &other) const
+{
+	return modelParam == other.modelParam && modelBin == other.modelBin &&
+	       modelBundle == other.modelBundle;
+}
+
+static bool same_polygons(const std::vector<RegionFilter::Polygon> &a,
+			  const std::vector<RegionFilter::Polygon> &b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].size() != b[i].size())
+			return false;
+		for (size_t j = 0; j < a[i].size(); j++)
+			if (a[i][j].x != b[i][j].x || a[i][j].y != b[i][j].y)
+				return false;
+	}
+
+	return true;
+}
+
+bool RuntimeConfig::sameRegions(const RuntimeConfig &other) const
+{
+	return same_polygons(regions, other.regions) &&
+	       same_polygons(exclusions, other.exclusions);
+}
+
+int parse_runtime_config(const std::string &path, RuntimeConfig &config)
+{
+	std::ifstream in(path);
+	if (!in) {
+		std::cerr << "Failed to open " << path << std::endl;
+		return -1;
+	}
+
+	RuntimeConfig parsed = config;
+	bool regions = false, exclusions = false;
+	std::string line;
+	unsigned int number = 0;
+
+	while (std::getline(in, line)) {
+		number++;
+		line = trim(line);
+		if (line.empty() || line[0] == '#')
+			continue;
+
+		size_t equals = line.find('=');
+		if (equals == std::string::npos) {
+			std::cerr << path << ":" << number << ": expected key = value" << std::endl;
+			return -1;
+		}
+
+		std::string key = trim(line.substr(0, equals));
+		std::string value = trim(line.substr(equals + 1));
+		bool valid = true;
+
+		try {
+			if (key == "prob_threshold") {
+				parsed.probThreshold = std::stof(value);
+			} else if (key == "nms_threshold") {
+				parsed.nmsThreshold = std::stof(value);
+			} else if (key == "input_size") {
+				parsed.inputSize = std::stoi(value);
+				valid = valid_input_size(parsed.inputSize);
+			} else if (key == "quality") {
+				parsed.quality = std::stoi(value);
+				valid = parsed.quality > 0 && parsed.quality <= 100;
+			} else if (key == "timeout") {
+				parsed.timeout = std::stoul(value);
+			} else if (key == "width") {
+				parsed.width = std::stoul(value);
+			} else if (key == "height") {
+				parsed.height = std::stoul(value);
+			} else if (key == "model_param") {
+				parsed.modelParam = value;
+			} else if (key == "model_bin") {
+				parsed.modelBin = value;
+			} else if (key == "model_bundle") {
+				parsed.modelBundle = value;
+			} else if (key == "roi" || key == "exclude") {
+				std::vector<RegionFilter::Polygon> &list =
+					key == "roi" ? parsed.regions : parsed.exclusions;
+				bool &seen = key == "roi" ? regions : exclusions;
+				if (!seen)
+					list.clear();
+				seen = true;
+
+				RegionFilter::Polygon polygon;
+				valid = RegionFilter::parsePolygon(value, polygon);
+				list.push_back(polygon);
+			} else {
+				std::cerr << path << ":" << number << ": unknown key '"
+					  << key << "'" << std::endl;
+				return -1;
+			}
+		} catch (const std::exception &) {
+			valid = false;
+		}
+
+		if (!valid) {
+			std::cerr << path << ":" << number << ": invalid value for "
+				  << key << std::endl;
+			return -1;
+		}
+	}
+
+	config = parsed;
+	return 0;
+}
+
+ConfigWatcher::ConfigWatcher(EventLoop &loop, const RuntimeConfig &defaults)
+	: loop_(loop), defaults_(defaults), fd_(-1),
+	  current_(std::make_shared<const RuntimeConfig>(defaults)), version_(0)
+{
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+	if (fd_ >= 0)
+		close(fd_);
+}
+
+int ConfigWatcher::watch(const std::string &path)
+{
+	RuntimeConfig config = defaults_;
+	if (parse_runtime_config(path, config))
+		return -1;
+
+	std::atomic_store(&current_, std::shared_ptr<const RuntimeConfig>(
+		std::make_shared<const RuntimeConfig>(config)));
+	version_.fetch_add(1, std::memory_order_release);
+
+	path_ = path;
+	size_t slash = path.rfind('/');
+	std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+	name_ = slash == std::string::npos ? path : path.substr(slash + 1);
+
+	fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd_ < 0 ||
+	    inotify_add_watch(fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		std::cerr << "Failed to watch " << dir << ": " << strerror(errno) << std::endl;
+		return -1;
+	}
+
+	loop_.addFdEvent(fd_, EventLoop::Read, std::bind(&ConfigWatcher::readEvents, this));
+	return 0;
+}
+
+void ConfigWatcher::readEvents()
+{
+	alignas(struct inotify_event) char buffer[4096];
+	bool changed = false;
+	ssize_t len;
+
+	/* Coalesce the burst of events an editor produces into one reload. */
+	while ((len = read(fd_, buffer, sizeof(buffer))) > 0) {
+		for (char *ptr = buffer; ptr < buffer + len; ) {
+			const struct inotify_event *event =
+				reinterpret_cast<const struct inotify_event *>(ptr);
+			if (event->len && name_ == event->name)
+				changed = true;
+			ptr += sizeof(struct inotify_event) + event->len;
+		}
+	}
+
+	if (changed)
+		reload();
+}
+
+void ConfigWatcher::reload()
+{
+	RuntimeConfig config = defaults_;
+	if (parse_runtime_config(path_, config)) {
+		std::cerr << "Keeping the previous configuration" << std::endl;
+		return;
+	}
+
+	std::shared_ptr<const RuntimeConfig> previous = snapshot();
+	std::shared_ptr<const RuntimeConfig> current =
+		std::make_shared<const RuntimeConfig>(config);
+
+	std::atomic_store(&current_, current);
+	version_.fetch_add(1, std::memory_order_release);
+
+	std::cout << "Reloaded " << path_ << std::endl;
+	if (handler_)
+		handler_(*previous, *current);
+}
@@ -0,0 +1,132 @@
+/*
+ * runtime_config.h - Hot-reloadable runtime configuration
+ */
+#ifndef RUNTIME_CONFIG_H
+#define RUNTIME_CONFIG_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "event_loop.h"
+#include "region_filter.h"
+
+/*
+ * Settings that can change while capturing. Every field has the value
+ * given on the command line unless the configuration file sets it.
+ */
+struct RuntimeConfig
+{
+	float probThreshold = 0.25f;
+	float nmsThreshold = 0.45f;
+	int inputSize = 640;
+	int quality = 85;
+	unsigned int timeout = 1;
+
+	/*
+	 * Camera stream size, changing it reconfigures the cameras. Zero to
+	 * pick a sensor mode from the input size, regions and outputs.
+	 */
+	unsigned int width = 0;
+	unsigned int height = 0;
+
+	/*
+	 * Changing the model reloads the detector. A bundle path takes
+	 * precedence over the text param and weights.
+	 */
+	std::string modelParam;
+	std::string modelBin;
+	std::string modelBundle;
+
+	std::vector<RegionFilter::Polygon> regions;
+	std::vector<RegionFilter::Polygon> exclusions;
+
+	bool sameStream(const RuntimeConfig &other) const;
+	bool sameModel(const RuntimeConfig &other) const;
+	bool sameRegions(const RuntimeConfig &other) const;
+};
+
+/*
+ * Parse "key = value" lines onto config. Blank lines and lines starting
+ * with '#' are ignored. roi and exclude may be repeated; if present they
+ * replace the polygons inherited from the command line. Returns -1 and
+ * leaves config untouched if any line is invalid.
+ */
+int parse_runtime_config(const std::string &path, RuntimeConfig &config);
+
+/*
+ * Publishes the configuration as immutable snapshots. The watcher thread,
+ * here the EventLoop, builds a new RuntimeConfig when the file changes and
+ * swaps it in atomically; readers holding the previous snapshot keep a
+ * consistent view until they drop it. The file's directory is watched
+ * with inotify rather than the file itself, so editors that save through
+ * rename are seen too.
+ */
+class ConfigWatcher
+{
+public:
+	typedef std::function<void(const RuntimeConfig &previous,
+				   const RuntimeConfig &current)> ChangeHandler;
+
+	ConfigWatcher(EventLoop &loop, const RuntimeConfig &defaults);
+	~ConfigWatcher();
+
+	/* Load path and watch it for changes. */
+	int watch(const std::string &path);
+
+	void setChangeHandler(const ChangeHandler &handler) { handler_ = handler; }
+
+	std::shared_ptr<const RuntimeConfig> snapshot() const
+	{
+		return std::atomic_load(&current_);
+	}
+	uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+private:
+	void readEvents();
+	void reload();
+
+	EventLoop &loop_;
+	RuntimeConfig defaults_;
+	std::string path_;
+	std::string name_;
+	int fd_;
+
+	std::shared_ptr<const RuntimeConfig> current_;
+	std::atomic<uint64_t> version_;
+	ChangeHandler handler_;
+};
+
+/*
+ * Per-thread view of the current snapshot. get() costs one atomic load
+ * while the configuration is unchanged and only re-reads the shared
+ * pointer after a reload, so it is cheap enough for every frame.
+ */
+class ConfigReader
+{
+public:
+	ConfigReader(const ConfigWatcher &watcher)
+		: watcher_(watcher), version_(~0ULL)
+	{
+	}
+
+	const RuntimeConfig &get()
+	{
+		uint64_t version = watcher_.version();
+		if (version != version_) {
+			snapshot_ = watcher_.snapshot();
+			version_ = version;
+		}
+		return *snapshot_;
+	}
+
+private:
+	const ConfigWatcher &watcher_;
+	uint64_t version_;
+	std::shared_ptr<const RuntimeConfig> snapshot_;
+};
+
+#endif
@@ -1,9 +1,40 @@
 #ifndef SAVE_JPEG_H
 #define SAVE_JPEG_H
 
+#include <string>
+#include <vector>
+
 #include <opencv4/opencv2/core.hpp>
 #include <opencv4/opencv2/opencv.hpp>
 
-void save_jpeg(cv::Mat save_img);
+#include "ncnn_inference.h"
+
+struct CropSaveOptions
+{
+	/* Margin added around each box, as a fraction of its size. */
+	float padding = 0.15f;
+	int quality = 85;
+	/* Width of the downscaled full-frame context image, 0 to disable. */
+	int thumbnailWidth = 320;
+	int thumbnailQuality = 60;
+};
+
+bool encode_jpeg(const cv::Mat &image, int quality, std::vector<unsigned char> &jpeg);
+
+/*
+ * Encode frames of a megapixel or more in parallel strips on `threads`
+ * threads, 1 for the single-threaded encoder. Call before any encoding.
+ */
+void set_jpeg_threads(unsigned int threads);
+
+/* Both functions return the number of bytes written to disk. */
+size_t save_jpeg(cv::Mat save_img, int quality = 95);
+
+/*
+ * Encode only the padded detection boxes, cut straight out of the source
+ * buffer without copying the frame, plus an optional context thumbnail.
+ */
+size_t save_crops(const cv::Mat &image, const std::vector<Object> &objects,
+		  const CropSaveOptions &options = CropSaveOptions());
 
 #endif
@@ -0,0 +1,56 @@
+/*
+ * sensor_mode.cpp - Choice of sensor readout from what the pipeline needs
+ */
+
+#include "sensor_mode.h"
+
+#include <algorithm>
+#include <cmath>
+
+#define MAX_BINNING 4
+
+/*
+ * Binned modes are rounded to the sensor's alignment, 3280 / 2 = 1640 but
+ * 2592 / 4 = 648 read out as 640, so allow a little slack.
+ */
+#define BINNING_TOLERANCE 0.02
+
+static bool binned(const cv::Size &mode, const cv::Size &full)
+{
+	if (mode.width <= 0 || mode.height <= 0)
+		return false;
+
+	int factor = static_cast<int>(std::lround(static_cast<double>(full.width) / mode.width));
+	if (factor < 1 || factor > MAX_BINNING)
+		return false;
+
+	return std::fabs(static_cast<double>(mode.width) * factor / full.width - 1) <= BINNING_TOLERANCE &&
+	       std::fabs(static_cast<double>(mode.height) * factor / full.height - 1) <= BINNING_TOLERANCE;
+}
+
+static bool sufficient(const cv::Size &mode, const StreamNeeds &needs)
+{
+	float regionSide = std::max(needs.region.width * mode.width,
+				    needs.region.height * mode.height);
+
+	return regionSide >= needs.inputSize && mode.width >= needs.previewWidth;
+}
+
+cv::Size select_sensor_mode(const std::vector<cv::Size> &modes, const StreamNeeds &needs)
+{
+	if (modes.empty())
+		return cv::Size();
+
+	const cv::Size full = *std::max_element(modes.begin(), modes.end(),
+		[](const cv::Size &a, const cv::Size &b) { return a.area() < b.area(); });
+	if (needs.fullResolution)
+		return full;
+
+	cv::Size best = full;
+	for (const cv::Size &mode : modes) {
+		if (mode.area() < best.area() && binned(mode, full) && sufficient(mode, needs))
+			best = mode;
+	}
+
+	return best;
+}
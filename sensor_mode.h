@@ -0,0 +1,35 @@
+/*
+ * sensor_mode.h - Choice of sensor readout from what the pipeline needs
+ */
+#ifndef SENSOR_MODE_H
+#define SENSOR_MODE_H
+
+#include <vector>
+
+#include <opencv4/opencv2/core.hpp>
+
+/* What the consumers of a camera stream need from each frame. */
+struct StreamNeeds
+{
+	/* Detector input size, the side of the square letterboxed input. */
+	int inputSize = 640;
+	/* Part of the frame detected on, normalised to 0-1. */
+	cv::Rect2f region = cv::Rect2f(0, 0, 1, 1);
+	/* Width of the preview stream, 0 without a preview. */
+	int previewWidth = 0;
+	/* Full frames or crops of them are saved. */
+	bool fullResolution = false;
+};
+
+/*
+ * Pick the stream size from the sizes a sensor reads out, such as the
+ * StreamFormats of its raw stream. The full readout, the largest mode, is
+ * taken when full-resolution stills are needed. Otherwise the smallest mode
+ * that covers the whole field of view, being the full readout binned by 2,
+ * 3 or 4, and still gives the detector region at least inputSize pixels on
+ * its longest side and the preview its width. Modes that crop the sensor
+ * are never chosen. Returns an empty size for an empty list.
+ */
+cv::Size select_sensor_mode(const std::vector<cv::Size> &modes, const StreamNeeds &needs);
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * startup_profiler.cpp - Timestamps of each start-up phase up to the first detection
+ */
+
+#include "startup_profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+/*
+ * Steady clock time at which the process was started. /proc/self/stat
+ * gives the start time in clock ticks since boot, 10 ms resolution on
+ * most kernels, which is compared against CLOCK_BOOTTIME now.
+ */
+static std::chrono::steady_clock::time_point process_launch()
+{
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	std::ifstream in("/proc/self/stat");
+	std::string stat((std::istreambuf_iterator<char>(in)),
+			 std::istreambuf_iterator<char>());
+
+	/* The command name may contain spaces, fields resume after ')'. */
+	size_t paren = stat.rfind(')');
+	if (paren == std::string::npos)
+		return now;
+
+	std::istringstream fields(stat.substr(paren + 2));
+	std::string field;
+	for (int i = 3; i < 22 && fields >> field; i++)
+		;
+
+	unsigned long long startTicks;
+	struct timespec boot;
+	if (!(fields >> startTicks) || clock_gettime(CLOCK_BOOTTIME, &boot))
+		return now;
+
+	double sinceBoot = boot.tv_sec + boot.tv_nsec / 1e9;
+	double sinceLaunch = sinceBoot - static_cast<double>(startTicks) / sysconf(_SC_CLK_TCK);
+	if (sinceLaunch < 0)
+		return now;
+
+	return now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(sinceLaunch));
+}
+
+StartupProfiler::StartupProfiler()
+	: launch_(process_launch()), frameSeen_(false), detectionSeen_(false)
+{
+	phases_.push_back({ "process launch", launch_ });
+}
+
+void StartupProfiler::mark(const std::string &phase)
+{
+	std::unique_lock<std::mutex> locker(lock_);
+	phases_.push_back({ phase, std::chrono::steady_clock::now() });
+}
+
+void StartupProfiler::firstFrame()
+{
+	if (frameSeen_.load(std::memory_order_relaxed) || frameSeen_.exchange(true))
+		return;
+
+	mark("first frame");
+}
+
+void StartupProfiler::firstDetection()
+{
+	if (detectionSeen_.load(std::memory_order_relaxed) || detectionSeen_.exchange(true))
+		return;
+
+	mark("first detection");
+
+	std::chrono::duration<double> total = std::chrono::steady_clock::now() - launch_;
+	metrics().gauge("radaria_time_to_first_detection_seconds",
+			"Time from process launch to the first inference result")
+		.set(total.count());
+
+	report(std::cout);
+}
+
+void StartupProfiler::report(std::ostream &out) const
+{
+	std::unique_lock<std::mutex> locker(lock_);
+
+	std::vector<Phase> phases = phases_;
+	std::stable_sort(phases.begin(), phases.end(),
+			 [](const Phase &a, const Phase &b) { return a.time < b.time; });
+
+	out << "Start-up profile:" << std::endl;
+
+	std::chrono::steady_clock::time_point previous = launch_;
+	for (const Phase &phase : phases) {
+		std::chrono::duration<double, std::milli> at = phase.time - launch_;
+		std::chrono::duration<double, std::milli> step = phase.time - previous;
+		out << std::fixed << std::setprecision(1)
+		    << "\t" << std::setw(8) << at.count() << " ms  (+"
+		    << std::setw(7) << step.count() << ")  " << phase.name << std::endl;
+		previous = phase.time;
+	}
+}
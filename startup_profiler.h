@@ -0,0 +1,46 @@
+/*
+ * startup_profiler.h - Timestamps of each start-up phase up to the first detection
+ */
+#ifndef STARTUP_PROFILER_H
+#define STARTUP_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+ * Phases are timed from process launch as recorded by the kernel, so the
+ * dynamic loader and static constructors count too. Marks may come from
+ * any thread. The report is printed once, at the first detection.
+ */
+class StartupProfiler
+{
+public:
+	StartupProfiler();
+
+	void mark(const std::string &phase);
+
+	/* Cheap after the first call, safe on the per-frame path. */
+	void firstFrame();
+	void firstDetection();
+
+	void report(std::ostream &out) const;
+
+private:
+	struct Phase {
+		std::string name;
+		std::chrono::steady_clock::time_point time;
+	};
+
+	std::chrono::steady_clock::time_point launch_;
+	std::vector<Phase> phases_;
+	mutable std::mutex lock_;
+
+	std::atomic<bool> frameSeen_;
+	std::atomic<bool> detectionSeen_;
+};
+
+#endif
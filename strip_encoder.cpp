@@ -0,0 +1,252 @@
+/*
+ * strip_encoder.cpp - Parallel JPEG encoding of large frames in strips
+ */
+
+#include "strip_encoder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include <turbojpeg.h>
+
+#include "perf_counters.h"
+#include "thread_placement.h"
+
+#define MCU_ROWS 16
+#define MCU_COLUMNS 16
+
+/* The restart interval, one strip's MCUs, is a 16-bit field. */
+#define MAX_RESTART_INTERVAL 65535
+
+#define JPEG_SOF0 0xc0
+#define JPEG_SOF1 0xc1
+#define JPEG_RST0 0xd0
+#define JPEG_EOI 0xd9
+#define JPEG_SOS 0xda
+#define JPEG_DRI 0xdd
+
+struct Compressor
+{
+	Compressor() : handle(tjInitCompress()) {}
+	~Compressor() { tjDestroy(handle); }
+
+	tjhandle handle;
+};
+
+/* One compressor per thread, pool and callers alike. */
+static tjhandle compressor()
+{
+	thread_local Compressor compressor;
+	return compressor.handle;
+}
+
+/* Header offsets of a TurboJPEG baseline stream. */
+struct Layout
+{
+	size_t sof;
+	size_t sos;
+	/* First byte of entropy-coded data, after the SOS segment. */
+	size_t data;
+};
+
+static bool parse_layout(const std::vector<unsigned char> &jpeg, Layout &layout)
+{
+	if (jpeg.size() < 4 || jpeg[0] != 0xff || jpeg[1] != 0xd8 ||
+	    jpeg[jpeg.size() - 2] != 0xff || jpeg[jpeg.size() - 1] != JPEG_EOI)
+		return false;
+
+	layout.sof = 0;
+	size_t pos = 2;
+	while (pos + 4 <= jpeg.size() && jpeg[pos] == 0xff) {
+		unsigned char marker = jpeg[pos + 1];
+		size_t length = (jpeg[pos + 2] << 8) | jpeg[pos + 3];
+
+		if (marker == JPEG_SOF0 || marker == JPEG_SOF1)
+			layout.sof = pos;
+		else if (marker == JPEG_DRI)
+			return false;
+
+		if (marker == JPEG_SOS) {
+			layout.sos = pos;
+			layout.data = pos + 2 + length;
+			return layout.sof && layout.data < jpeg.size();
+		}
+
+		pos += 2 + length;
+	}
+
+	return false;
+}
+
+static bool compress(const cv::Mat &image, int quality, std::vector<unsigned char> &jpeg)
+{
+	PerfScope perf(PerfStage::Encode);
+	tjhandle handle = compressor();
+	unsigned long size = tjBufSize(image.cols, image.rows, TJSAMP_420);
+	jpeg.resize(size);
+
+	unsigned char *buffer = jpeg.data();
+	if (!handle ||
+	    tjCompress2(handle, image.data, image.cols, (int)image.step, image.rows,
+			TJPF_BGR, &buffer, &size, TJSAMP_420, quality, TJFLAG_NOREALLOC) < 0) {
+		std::cerr << "JPEG compression failed: "
+			  << (handle ? tjGetErrorStr2(handle) : tjGetErrorStr()) << std::endl;
+		jpeg.clear();
+		return false;
+	}
+
+	jpeg.resize(size);
+	return true;
+}
+
+/*
+ * Join the strips behind the headers of the first one. The headers must
+ * match byte for byte apart from the SOF height, or the strips were not
+ * coded with the same tables.
+ */
+static bool stitch(const std::vector<std::vector<unsigned char>> &strips, unsigned int height,
+		   unsigned int restartInterval, std::vector<unsigned char> &jpeg)
+{
+	std::vector<Layout> layouts(strips.size());
+	size_t total = 0;
+	for (unsigned int i = 0; i < strips.size(); i++) {
+		if (!parse_layout(strips[i], layouts[i]))
+			return false;
+		total += strips[i].size();
+	}
+
+	const std::vector<unsigned char> &first = strips[0];
+	const Layout &head = layouts[0];
+	for (unsigned int i = 1; i < strips.size(); i++) {
+		const Layout &layout = layouts[i];
+		if (layout.sof != head.sof || layout.data != head.data ||
+		    memcmp(strips[i].data(), first.data(), head.sof + 5) ||
+		    memcmp(strips[i].data() + head.sof + 7, first.data() + head.sof + 7,
+			   head.data - head.sof - 7))
+			return false;
+	}
+
+	jpeg.clear();
+	jpeg.reserve(total + 6 + strips.size() * 2);
+	jpeg.insert(jpeg.end(), first.begin(), first.begin() + head.sos);
+	jpeg[head.sof + 5] = height >> 8;
+	jpeg[head.sof + 6] = height & 0xff;
+
+	const unsigned char dri[] = {
+		0xff, JPEG_DRI, 0x00, 0x04,
+		static_cast<unsigned char>(restartInterval >> 8),
+		static_cast<unsigned char>(restartInterval & 0xff),
+	};
+	jpeg.insert(jpeg.end(), std::begin(dri), std::end(dri));
+	jpeg.insert(jpeg.end(), first.begin() + head.sos, first.begin() + head.data);
+
+	/* The encoder pads each scan to a byte with ones, as before a RSTn. */
+	for (unsigned int i = 0; i < strips.size(); i++) {
+		const std::vector<unsigned char> &strip = strips[i];
+		jpeg.insert(jpeg.end(), strip.begin() + layouts[i].data, strip.end() - 2);
+		if (i + 1 < strips.size()) {
+			jpeg.push_back(0xff);
+			jpeg.push_back(JPEG_RST0 + i % 8);
+		}
+	}
+
+	jpeg.push_back(0xff);
+	jpeg.push_back(JPEG_EOI);
+	return true;
+}
+
+StripEncoder::StripEncoder(unsigned int threads)
+	: running_(true)
+{
+	for (unsigned int i = 1; i < threads; i++)
+		threads_.emplace_back(&StripEncoder::run, this);
+}
+
+StripEncoder::~StripEncoder()
+{
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		running_ = false;
+	}
+	cond_.notify_all();
+
+	for (std::thread &thread : threads_)
+		thread.join();
+}
+
+/* Encoding competes with inference for the same cores. */
+void StripEncoder::run()
+{
+	place_current_thread(ThreadRole::Inference);
+
+	std::unique_lock<std::mutex> locker(lock_);
+	while (true) {
+		cond_.wait(locker, [this]() { return !running_ || !tasks_.empty(); });
+		if (tasks_.empty())
+			break;
+
+		std::function<void()> task = std::move(tasks_.front());
+		tasks_.pop_front();
+
+		locker.unlock();
+		task();
+		locker.lock();
+	}
+}
+
+bool StripEncoder::encode(const cv::Mat &image, int quality, std::vector<unsigned char> &jpeg)
+{
+	const unsigned int mcuRows = (image.rows + MCU_ROWS - 1) / MCU_ROWS;
+	const unsigned int mcuColumns = (image.cols + MCU_COLUMNS - 1) / MCU_COLUMNS;
+
+	unsigned int stripMcuRows = (mcuRows + threads() - 1) / threads();
+	stripMcuRows = std::min(stripMcuRows, MAX_RESTART_INTERVAL / mcuColumns);
+	const unsigned int count = stripMcuRows ? (mcuRows + stripMcuRows - 1) / stripMcuRows : 0;
+
+	if (count < 2)
+		return compress(image, quality, jpeg);
+
+	std::vector<std::vector<unsigned char>> strips(count);
+	std::vector<char> results(count);
+
+	auto encodeStrip = [&](unsigned int i) {
+		int top = i * stripMcuRows * MCU_ROWS;
+		int rows = std::min<int>(stripMcuRows * MCU_ROWS, image.rows - top);
+		results[i] = compress(image.rowRange(top, top + rows), quality, strips[i]);
+	};
+
+	std::mutex doneLock;
+	std::condition_variable done;
+	unsigned int pending = count - 1;
+
+	{
+		std::unique_lock<std::mutex> locker(lock_);
+		for (unsigned int i = 1; i < count; i++) {
+			tasks_.push_back([&, i]() {
+				encodeStrip(i);
+
+				std::unique_lock<std::mutex> doneLocker(doneLock);
+				if (--pending == 0)
+					done.notify_one();
+			});
+		}
+	}
+	cond_.notify_all();
+
+	encodeStrip(0);
+
+	std::unique_lock<std::mutex> doneLocker(doneLock);
+	done.wait(doneLocker, [&]() { return pending == 0; });
+	doneLocker.unlock();
+
+	if (std::find(results.begin(), results.end(), 0) != results.end())
+		return false;
+
+	if (!stitch(strips, image.rows, stripMcuRows * mcuColumns, jpeg)) {
+		std::cerr << "JPEG strips differ in their tables, encoding in one piece" << std::endl;
+		return compress(image, quality, jpeg);
+	}
+
+	return true;
+}
@@ -0,0 +1,47 @@
+/*
+ * strip_encoder.h - Parallel JPEG encoding of large frames in strips
+ */
+#ifndef STRIP_ENCODER_H
+#define STRIP_ENCODER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv4/opencv2/core.hpp>
+
+/*
+ * Splits a frame into horizontal strips whose heights are multiples of the
+ * 16-row 4:2:0 MCU, compresses them concurrently with the same tables and
+ * stitches the scans into a single baseline JPEG. Each strip becomes one
+ * restart interval, announced by a DRI segment and separated by RSTn
+ * markers, which resets the DC predictors exactly as the start of a new
+ * image does, so the result decodes with any standard decoder.
+ *
+ * The calling thread encodes the first strip itself, `threads - 1` pool
+ * threads the others. encode() is thread-safe.
+ */
+class StripEncoder
+{
+public:
+	explicit StripEncoder(unsigned int threads);
+	~StripEncoder();
+
+	unsigned int threads() const { return threads_.size() + 1; }
+
+	bool encode(const cv::Mat &image, int quality, std::vector<unsigned char> &jpeg);
+
+private:
+	void run();
+
+	std::vector<std::thread> threads_;
+	std::deque<std::function<void()>> tasks_;
+	std::mutex lock_;
+	std::condition_variable cond_;
+	bool running_;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * thread_placement.cpp - Core sets and scheduling policy per thread role
+ */
+
+#include "thread_placement.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <pthread.h>
+#include <sched.h>
+
+static ThreadPlacement placement_;
+
+/* Affinity of the process at start-up, restored on unpinned roles. */
+static cpu_set_t defaultCpus_;
+
+const std::vector<int> &ThreadPlacement::cpus(ThreadRole role) const
+{
+	switch (role) {
+	case ThreadRole::Capture:
+	case ThreadRole::Control:
+		return capture;
+	case ThreadRole::Inference:
+		return inference;
+	case ThreadRole::Io:
+	default:
+		return io;
+	}
+}
+
+bool ThreadPlacement::empty() const
+{
+	return capture.empty() && inference.empty() && io.empty() &&
+	       !capturePriority;
+}
+
+int parse_cpu_list(const std::string &list, std::vector<int> &cpus)
+{
+	std::vector<int> parsed;
+	std::stringstream ss(list);
+	std::string item;
+
+	while (std::getline(ss, item, ',')) {
+		int first, last;
+		char dash;
+		std::stringstream range(item);
+
+		if (!(range >> first))
+			return -1;
+		last = first;
+		if (range >> dash && (dash != '-' || !(range >> last)))
+			return -1;
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			return -1;
+
+		for (int cpu = first; cpu <= last; cpu++)
+			parsed.push_back(cpu);
+	}
+
+	if (parsed.empty())
+		return -1;
+
+	cpus = parsed;
+	return 0;
+}
+
+int parse_thread_pin(const std::string &spec, ThreadPlacement &placement)
+{
+	size_t eq = spec.find('=');
+	if (eq == std::string::npos)
+		return -1;
+
+	std::string role = spec.substr(0, eq);
+	std::vector<int> *cpus;
+	if (role == "capture")
+		cpus = &placement.capture;
+	else if (role == "inference")
+		cpus = &placement.inference;
+	else if (role == "io")
+		cpus = &placement.io;
+	else
+		return -1;
+
+	return parse_cpu_list(spec.substr(eq + 1), *cpus);
+}
+
+void set_thread_placement(const ThreadPlacement &placement)
+{
+	placement_ = placement;
+
+	CPU_ZERO(&defaultCpus_);
+	if (sched_getaffinity(0, sizeof(defaultCpus_), &defaultCpus_)) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			CPU_SET(cpu, &defaultCpus_);
+	}
+}
+
+const ThreadPlacement &thread_placement()
+{
+	return placement_;
+}
+
+/*
+ * Threads inherit the affinity and policy of their creator, so a worker
+ * started from a pinned real-time thread must be given its own role's
+ * placement explicitly, including when that role is unpinned.
+ */
+int place_current_thread(ThreadRole role)
+{
+	static std::atomic<bool> priorityWarned(false);
+	const std::vector<int> &cpus = placement_.cpus(role);
+	int ret = 0;
+
+	if (placement_.empty())
+		return 0;
+
+	cpu_set_t set = defaultCpus_;
+	if (!cpus.empty()) {
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+			CPU_SET(cpu, &set);
+	}
+
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (err) {
+		std::cerr << "Failed to pin thread: " << strerror(err) << std::endl;
+		ret = -1;
+	}
+
+	if (placement_.capturePriority) {
+		bool realtime = role == ThreadRole::Capture;
+		struct sched_param param = {};
+		param.sched_priority = realtime ? placement_.capturePriority : 0;
+
+		err = pthread_setschedparam(pthread_self(),
+					    realtime ? SCHED_FIFO : SCHED_OTHER, &param);
+		if (err && realtime) {
+			if (!priorityWarned.exchange(true))
+				std::cerr << "Failed to set SCHED_FIFO priority "
+					  << param.sched_priority << ": "
+					  << strerror(err) << std::endl;
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
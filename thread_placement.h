@@ -0,0 +1,60 @@
+/*
+ * thread_placement.h - Core sets and scheduling policy per thread role
+ */
+#ifndef THREAD_PLACEMENT_H
+#define THREAD_PLACEMENT_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Capture covers the libcamera completion thread and replay pacing,
+ * inference the scheduler workers and their ncnn OpenMP threads, and I/O
+ * the background file threads. Control is the EventLoop thread: it runs on
+ * the capture cores but never real-time, as besides requeueing requests it
+ * reloads the config, warms up the detector and serves preview and metrics.
+ */
+enum class ThreadRole {
+	Capture,
+	Inference,
+	Io,
+	Control,
+};
+
+/*
+ * Cores each role may run on, empty to leave the role unpinned. A
+ * non-zero capture priority runs the capture threads under SCHED_FIFO so
+ * that completions are never delayed behind encoding or writing.
+ */
+struct ThreadPlacement
+{
+	std::vector<int> capture;
+	std::vector<int> inference;
+	std::vector<int> io;
+	int capturePriority = 0;
+
+	const std::vector<int> &cpus(ThreadRole role) const;
+	bool empty() const;
+};
+
+/* Parse a kernel style CPU list such as "0", "1-3" or "0,2-3". */
+int parse_cpu_list(const std::string &list, std::vector<int> &cpus);
+
+/* Parse one ROLE=CPUS pin, ROLE being capture, inference or io. */
+int parse_thread_pin(const std::string &spec, ThreadPlacement &placement);
+
+/*
+ * The placement is process wide. It is set once at start-up, before any
+ * role thread is created, and only read afterwards.
+ */
+void set_thread_placement(const ThreadPlacement &placement);
+const ThreadPlacement &thread_placement();
+
+/*
+ * Apply the placement of `role` to the calling thread. Failing to raise
+ * the priority, typically for lack of CAP_SYS_NICE, is reported once and
+ * leaves the thread pinned under its normal policy.
+ */
+int place_current_thread(ThreadRole role);
+
+#endif